@@ -27,7 +27,24 @@ def factorization(num):
     return '%d = %s' % (original, ' * '.join(factors))
 
 self_halting = len(sys.argv) > 1 and sys.argv[1] == '--self-halting'
+batched = len(sys.argv) > 1 and sys.argv[1] == '--batch'
 pid = os.getpid()
+
+# In batch mode, each line of input is a sequence number followed by the number to factor, and
+# each line of output is the same sequence number followed by the usual response.  Lines are read
+# one at a time via readline (iterating over sys.stdin would wait to fill a read-ahead buffer), and
+# each response is flushed right away so the farm can forward results as soon as they're ready.
+if batched:
+    for line in iter(sys.stdin.readline, ''):
+        seq, num = line.split()
+        num = int(num)
+        start = time.time()
+        response = factorization(num)
+        stop = time.time()
+        sys.stdout.write('%s %s [pid: %d, time: %g seconds]\n' % (seq, response, pid, stop - start))
+        sys.stdout.flush()
+    sys.exit(0)
+
 while True:
     if self_halting: os.kill(pid, signal.SIGSTOP)
     try: num = int(raw_input()) 
@@ -1,156 +1,281 @@
+/**
+ * File: farm.cc
+ * -------------
+ * Presents the implementation of the farm program, which reads numbers from standard input,
+ * distributes them across one factor.py worker per CPU, and prints each number's factorization
+ * in the same order the numbers were read.
+ *
+ * The farm and its workers speak a batched protocol (factor.py --batch).  Each number is tagged with
+ * a sequence number, numbers are handed to each worker in batches sized by that worker's observed
+ * throughput (every batch published in a single write), and the workers stream back result records
+ * tagged with the same sequence numbers, so the farm can restore input order no matter which worker
+ * finishes first.  All of the workers' pipes, along with the farm's own standard input, are multiplexed
+ * through a single SubprocessGroup, so a slow producer never keeps results from being collected.
+ */
+
+#include <algorithm>
 #include <cassert>
-#include <ctime>
 #include <cctype>
+#include <cerrno>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
+#include <deque>
 #include <iostream>
 #include <cstdlib>
+#include <map>
+#include <string>
 #include <vector>
-#include <sys/wait.h>
+#include <fcntl.h>
 #include <unistd.h>
-#include <sched.h>
-#include "subprocess.h"
-#include <signal.h>
-#include <ext/stdio_filebuf.h>
+#include "subprocess-group.h"
 
-using namespace __gnu_cxx;
 using namespace std;
 
 struct worker {
-    worker() {}
-
-    worker(char *argv[]) : sp(subprocess(argv, true, false)), available(false) {}
-
-    subprocess_t sp;
-    bool available;
+    size_t id;                        // the worker's id within the SubprocessGroup
+    size_t outstanding = 0;           // numbers handed to the worker but not yet factored
+    size_t completed = 0;             // numbers the worker has factored so far
+    chrono::steady_clock::time_point busySince;
+    chrono::duration<double> busyTime = chrono::duration<double>::zero();
 };
 
-static const size_t kNumCPUs = sysconf(_SC_NPROCESSORS_ONLN);
-// restore static keyword once you start using these, commented out to suppress compiler warning
-static vector<worker> workers;
-static size_t numWorkersAvailable = 0;
+/**
+ * Constants: kTargetBatchSeconds, kMaxBatchSize, kInputChunkSize
+ * --------------------------------------------------------------
+ * Each batch is sized so that a worker should take roughly kTargetBatchSeconds to
+ * work through it, given the rate it's factored numbers so far, but never contains more than
+ * kMaxBatchSize numbers (which keeps every batch well under the capacity of a pipe, so each
+ * one is published with a single write).  Input is pulled from standard input kInputChunkSize bytes
+ * at a time, and stops being pulled while a full batch for every worker is already waiting to be handed out.
+ */
+static const double kTargetBatchSeconds = 0.05;
+static const size_t kMaxBatchSize = 256;
+static const size_t kInputChunkSize = 1 << 16;
 
-static void markWorkersAsAvailable(int sig) {
-    while (true) {
-        pid_t child_pid = waitpid(-1, NULL, WNOHANG | WUNTRACED);
-        if (child_pid <= 0) break;
-        for (auto &w: workers) {
-            if (w.sp.pid == child_pid) {
-                w.available = true;
-                ++numWorkersAvailable;
-                break;
-            }
-        }
-    }
-}
+static const size_t kNumCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+static char *kWorkerArguments[] = {const_cast<char *>("./factor.py"), const_cast<char *>("--batch"), NULL};
 
-// restore static keyword once you start using it, commented out to suppress compiler warning
-static char *kWorkerArguments[] = {"./factor.py", "--self-halting", NULL};
+static vector<worker> workers;
+static deque<pair<size_t, string>> unassigned;   // (sequence number, number) pairs read but not yet handed out
+static map<size_t, string> results;              // results that arrived ahead of their turn
+static size_t numRead = 0;
+static size_t nextToPrint = 0;
+static bool inputExhausted = false;
+static bool inputWatched = false;   // true while standard input is in the group's epoll set
+static bool inputPollable = true;   // false if standard input is a regular file, which epoll refuses
+static int inputFlags;              // standard input's flags before it was made non-blocking
+static string partialInput;
 
-static void spawnAllWorkers() {
+static void spawnAllWorkers(SubprocessGroup &group) {
     cout << "There are this many CPUs: " << kNumCPUs << ", numbered 0 through " << kNumCPUs - 1 << "." << endl;
-//    int numWorkerArguments = sizeof(kWorkerArguments) / sizeof(kWorkerArguments[0]);
-//    char *workerArguments[numWorkerArguments];
-//    copy(kWorkerArguments, kWorkerArguments + numWorkerArguments, workerArguments);
     for (size_t i = 0; i < kNumCPUs; i++) {
         try {
-            worker worker_cpu(kWorkerArguments);
-            workers.push_back(worker_cpu);
-            cout << "Worker " << workers[i].sp.pid << " is set to run on CPU " << i << "." << endl;
-        } catch (SubprocessException e){
+            worker w;
+            w.id = group.spawn(kWorkerArguments, true, true);
+            workers.push_back(w);
+            cout << "Worker " << group.getPid(w.id) << " is set to run on CPU " << i << "." << endl;
+        } catch (const SubprocessException& e){
             cout << e.what() << endl;
         }
     }
+}
 
+/**
+ * Function: acceptNumber
+ * ----------------------
+ * Queues up a single line of input to be factored.  As before, the first line that isn't
+ * entirely a number marks the end of the input.
+ */
+static void acceptNumber(const string &line) {
+    size_t endpos = 0;
+    try {
+        stoll(line, &endpos);
+    } catch (const exception& e) {
+        endpos = string::npos;
+    }
+    if (endpos != line.size()) {
+        inputExhausted = true;
+        return;
+    }
+    unassigned.push_back(make_pair(numRead++, line));
 }
 
-static void blockSignal(sigset_t &sigset){
-    sigemptyset(&sigset);
-    sigaddset(&sigset, SIGCHLD);
-    sigprocmask(SIG_BLOCK, &sigset, NULL);
+/**
+ * Function: readMoreNumbers
+ * -------------------------
+ * Pulls the next large chunk of standard input in with a single read, and queues up every
+ * complete line within it.  If standard input is non-blocking and has nothing to offer just
+ * yet, nothing happens.
+ */
+static void readMoreNumbers() {
+    char buffer[kInputChunkSize];
+    ssize_t count;
+    do {
+        count = read(STDIN_FILENO, buffer, sizeof(buffer));
+    } while (count == -1 && errno == EINTR);
+
+    if (count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    if (count <= 0) {
+        if (!partialInput.empty()) acceptNumber(partialInput);
+        partialInput.clear();
+        inputExhausted = true;
+        return;
+    }
+
+    const char *start = buffer;
+    const char *end = buffer + count;
+    while (!inputExhausted) {
+        const char *newline = static_cast<const char *>(memchr(start, '\n', end - start));
+        if (newline == NULL) break;
+        partialInput.append(start, newline - start);
+        acceptNumber(partialInput);
+        partialInput.clear();
+        start = newline + 1;
+    }
+    if (!inputExhausted) partialInput.append(start, end - start);
 }
 
-static void unBlockSignal(sigset_t &sigset){
-    sigprocmask(SIG_UNBLOCK, &sigset, NULL);
+/**
+ * Function: batchSizeFor
+ * ----------------------
+ * Computes how many numbers the supplied worker should be handed next, based on how quickly
+ * it's factored numbers so far.  Workers that haven't finished anything yet get one number at a time.
+ */
+static size_t batchSizeFor(const worker &w) {
+    if (w.completed == 0 || w.busyTime.count() <= 0) return 1;
+    double rate = w.completed / w.busyTime.count();
+    return max<size_t>(1, min<size_t>(kMaxBatchSize, rate * kTargetBatchSeconds));
 }
 
-// restore static keyword once you start using it, commented out to suppress compiler warning
-static size_t getAvailableWorker() {
-    sigset_t sigset;
-    blockSignal(sigset);
-
-    sigset_t empty;
-    sigemptyset(&empty);
-
-    size_t worker_id;
-    while(true){
-        if (numWorkersAvailable > 0){
-            for (int i = 0; i < workers.size(); ++i) {
-                if (workers[i].available) {
-                    --numWorkersAvailable;
-                    workers[i].available = false;
-                    unBlockSignal(sigset);
-                    worker_id = i;
-                    return worker_id;
-                }
-            }
+/**
+ * Function: watchInput
+ * --------------------
+ * Adds standard input to (or removes it from) the group's epoll set, so that it's only read
+ * while it has more to offer and there's room to queue up what it does.  Standard input is
+ * non-blocking while it's watched, and has its original flags back once it's exhausted.
+ */
+static void watchInput(SubprocessGroup &group) {
+    bool wanted = !inputExhausted && unassigned.size() < kMaxBatchSize * workers.size();
+    if (!inputPollable || wanted == inputWatched) return;
+    if (wanted) {
+        auto handler = [&group](int) {
+            readMoreNumbers();
+            watchInput(group); // so standard input is unwatched as soon as it's exhausted
+        };
+        if (!group.watchDescriptor(STDIN_FILENO, handler)) {
+            inputPollable = false;
+            fcntl(STDIN_FILENO, F_SETFL, inputFlags);
+            return;
         }
-        sigsuspend(&empty);
+    } else {
+        group.unwatchDescriptor(STDIN_FILENO);
     }
+    inputWatched = wanted;
+    if (inputExhausted) fcntl(STDIN_FILENO, F_SETFL, inputFlags);
 }
 
-static void publishWordsToChild(int to, string &word) {
-    stdio_filebuf<char> outbuf(to, std::ios::out);
-    ostream os(&outbuf); // manufacture an ostream out of a write-oriented file descriptor so we can use C++ streams semantics (prettier!)
-    os << word << endl;
-} // stdio_filebuf destroyed, destructor calls close on desciptor it owns
+/**
+ * Function: assignWork
+ * --------------------
+ * Tops up every worker whose queue of outstanding numbers is running low.  A worker is handed
+ * another batch while it still has up to a batch of its own to chew on, so it never sits idle
+ * waiting for its next batch to arrive.  While standard input is still trickling in, busy workers
+ * wait for a full batch, but idle ones are handed whatever's been read so far.  Each batch is formatted
+ * into a single string and published with a single write.
+ */
+static void assignWork(SubprocessGroup &group) {
+    for (worker &w: workers) {
+        size_t batchSize = batchSizeFor(w);
+        if (w.outstanding > batchSize) continue;
+        // a regular file never blocks, so it's read as needed instead of through the epoll loop
+        while (!inputPollable && unassigned.size() < batchSize && !inputExhausted) readMoreNumbers();
+        if (unassigned.empty()) break;
+        if (unassigned.size() < batchSize && !inputExhausted && w.outstanding > 0) continue;
 
+        string batch;
+        size_t count = min(batchSize, unassigned.size());
+        for (size_t i = 0; i < count; i++) {
+            batch += to_string(unassigned.front().first) + " " + unassigned.front().second + "\n";
+            unassigned.pop_front();
+        }
+        if (w.outstanding == 0) w.busySince = chrono::steady_clock::now();
+        w.outstanding += count;
+        group.write(w.id, batch);
+    }
+    watchInput(group);
+}
 
-static void broadcastNumbersToWorkers() {
+/**
+ * Function: printReadyResults
+ * ---------------------------
+ * Prints every result whose turn it is, in input order.
+ */
+static void printReadyResults() {
+    bool printedAny = false;
     while (true) {
-        string line;
-        getline(cin, line);
-        if (cin.fail()) break;
-        size_t endpos;
-        /* long long num = */ stoll(line, &endpos);
-        if (endpos != line.size()) break;
-        size_t worker_id = getAvailableWorker();
-        kill(workers[worker_id].sp.pid, SIGCONT);
-        publishWordsToChild(workers[worker_id].sp.supplyfd, line);
-        // you shouldn't need all that many lines of additional code
+        auto found = results.find(nextToPrint);
+        if (found == results.end()) break;
+        cout << found->second << '\n';
+        results.erase(found);
+        nextToPrint++;
+        printedAny = true;
     }
+    if (printedAny) cout << flush;
 }
 
-static void waitForAllWorkers() {
-    sigset_t sigset;
-    blockSignal(sigset);
+/**
+ * Function: ingestResult
+ * ----------------------
+ * Handles a single result record streamed back by the supplied worker, which is the sequence number
+ * of the number factored, followed by a space and the response to be printed.
+ */
+static void ingestResult(worker &w, const string &line) {
+    size_t space = line.find(' ');
+    if (space == string::npos) return;
+    size_t seq = stoul(line.substr(0, space));
+    results[seq] = line.substr(space + 1);
 
-    sigset_t empty;
-    sigemptyset(&empty);
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    w.busyTime += now - w.busySince;
+    w.busySince = now;
+    w.completed++;
+    w.outstanding--;
+    printReadyResults();
+}
 
-    while(numWorkersAvailable != kNumCPUs){
-        sigsuspend(&empty);
+static bool allWorkDone() {
+    if (!inputExhausted || !unassigned.empty()) return false;
+    for (const worker &w: workers) {
+        if (w.outstanding > 0) return false;
     }
-    unBlockSignal(sigset);
+    return true;
 }
 
-static void closeAllWorkers() {
-    signal(SIGCHLD, SIG_DFL);
-    for (auto &w: workers){
-        kill(w.sp.pid, SIGCONT);
-        close(w.sp.supplyfd);
+static void farmNumbersToWorkers(SubprocessGroup &group) {
+    inputFlags = fcntl(STDIN_FILENO, F_GETFL);
+    fcntl(STDIN_FILENO, F_SETFL, inputFlags | O_NONBLOCK);
+    for (worker &w: workers) {
+        group.onLine(w.id, [&w](size_t, const string &line) { ingestResult(w, line); });
     }
 
-    while(true){
-        pid_t pid = waitpid(-1, NULL, 0);
-        if (pid < 0) break;
+    watchInput(group); // finds out up front whether standard input can be watched at all
+    while (!allWorkDone()) {
+        assignWork(group);
+        if (allWorkDone() || !group.step()) break;
     }
 }
 
+static void closeAllWorkers(SubprocessGroup &group) {
+    for (const worker &w: workers) group.closeInput(w.id);
+    group.run();
+    for (const worker &w: workers) group.wait(w.id);
+}
+
 int main(int argc, char *argv[]) {
-    signal(SIGCHLD, markWorkersAsAvailable);
-    spawnAllWorkers();
-    broadcastNumbersToWorkers();
-    waitForAllWorkers();
-    closeAllWorkers();
+    SubprocessGroup group;
+    spawnAllWorkers(group);
+    farmNumbersToWorkers(group);
+    closeAllWorkers(group);
     return 0;
 }
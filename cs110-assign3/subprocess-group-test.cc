@@ -0,0 +1,88 @@
+/**
+ * File: subprocess-group-test.cc
+ * ------------------------------
+ * Simple unit test to exercise the SubprocessGroup class.  It spawns a large number of
+ * children running /bin/sort, publishes the same handful of words to each of them, and
+ * confirms (via line handlers, futures, and chunk handlers) that every child hands back
+ * the same words in sorted order, without the parent ever blocking on any one child.  It also
+ * confirms that feeding a child that's already exited doesn't kill the parent with a SIGPIPE.
+ */
+
+#include "subprocess-group.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+
+using namespace std;
+
+static const string kSortExecutable = "/bin/sort";
+static const string kTrueExecutable = "/bin/true";
+static const string kWords[] = {"put", "a", "ring", "on", "it"};
+static const string kSortedWords[] = {"a", "it", "on", "put", "ring"};
+static const size_t kNumWords = sizeof(kWords) / sizeof(kWords[0]);
+static const size_t kNumChildren = 200;
+
+int main(int argc, char *argv[]) {
+  char *sortArgv[] = {const_cast<char *>(kSortExecutable.c_str()), NULL};
+  char *trueArgv[] = {const_cast<char *>(kTrueExecutable.c_str()), NULL};
+  try {
+    SubprocessGroup group;
+    vector<vector<string>> received(kNumChildren);
+    vector<string> chunks(kNumChildren);
+    for (size_t i = 0; i < kNumChildren; i++) {
+      size_t child = group.spawn(sortArgv, true, true);
+      if (i % 2 == 0) {
+        group.onLine(child, [&received](size_t child, const string& line) {
+          received[child].push_back(line);
+        });
+      } else {
+        group.onChunk(child, [&chunks](size_t child, const char *data, size_t length) {
+          chunks[child].append(data, length);
+        });
+      }
+      for (const string& word: kWords) group.write(child, word + "\n");
+      group.closeInput(child);
+    }
+    group.run();
+
+    size_t numFailures = 0;
+    for (size_t i = 0; i < kNumChildren; i++) {
+      string expected;
+      for (const string& word: kSortedWords) expected += word + "\n";
+      string actual = chunks[i];
+      if (i % 2 == 0) {
+        for (const string& line: received[i]) actual += line + "\n";
+      }
+      if (actual != expected) numFailures++;
+      if (!WIFEXITED(group.wait(i)) || WEXITSTATUS(group.wait(i)) != 0) numFailures++;
+    }
+
+    size_t child = group.spawn(sortArgv, true, true);
+    for (const string& word: kWords) group.write(child, word + "\n");
+    group.closeInput(child);
+    vector<future<string>> lines;
+    for (size_t i = 0; i <= kNumWords; i++) lines.push_back(group.nextLine(child));
+    group.run();
+    for (size_t i = 0; i < kNumWords; i++) {
+      if (lines[i].get() != kSortedWords[i]) numFailures++;
+    }
+    try {
+      lines[kNumWords].get();
+      numFailures++;
+    } catch (const SubprocessException& se) {}
+
+    size_t quitter = group.spawn(trueArgv, true, true);
+    group.wait(quitter);
+    group.write(quitter, string(1 << 20, 'x'));
+    group.closeInput(quitter);
+    group.run();
+
+    cout << (numFailures == 0 ? "All tests passed!" : "Some tests failed.") << endl;
+    return numFailures == 0 ? 0 : 1;
+  } catch (const SubprocessException& se) {
+    cerr << "Problem encountered while spawning processes to run \"" << kSortExecutable << "\"." << endl;
+    cerr << "More details here: " << se.what() << endl;
+    return 1;
+  }
+}
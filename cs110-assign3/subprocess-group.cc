@@ -0,0 +1,404 @@
+/**
+ * File: subprocess-group.cc
+ * -------------------------
+ * Presents the implementation of the SubprocessGroup class.
+ */
+
+#include "subprocess-group.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+/**
+ * Constants: kWakeupToken, kDescriptorTag, kMaxEvents, kReadChunkSize
+ * -------------------------------------------------------------------
+ * kWakeupToken tags the eventfd used to interrupt epoll_wait whenever another thread queues
+ * input, kDescriptorTag marks the tokens of descriptors added via watchDescriptor (whose low bits
+ * hold the descriptor itself), kMaxEvents caps the number of ready descriptors serviced per epoll_wait, and
+ * kReadChunkSize is the size of each read pulled off of a child's stdout.
+ */
+static const uint64_t kWakeupToken = UINT64_MAX;
+static const uint64_t kDescriptorTag = uint64_t(1) << 62;
+static const int kMaxEvents = 64;
+static const size_t kReadChunkSize = 1 << 16;
+
+/**
+ * Function: prepareDescriptor
+ * ---------------------------
+ * Makes the supplied parent-side descriptor non-blocking, and marks it close-on-exec so that
+ * children spawned later on don't inherit it (an inherited write end would otherwise keep
+ * a sibling from ever seeing EOF on its stdin).
+ */
+static void prepareDescriptor(int fd) {
+    if (fd == kNotInUse) return;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+/**
+ * Function: publish
+ * -----------------
+ * Writes to a child's stdin just as write does, except that if the child has closed its end,
+ * the write fails with EPIPE without raising a SIGPIPE that would otherwise kill the parent.
+ * SIGPIPE is blocked in the calling thread for the duration of the write, and the one the
+ * write raises, if any, is consumed before it's unblocked.
+ */
+static ssize_t publish(int fd, const char *data, size_t length) {
+    sigset_t sigpipe, original, pending;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, &original);
+    sigpending(&pending);
+    bool alreadyPending = sigismember(&pending, SIGPIPE);
+
+    ssize_t count = ::write(fd, data, length);
+    int error = errno;
+    if (count == -1 && error == EPIPE && !alreadyPending) {
+        struct timespec immediately = {0, 0};
+        while (sigtimedwait(&sigpipe, NULL, &immediately) == -1 && errno == EINTR) {}
+    }
+
+    pthread_sigmask(SIG_SETMASK, &original, NULL);
+    errno = error;
+    return count;
+}
+
+static uint64_t encodeToken(size_t id, bool input) {
+    return (uint64_t(id) << 1) | (input ? 1 : 0);
+}
+
+SubprocessGroup::SubprocessGroup() throw (SubprocessException) : numWatched(0) {
+    epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollfd == -1) throw SubprocessException("epoll_create1 failed");
+    wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakefd == -1) {
+        close(epollfd);
+        throw SubprocessException("eventfd failed");
+    }
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = kWakeupToken;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, wakefd, &event);
+}
+
+SubprocessGroup::~SubprocessGroup() {
+    for (size_t id = 0; id < children.size(); id++) {
+        child& c = *children[id];
+        if (c.supplyfd != kNotInUse) close(c.supplyfd);
+        if (c.ingestfd != kNotInUse) close(c.ingestfd);
+        if (!c.reaped) waitpid(c.pid, NULL, 0);
+    }
+    close(wakefd);
+    close(epollfd);
+}
+
+size_t SubprocessGroup::spawn(char *argv[], bool supplyChildInput, bool ingestChildOutput) throw (SubprocessException) {
+    lock_guard<mutex> lg(m);
+    subprocess_t sp = subprocess(argv, supplyChildInput, ingestChildOutput);
+    prepareDescriptor(sp.supplyfd);
+    prepareDescriptor(sp.ingestfd);
+
+    unique_ptr<child> c(new child);
+    c->pid = sp.pid;
+    c->supplyfd = sp.supplyfd;
+    c->ingestfd = sp.ingestfd;
+    size_t id = children.size();
+    children.push_back(move(c));
+    if (sp.ingestfd != kNotInUse) watch(sp.ingestfd, id, /* input = */ false, /* add = */ true);
+    return id;
+}
+
+pid_t SubprocessGroup::getPid(size_t id) const {
+    lock_guard<mutex> lg(m);
+    return lookup(id).pid;
+}
+
+SubprocessGroup::child& SubprocessGroup::lookup(size_t id) const {
+    if (id >= children.size()) throw SubprocessException("No such child: " + to_string(id));
+    return *children[id];
+}
+
+void SubprocessGroup::onLine(size_t id, const LineHandler& handler) {
+    lock_guard<mutex> lg(m);
+    lookup(id).lineHandler = handler;
+}
+
+void SubprocessGroup::onChunk(size_t id, const ChunkHandler& handler) {
+    lock_guard<mutex> lg(m);
+    lookup(id).chunkHandler = handler;
+}
+
+void SubprocessGroup::onEOF(size_t id, const EOFHandler& handler) {
+    lock_guard<mutex> lg(m);
+    lookup(id).eofHandler = handler;
+}
+
+future<string> SubprocessGroup::nextLine(size_t id) {
+    lock_guard<mutex> lg(m);
+    child& c = lookup(id);
+    promise<string> p;
+    future<string> f = p.get_future();
+    if (!c.lines.empty()) {
+        p.set_value(move(c.lines.front()));
+        c.lines.pop_front();
+    } else if (c.ingestfd == kNotInUse) {
+        p.set_exception(make_exception_ptr(SubprocessException("child " + to_string(id) + " has no more output")));
+    } else {
+        c.waiters.push_back(move(p));
+    }
+    return f;
+}
+
+/**
+ * Method: watch
+ * -------------
+ * Adds the supplied descriptor to (or removes it from) the epoll instance, tagged with the
+ * child id and direction so the event loop knows what to do with it.
+ */
+void SubprocessGroup::watch(int fd, size_t id, bool input, bool add) {
+    if (add) {
+        struct epoll_event event = {};
+        event.events = input ? EPOLLOUT : EPOLLIN;
+        event.data.u64 = encodeToken(id, input);
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+        numWatched++;
+    } else {
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL);
+        numWatched--;
+    }
+}
+
+void SubprocessGroup::write(size_t id, const string& data) {
+    lock_guard<mutex> lg(m);
+    child& c = lookup(id);
+    if (c.supplyfd == kNotInUse || c.closeRequested) return;
+    c.outbox += data;
+    flushOutbox(id, c);
+}
+
+void SubprocessGroup::closeInput(size_t id) {
+    lock_guard<mutex> lg(m);
+    child& c = lookup(id);
+    c.closeRequested = true;
+    flushOutbox(id, c);
+}
+
+/**
+ * Method: flushOutbox
+ * -------------------
+ * Publishes as much queued input as the child's pipe will accept without blocking.  If some
+ * input remains, the pipe is watched for writability (and the event loop is woken up, in case
+ * it's sleeping on some other thread); once everything has been published, the pipe is unwatched,
+ * and closed if closeInput has been called.
+ */
+void SubprocessGroup::flushOutbox(size_t id, child& c) {
+    if (c.supplyfd == kNotInUse) return;
+    size_t published = 0;
+    while (published < c.outbox.size()) {
+        ssize_t count = publish(c.supplyfd, c.outbox.data() + published, c.outbox.size() - published);
+        if (count > 0) {
+            published += count;
+        } else if (count == -1 && errno == EINTR) {
+            continue;
+        } else if (count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            c.outbox.clear(); // child closed its stdin (EPIPE), so nobody will ever read the rest
+            published = 0;
+            c.closeRequested = true;
+            break;
+        }
+    }
+    c.outbox.erase(0, published);
+
+    if (!c.outbox.empty()) {
+        if (!c.supplyRegistered) {
+            watch(c.supplyfd, id, /* input = */ true, /* add = */ true);
+            c.supplyRegistered = true;
+            wakeup();
+        }
+        return;
+    }
+
+    if (c.supplyRegistered) {
+        watch(c.supplyfd, id, /* input = */ true, /* add = */ false);
+        c.supplyRegistered = false;
+    }
+    if (c.closeRequested) closeSupply(c);
+}
+
+bool SubprocessGroup::watchDescriptor(int fd, const ReadableHandler& handler) {
+    lock_guard<mutex> lg(m);
+    if (descriptors.count(fd) == 0) {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = kDescriptorTag | uint64_t(fd);
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event) == -1) return false;
+        numWatched++;
+        wakeup();
+    }
+    descriptors[fd] = handler;
+    return true;
+}
+
+void SubprocessGroup::unwatchDescriptor(int fd) {
+    lock_guard<mutex> lg(m);
+    if (descriptors.erase(fd) == 0) return;
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL);
+    numWatched--;
+}
+
+void SubprocessGroup::closeSupply(child& c) {
+    close(c.supplyfd);
+    c.supplyfd = kNotInUse;
+}
+
+void SubprocessGroup::wakeup() {
+    uint64_t one = 1;
+    ssize_t ignored = ::write(wakefd, &one, sizeof(one));
+    (void) ignored;
+}
+
+/**
+ * Method: deliverLine
+ * -------------------
+ * Routes a single complete line to the oldest outstanding future, the line handler, or
+ * the backlog of unclaimed lines, in that order of preference.  Handlers aren't invoked
+ * here, since the lock is held; they're queued up in deliveries instead.
+ */
+void SubprocessGroup::deliverLine(size_t id, child& c, string line, vector<function<void()>>& deliveries) {
+    if (!c.waiters.empty()) {
+        c.waiters.front().set_value(move(line));
+        c.waiters.pop_front();
+    } else if (c.lineHandler) {
+        LineHandler handler = c.lineHandler;
+        shared_ptr<string> shared = make_shared<string>(move(line));
+        deliveries.push_back([handler, id, shared] { handler(id, *shared); });
+    } else {
+        c.lines.push_back(move(line));
+    }
+}
+
+/**
+ * Method: ingest
+ * --------------
+ * Drains everything currently readable from the child's stdout without blocking, and
+ * either hands it over in chunks or splits it up into lines.  On EOF, the descriptor is
+ * closed, any dangling partial line is delivered, and outstanding futures are broken.
+ */
+void SubprocessGroup::ingest(size_t id, child& c, vector<function<void()>>& deliveries) {
+    char buffer[kReadChunkSize];
+    while (true) {
+        ssize_t count = read(c.ingestfd, buffer, sizeof(buffer));
+        if (count == -1 && errno == EINTR) continue;
+        if (count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (count <= 0) break;
+
+        if (c.chunkHandler) {
+            ChunkHandler handler = c.chunkHandler;
+            shared_ptr<string> chunk = make_shared<string>(buffer, count);
+            deliveries.push_back([handler, id, chunk] { handler(id, chunk->data(), chunk->size()); });
+            continue;
+        }
+
+        const char *start = buffer;
+        const char *end = buffer + count;
+        while (true) {
+            const char *newline = static_cast<const char *>(memchr(start, '\n', end - start));
+            if (newline == NULL) break;
+            c.partial.append(start, newline - start);
+            deliverLine(id, c, move(c.partial), deliveries);
+            c.partial.clear();
+            start = newline + 1;
+        }
+        c.partial.append(start, end - start);
+    }
+
+    watch(c.ingestfd, id, /* input = */ false, /* add = */ false);
+    close(c.ingestfd);
+    c.ingestfd = kNotInUse;
+    if (!c.partial.empty()) {
+        deliverLine(id, c, move(c.partial), deliveries);
+        c.partial.clear();
+    }
+    for (promise<string>& p: c.waiters)
+        p.set_exception(make_exception_ptr(SubprocessException("child " + to_string(id) + " has no more output")));
+    c.waiters.clear();
+    if (c.eofHandler) {
+        EOFHandler handler = c.eofHandler;
+        deliveries.push_back([handler, id] { handler(id); });
+    }
+}
+
+bool SubprocessGroup::step(int timeout) {
+    {
+        lock_guard<mutex> lg(m);
+        if (numWatched == 0) return false;
+    }
+
+    struct epoll_event events[kMaxEvents];
+    int numReady = epoll_wait(epollfd, events, kMaxEvents, timeout);
+    if (numReady == -1 && errno != EINTR) throw SubprocessException("epoll_wait failed");
+
+    vector<function<void()>> deliveries;
+    {
+        lock_guard<mutex> lg(m);
+        for (int i = 0; i < numReady; i++) {
+            uint64_t token = events[i].data.u64;
+            if (token == kWakeupToken) {
+                uint64_t count;
+                ssize_t ignored = read(wakefd, &count, sizeof(count));
+                (void) ignored;
+                continue;
+            }
+            if (token & kDescriptorTag) {
+                int fd = int(token & ~kDescriptorTag);
+                auto found = descriptors.find(fd);
+                if (found == descriptors.end()) continue;
+                ReadableHandler handler = found->second;
+                deliveries.push_back([handler, fd] { handler(fd); });
+                continue;
+            }
+            size_t id = token >> 1;
+            child& c = *children[id];
+            if (token & 1) {
+                if (c.supplyRegistered) flushOutbox(id, c);
+            } else if (c.ingestfd != kNotInUse) {
+                ingest(id, c, deliveries);
+            }
+        }
+    }
+
+    for (const function<void()>& delivery: deliveries) delivery();
+    return true;
+}
+
+void SubprocessGroup::run() {
+    while (step()) {}
+}
+
+int SubprocessGroup::wait(size_t id) {
+    pid_t pid;
+    {
+        lock_guard<mutex> lg(m);
+        child& c = lookup(id);
+        if (c.reaped) return c.status;
+        pid = c.pid;
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {}
+    lock_guard<mutex> lg(m);
+    child& c = lookup(id);
+    c.reaped = true;
+    c.status = status;
+    return status;
+}
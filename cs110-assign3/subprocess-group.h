@@ -0,0 +1,193 @@
+/**
+ * File: subprocess-group.h
+ * ------------------------
+ * Exports the SubprocessGroup class, which spawns and manages any number of subprocesses
+ * (each created via the subprocess function) and multiplexes all of their stdin and stdout
+ * pipes through a single epoll loop.  Every parent-side descriptor is made non-blocking, so
+ * one slow child never stalls the parent or any of its siblings.
+ *
+ * Output can be delivered as raw chunks or as complete lines, either through callbacks or
+ * through futures.  Input is queued and trickled out as the child's pipe has room for it.
+ *
+ * Sample program:
+
+static char *kSortArgv[] = {const_cast<char *>("/usr/bin/sort"), NULL};
+int main(int argc, char *argv[]) {
+  SubprocessGroup group;
+  for (size_t i = 0; i < 100; i++) {
+    size_t child = group.spawn(kSortArgv, true, true);
+    group.onLine(child, [](size_t child, const string& line) {
+      cout << child << ": " << line << endl;
+    });
+    group.write(child, "ring\nput\na\non\nit\n");
+    group.closeInput(child);
+  }
+  group.run(); // returns once every child's output has been fully ingested
+  return 0;
+}
+
+ * The event loop (step or run) is typically driven by a single thread, but the remaining
+ * methods may be called from any thread, including from within handlers.  Handlers themselves
+ * are always invoked from within step.
+ */
+
+#pragma once
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "subprocess.h"
+
+class SubprocessGroup {
+ public:
+  typedef std::function<void(size_t child, const std::string& line)> LineHandler;
+  typedef std::function<void(size_t child, const char *data, size_t length)> ChunkHandler;
+  typedef std::function<void(size_t child)> EOFHandler;
+  typedef std::function<void(int fd)> ReadableHandler;
+
+/**
+ * Constructor: SubprocessGroup
+ * ----------------------------
+ * Creates an empty group, along with the epoll instance that drives it.
+ */
+  SubprocessGroup() throw (SubprocessException);
+
+/**
+ * Destructor: ~SubprocessGroup
+ * ----------------------------
+ * Closes every descriptor the group still owns (which delivers EOF to any children still
+ * reading their stdin) and reaps every child that hasn't already been waited on.
+ */
+  ~SubprocessGroup();
+
+/**
+ * Method: spawn
+ * -------------
+ * Creates a new subprocess exactly as the subprocess function does, adds its pipes to
+ * the group, and returns the id (0, 1, 2, ...) used to identify it in all other methods.
+ */
+  size_t spawn(char *argv[], bool supplyChildInput, bool ingestChildOutput) throw (SubprocessException);
+
+/**
+ * Method: getPid
+ * --------------
+ * Returns the process id of the identified child.
+ */
+  pid_t getPid(size_t child) const;
+
+/**
+ * Methods: onLine, onChunk, onEOF
+ * -------------------------------
+ * Install handlers for the identified child's output.  If a chunk handler is installed, it
+ * receives all output exactly as it's read.  Otherwise, output is broken up into lines (without
+ * their trailing newlines), each of which goes to the oldest outstanding nextLine future, or else the line
+ * handler, or else is buffered until someone asks for it via nextLine.  The EOF handler is invoked
+ * once the child closes its stdout.
+ */
+  void onLine(size_t child, const LineHandler& handler);
+  void onChunk(size_t child, const ChunkHandler& handler);
+  void onEOF(size_t child, const EOFHandler& handler);
+
+/**
+ * Method: nextLine
+ * ----------------
+ * Returns a future for the next line the identified child prints.  If the child closes its
+ * stdout before printing another line, the future holds a SubprocessException instead.
+ */
+  std::future<std::string> nextLine(size_t child);
+
+/**
+ * Method: write
+ * -------------
+ * Queues the supplied data to be published to the identified child's stdin.  write never
+ * blocks: whatever the pipe can't accept right away is published from within the event loop
+ * once the pipe has room.  If the child has closed its stdin, whatever's queued is discarded,
+ * and the parent isn't sent a SIGPIPE, so it needn't ignore SIGPIPE itself.
+ */
+  void write(size_t child, const std::string& data);
+
+/**
+ * Method: closeInput
+ * ------------------
+ * Closes the identified child's stdin as soon as everything queued for it has been published.
+ */
+  void closeInput(size_t child);
+
+/**
+ * Methods: watchDescriptor, unwatchDescriptor
+ * -------------------------------------------
+ * Add some other descriptor (the parent's own stdin, say) to the event loop, so that step invokes
+ * the supplied handler whenever it's readable, and take it back out again.  The handler should drain
+ * what it can without blocking, since it's invoked again on every step for as long as the descriptor
+ * stays readable.  watchDescriptor returns false if the descriptor can't be watched, which is the case
+ * for regular files (which epoll refuses, since they never block anyway).  So long as any descriptor
+ * is watched, step keeps waiting on it.
+ */
+  bool watchDescriptor(int fd, const ReadableHandler& handler);
+  void unwatchDescriptor(int fd);
+
+/**
+ * Method: step
+ * ------------
+ * Waits up to timeout milliseconds (or indefinitely, if timeout is -1) for any descriptor in the group
+ * to become ready, services every descriptor that is, and invokes the relevant handlers.  Returns false
+ * without waiting if no child has output left to ingest or input left to publish, and no other
+ * descriptor is being watched.
+ */
+  bool step(int timeout = -1);
+
+/**
+ * Method: run
+ * -----------
+ * Calls step until it returns false.
+ */
+  void run();
+
+/**
+ * Method: wait
+ * ------------
+ * Blocks until the identified child exits, and returns its wait status.
+ */
+  int wait(size_t child);
+
+ private:
+  struct child {
+    pid_t pid;
+    int supplyfd;
+    int ingestfd;
+    std::string outbox;              // input queued but not yet published
+    bool supplyRegistered = false;   // true if supplyfd is being watched for writability
+    bool closeRequested = false;
+    std::string partial;             // output following the most recent newline
+    std::deque<std::string> lines;   // complete lines nobody has asked for yet
+    std::deque<std::promise<std::string>> waiters;
+    LineHandler lineHandler;
+    ChunkHandler chunkHandler;
+    EOFHandler eofHandler;
+    bool reaped = false;
+    int status = 0;
+  };
+
+  int epollfd;
+  int wakefd;
+  mutable std::mutex m;
+  std::vector<std::unique_ptr<child>> children;
+  std::map<int, ReadableHandler> descriptors; // descriptors other than the children's, keyed by fd
+  size_t numWatched;
+
+  child& lookup(size_t id) const;
+  void watch(int fd, size_t id, bool input, bool add);
+  void flushOutbox(size_t id, child& c);
+  void closeSupply(child& c);
+  void ingest(size_t id, child& c, std::vector<std::function<void()>>& deliveries);
+  void deliverLine(size_t id, child& c, std::string line, std::vector<std::function<void()>>& deliveries);
+  void wakeup();
+
+  SubprocessGroup(const SubprocessGroup& original) = delete;
+  SubprocessGroup& operator=(const SubprocessGroup& rhs) = delete;
+};
@@ -0,0 +1,69 @@
+/**
+ * File: trace-decode.cc
+ * ---------------------
+ * Presents the implementation of trace-decode, which pretty-prints a binary log produced
+ * by "trace --binary" offline, exactly as trace itself would have printed it live, e.g.
+ *
+ *    > ./trace --binary=simple-test3.log ./simple-test3
+ *    > ./trace-decode simple-test3.log
+ *
+ * trace-decode reads from standard input if no log file is named, and accepts --simple
+ * to print just system call numbers and return values.
+ */
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "trace-error-constants.h"
+#include "trace-system-calls.h"
+#include "trace-output.h"
+#include "trace-log.h"
+
+using namespace std;
+
+static const string kSimpleFlag = "--simple";
+
+static int decode(istream& is, bool simple) {
+    bool follow;
+    if (!decodeLogHeader(is, follow)) {
+        cerr << "trace-decode: input is not a trace log." << endl;
+        return 1;
+    }
+
+    systemCallTable systemCalls;
+    compileSystemCallTable(systemCalls, /* rebuild = */ false);
+    vector<string> errorConstants;
+    compileSystemCallErrorStrings(errorConstants);
+
+    TraceOutput out(STDOUT_FILENO);
+    syscallEvent event;
+    bool exited = false;
+    int status = 0;
+    while (decodeLogRecord(is, event, exited, status)) {
+        if (exited) {
+            printProgramExit(out, status);
+            break;
+        }
+        printSyscallEvent(out, event, systemCalls, errorConstants, simple, follow);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    bool simple = false;
+    int i = 1;
+    if (argv[i] != NULL && argv[i] == kSimpleFlag) {
+        simple = true;
+        i++;
+    }
+
+    if (argv[i] == NULL) return decode(cin, simple);
+    ifstream infile(argv[i], ios::binary);
+    if (infile.fail()) {
+        cerr << "trace-decode: couldn't open \"" << argv[i] << "\"." << endl;
+        return 1;
+    }
+    return decode(infile, simple);
+}
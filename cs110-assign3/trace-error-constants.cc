@@ -91,3 +91,19 @@ void compileSystemCallErrorStrings(map<int, string>& errorConstants) throw (Miss
     }
   }
 }
+
+/**
+ * Function: compileSystemCallErrorStrings
+ * ---------------------------------------
+ * Flattens the map built by the other version into a vector indexed by errno.
+ */
+void compileSystemCallErrorStrings(vector<string>& errorConstants) throw (MissingFileException) {
+  map<int, string> constants;
+  compileSystemCallErrorStrings(constants);
+  errorConstants.clear();
+  if (constants.empty()) return;
+  errorConstants.resize(constants.crbegin()->first + 1);
+  for (const pair<const int, string>& p: constants) {
+    if (p.first >= 0) errorConstants[p.first] = p.second;
+  }
+}
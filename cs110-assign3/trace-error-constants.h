@@ -1,14 +1,24 @@
 /**
  * File: trace-error-constants.h
  * -----------------------------
- * Defines a single routine that builds of a map of errno status codes (e.g. 2) to
- * their more familiar #define constants (expressed as strings, e.g. "ENOENT").
+ * Defines a routine that builds of a map of errno status codes (e.g. 2) to
+ * their more familiar #define constants (expressed as strings, e.g. "ENOENT"), and
+ * a second version that builds a dense table indexed by errno instead.
  */
  
 #pragma once
 #include <map>
 #include <string>
+#include <vector>
 #include "trace-exception.h"
  
 void compileSystemCallErrorStrings(std::map<int, std::string>& errorConstants) throw (MissingFileException);
+
+/**
+ * Function: compileSystemCallErrorStrings
+ * ---------------------------------------
+ * Populates the supplied vector so that errorConstants[errno] is the #define constant
+ * for errno (or the empty string, for the few numbers without one).
+ */
+void compileSystemCallErrorStrings(std::vector<std::string>& errorConstants) throw (MissingFileException);
  
\ No newline at end of file
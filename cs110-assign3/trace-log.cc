@@ -0,0 +1,85 @@
+/**
+ * File: trace-log.cc
+ * ------------------
+ * Presents the implementation of the binary trace log encoder and decoder.
+ */
+
+#include "trace-log.h"
+using namespace std;
+
+void encodeLogHeader(TraceOutput& out, bool follow) {
+    traceLogHeader header = {kTraceLogMagic, follow ? kTraceLogFollow : 0};
+    out.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.commit();
+}
+
+void encodeSyscallEvent(TraceOutput& out, const syscallEvent& event) {
+    traceLogRecord record = {};
+    record.tid = event.tid;
+    record.syscall = event.syscall;
+    record.retval = event.retval;
+    if (!event.returned) record.flags |= kRecordNoReturn;
+    if (event.signatureMissing) record.flags |= kRecordSignatureMissing;
+    record.numArgs = event.numArgs;
+    record.stringMask = event.stringMask;
+    out.append(reinterpret_cast<const char *>(&record), sizeof(record));
+    for (int i = 0; i < event.numArgs; i++) {
+        int64_t arg = event.args[i];
+        out.append(reinterpret_cast<const char *>(&arg), sizeof(arg));
+    }
+    for (int i = 0; i < event.numArgs; i++) {
+        if ((event.stringMask & (1u << i)) == 0) continue;
+        uint32_t length = event.strings[i].size();
+        out.append(reinterpret_cast<const char *>(&length), sizeof(length));
+        out.append(event.strings[i]);
+    }
+    out.commit();
+}
+
+void encodeProgramExit(TraceOutput& out, int status) {
+    traceLogRecord record = {};
+    record.retval = status;
+    record.flags = kRecordProgramExit;
+    out.append(reinterpret_cast<const char *>(&record), sizeof(record));
+    out.commit();
+}
+
+bool decodeLogHeader(istream& is, bool& follow) {
+    traceLogHeader header;
+    if (!is.read(reinterpret_cast<char *>(&header), sizeof(header))) return false;
+    if (header.magic != kTraceLogMagic) return false;
+    follow = (header.flags & kTraceLogFollow) != 0;
+    return true;
+}
+
+bool decodeLogRecord(istream& is, syscallEvent& event, bool& exited, int& status) {
+    traceLogRecord record;
+    if (!is.read(reinterpret_cast<char *>(&record), sizeof(record))) return false;
+    exited = (record.flags & kRecordProgramExit) != 0;
+    if (exited) {
+        status = record.retval;
+        return true;
+    }
+    if (record.numArgs > kMaxSyscallArgs) return false;
+
+    event.tid = record.tid;
+    event.syscall = record.syscall;
+    event.retval = record.retval;
+    event.returned = (record.flags & kRecordNoReturn) == 0;
+    event.signatureMissing = (record.flags & kRecordSignatureMissing) != 0;
+    event.numArgs = record.numArgs;
+    event.stringMask = record.stringMask;
+    for (int i = 0; i < event.numArgs; i++) {
+        int64_t arg;
+        if (!is.read(reinterpret_cast<char *>(&arg), sizeof(arg))) return false;
+        event.args[i] = arg;
+    }
+    for (int i = 0; i < event.numArgs; i++) {
+        if ((event.stringMask & (1u << i)) == 0) continue;
+        uint32_t length;
+        if (!is.read(reinterpret_cast<char *>(&length), sizeof(length))) return false;
+        event.strings[i].resize(length);
+        if (length > 0 && !is.read(&event.strings[i][0], length)) return false;
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+/**
+ * File: trace-log.h
+ * -----------------
+ * Defines the compact binary log format trace emits when invoked with --binary, along
+ * with the routines that encode syscallEvents into it and decode them back out.  The
+ * trace-decode program relies on the decoding half to pretty-print a log offline.
+ *
+ * A log is a traceLogHeader followed by any number of records.  Each record is a
+ * traceLogRecord, followed by numArgs 64-bit argument values, followed by a 32-bit length
+ * and the raw bytes of every string argument (in argument order).  All values are
+ * stored in host byte order, since logs are decoded on the machine that wrote them.
+ */
+
+#pragma once
+#include <cstdint>
+#include <istream>
+#include "trace-output.h"
+
+/**
+ * Constants: kTraceLogMagic, kTraceLogFollow
+ * ------------------------------------------
+ * kTraceLogMagic identifies a file as a trace log ("TRC1").  kTraceLogFollow is set in the
+ * header flags if the log was captured with --follow, so trace-decode knows to tag each line
+ * with the pid responsible for it.
+ */
+static const uint32_t kTraceLogMagic = 0x31435254;
+static const uint32_t kTraceLogFollow = 0x1;
+
+struct traceLogHeader {
+  uint32_t magic;
+  uint32_t flags;
+};
+
+/**
+ * Constants: record flags
+ * -----------------------
+ * kRecordNoReturn marks a system call that never returned, kRecordSignatureMissing marks
+ * a system call trace had no signature for, and kRecordProgramExit marks the final
+ * record of a log, whose retval field holds the traced program's wait status.
+ */
+static const uint8_t kRecordNoReturn = 0x1;
+static const uint8_t kRecordSignatureMissing = 0x2;
+static const uint8_t kRecordProgramExit = 0x4;
+
+struct traceLogRecord {
+  int32_t tid;
+  int32_t syscall;
+  int64_t retval;
+  uint8_t flags;
+  uint8_t numArgs;
+  uint8_t stringMask;
+  uint8_t reserved;
+};
+
+/**
+ * Functions: encodeLogHeader, encodeSyscallEvent, encodeProgramExit
+ * -----------------------------------------------------------------
+ * Append the binary encoding of a log header, a system call, or the traced program's
+ * final wait status to the supplied TraceOutput.
+ */
+void encodeLogHeader(TraceOutput& out, bool follow);
+void encodeSyscallEvent(TraceOutput& out, const syscallEvent& event);
+void encodeProgramExit(TraceOutput& out, int status);
+
+/**
+ * Function: decodeLogHeader
+ * -------------------------
+ * Reads a log header from the supplied stream, returning false if the stream doesn't
+ * begin with one.  follow is set according to the header's flags.
+ */
+bool decodeLogHeader(std::istream& is, bool& follow);
+
+/**
+ * Function: decodeLogRecord
+ * -------------------------
+ * Reads the next record from the supplied stream into event.  Returns false once the stream
+ * has been exhausted (or is truncated mid-record).  If the record is the program exit
+ * record, then exited is set to true and status is set to the program's wait status.
+ */
+bool decodeLogRecord(std::istream& is, syscallEvent& event, bool& exited, int& status);
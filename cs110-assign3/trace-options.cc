@@ -11,11 +11,16 @@ using namespace std;
 
 static const string kSimpleFlag = "--simple";
 static const string kRebuildFlag = "--rebuild";
-size_t processCommandLineFlags(bool& simple, bool& rebuild, char *argv[]) throw (TraceException) {  
+static const string kFollowFlag = "--follow";
+static const string kBinaryFlagPrefix = "--binary=";
+size_t processCommandLineFlags(bool& simple, bool& rebuild, bool& follow, string& binaryLog, char *argv[]) throw (TraceException) {  
   size_t numFlags = 0;
   for (int i = 1; argv[i] != NULL && startsWith(argv[i], "--"); i++) {
     if (argv[i] == kSimpleFlag) simple = true;
     else if (argv[i] == kRebuildFlag) rebuild = true;
+    else if (argv[i] == kFollowFlag) follow = true;
+    else if (startsWith(argv[i], kBinaryFlagPrefix) && argv[i] != kBinaryFlagPrefix)
+      binaryLog = string(argv[i]).substr(kBinaryFlagPrefix.size());
     else throw TraceException(string(argv[0]) + ": Unrecognized flag (" + argv[i] + " )");
     numFlags++;
   }
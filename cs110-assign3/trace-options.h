@@ -4,15 +4,19 @@
  * Exports a single function that knows how to process the command line invoking
  * trace.  The command line typically looks like the invocation of another executable, e.g.
  * something like "find /usr/include/ -name *.h -print" preceded by "trace", e.g. 
- * "trace find /usr/include/ -name *.h -print".  However, trace itself can be fed one or two
- * flags, --simple and/or --rebuild.  The first one coaches trace to output a very simplified
- * version of trace, whereas the second one instructs trace to rebuild all of the prototypes
- * from scratch instead of relying on a cached file.
+ * "trace find /usr/include/ -name *.h -print".  However, trace itself can be fed any of four
+ * flags: --simple, --rebuild, --follow, and --binary=<file>.  The first one coaches trace to output a very simplified
+ * version of trace, the second one instructs trace to rebuild all of the prototypes
+ * from scratch instead of relying on a cached file, the third one asks trace to follow every
+ * process and thread the traced program creates, tagging each line of output with the pid responsible,
+ * and the fourth one has trace write a compact binary log to the named file (instead of printing to
+ * standard output, which the traced program shares) so that trace-decode can pretty-print it later on.
  *
  * If the command line is malformed (e.g. bogus flags, etc), then a TraceException is thrown.
  */
 
 #pragma once
+#include <string>
 #include "trace-exception.h"
 
-size_t processCommandLineFlags(bool& simple, bool& rebuild, char *argv[]) throw (TraceException);
+size_t processCommandLineFlags(bool& simple, bool& rebuild, bool& follow, std::string& binaryLog, char *argv[]) throw (TraceException);
@@ -0,0 +1,257 @@
+/**
+ * File: trace-output.cc
+ * ---------------------
+ * Presents the implementation of the TraceOutput class and the routines that
+ * pretty-print syscallEvents through one.
+ */
+
+#include "trace-output.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+/**
+ * Constant: kMaxWriterLatency
+ * ---------------------------
+ * The writer thread prefers to wait until at least kBatchSize bytes have been committed, but
+ * never leaves committed bytes sitting in the ring for longer than this.
+ */
+static const chrono::milliseconds kMaxWriterLatency(20);
+
+const size_t TraceOutput::kDefaultCapacity;
+const size_t TraceOutput::kBatchSize;
+
+static size_t roundUpToPowerOfTwo(size_t n) {
+    size_t power = 1;
+    while (power < n) power <<= 1;
+    return power;
+}
+
+TraceOutput::TraceOutput(int fd, size_t capacity) :
+        fd(fd), capacity(roundUpToPowerOfTwo(max(capacity, 2 * kBatchSize))),
+        ring(new char[this->capacity]), head(0), recordStart(0), published(0), consumed(0),
+        writerIdle(false), flushRequested(false), done(false) {
+    writer = thread(&TraceOutput::writerLoop, this);
+}
+
+TraceOutput::~TraceOutput() {
+    commit();
+    {
+        lock_guard<mutex> lg(m);
+        done = true;
+    }
+    cv.notify_one();
+    writer.join();
+}
+
+/**
+ * Method: reserve
+ * ---------------
+ * Blocks until there are at least length free bytes in the ring.  If the ring is full,
+ * then everything before the record being built is committed (the writer can't free up space
+ * for bytes it can't see), the writer is woken up, and the tracer yields until enough space is
+ * freed.  The record itself is only committed early if it couldn't fit in the ring on its own.
+ */
+void TraceOutput::reserve(size_t length) {
+    while (head + length - consumed.load(memory_order_acquire) > capacity) {
+        if (head + length - recordStart > capacity) recordStart = head;
+        published.store(recordStart, memory_order_release);
+        wakeWriter(/* flushing = */ false);
+        this_thread::yield();
+    }
+}
+
+void TraceOutput::append(const char *bytes, size_t length) {
+    while (length > 0) {
+        size_t chunk = min(length, kBatchSize);
+        reserve(chunk);
+        size_t offset = head & (capacity - 1);
+        size_t first = min(chunk, capacity - offset);
+        memcpy(ring.get() + offset, bytes, first);
+        memcpy(ring.get(), bytes + first, chunk - first);
+        head += chunk;
+        bytes += chunk;
+        length -= chunk;
+    }
+}
+
+void TraceOutput::append(const char *str) {
+    append(str, strlen(str));
+}
+
+void TraceOutput::appendDecimal(long long value) {
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *start = end;
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long) value : value;
+    do {
+        *--start = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) *--start = '-';
+    append(start, end - start);
+}
+
+void TraceOutput::appendHex(unsigned long long value) {
+    static const char kHexDigits[] = "0123456789abcdef";
+    char digits[16];
+    char *end = digits + sizeof(digits);
+    char *start = end;
+    do {
+        *--start = kHexDigits[value & 0xf];
+        value >>= 4;
+    } while (value > 0);
+    append(start, end - start);
+}
+
+void TraceOutput::commit() {
+    recordStart = head;
+    published.store(head, memory_order_seq_cst);
+    if (writerIdle.load(memory_order_seq_cst) &&
+        head - consumed.load(memory_order_relaxed) >= kBatchSize)
+        wakeWriter(/* flushing = */ false);
+}
+
+void TraceOutput::flush() {
+    recordStart = head;
+    published.store(head, memory_order_seq_cst);
+    wakeWriter(/* flushing = */ true);
+    while (consumed.load(memory_order_acquire) != head) this_thread::yield();
+    lock_guard<mutex> lg(m);
+    flushRequested = false;
+}
+
+void TraceOutput::wakeWriter(bool flushing) {
+    {
+        lock_guard<mutex> lg(m);
+        if (flushing) flushRequested = true;
+    }
+    cv.notify_one();
+}
+
+/**
+ * Method: drain
+ * -------------
+ * Writes the committed bytes in [start, end) to the descriptor, which takes at most
+ * two write calls per wraparound.  If the descriptor stops accepting output (e.g.
+ * the reading end of a pipe went away), the bytes are discarded so the tracer never
+ * blocks on a ring that can't drain.
+ */
+void TraceOutput::drain(size_t start, size_t end) {
+    while (start < end) {
+        size_t offset = start & (capacity - 1);
+        size_t length = min(end - start, capacity - offset);
+        ssize_t count = write(fd, ring.get() + offset, length);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return;
+        start += count;
+    }
+}
+
+void TraceOutput::writerLoop() {
+    while (true) {
+        size_t start = consumed.load(memory_order_relaxed);
+        bool finishing;
+        {
+            unique_lock<mutex> ul(m);
+            writerIdle.store(true, memory_order_seq_cst);
+            cv.wait_for(ul, kMaxWriterLatency, [this, start] {
+                return done || flushRequested || published.load(memory_order_seq_cst) - start >= kBatchSize;
+            });
+            writerIdle.store(false, memory_order_relaxed);
+            finishing = done;
+        }
+        size_t end = published.load(memory_order_acquire);
+        drain(start, end);
+        consumed.store(end, memory_order_release);
+        if (finishing && end == published.load(memory_order_acquire)) break;
+    }
+}
+
+/**
+ * Function: printReturnValue
+ * --------------------------
+ * Prints the return value of a system call.  mmap and brk hand back addresses, so their
+ * return values are printed in hex, and failed system calls are printed along with the name
+ * of the errno constant that describes the failure.
+ */
+static void printReturnValue(TraceOutput& out, const syscallEvent& event, const systemCallEntry *entry,
+                             const vector<string>& errorConstants) {
+    if (entry != NULL && entry->returnType == SYSCALL_RETURNS_ADDRESS) {
+        out.append("0x");
+        out.appendHex(event.retval);
+        return;
+    }
+    if (event.retval >= 0) {
+        out.appendDecimal(event.retval);
+        return;
+    }
+    if (event.retval == -38) {
+        out.append('0');
+        return;
+    }
+    out.appendDecimal(event.retval);
+    out.append(' ');
+    unsigned long error = -event.retval;
+    if (error < errorConstants.size()) out.append(errorConstants[error]);
+}
+
+void printSyscallEvent(TraceOutput& out, const syscallEvent& event, const systemCallTable& systemCalls,
+                       const vector<string>& errorConstants, bool simple, bool tagWithPid) {
+    if (tagWithPid) {
+        out.append("[pid ");
+        out.appendDecimal(event.tid);
+        out.append("] ");
+    }
+
+    const systemCallEntry *entry = event.syscall >= 0 && size_t(event.syscall) < systemCalls.size() ?
+                                   &systemCalls[event.syscall] : NULL;
+    if (simple) {
+        out.append("syscall(");
+        out.appendDecimal(event.syscall);
+        out.append(") = ");
+    } else {
+        if (entry != NULL) out.append(entry->name);
+        out.append('(');
+        if (event.signatureMissing) out.append("<signature-information-missing>");
+        for (int i = 0; i < event.numArgs; i++) {
+            if (event.stringMask & (1u << i)) {
+                out.append('"');
+                out.append(event.strings[i]);
+                out.append('"');
+            } else {
+                out.appendDecimal(event.args[i]);
+            }
+            if (i < event.numArgs - 1) out.append(", ");
+        }
+        out.append(") = ");
+    }
+
+    if (!event.returned) {
+        out.append("<no return>");
+    } else if (simple) {
+        out.appendDecimal(event.retval);
+    } else {
+        printReturnValue(out, event, entry, errorConstants);
+    }
+    out.append('\n');
+    out.commit();
+}
+
+void printProgramExit(TraceOutput& out, int status) {
+    if (WIFSIGNALED(status)) {
+        out.append("Program terminated by signal ");
+        out.appendDecimal(WTERMSIG(status));
+        out.append(".\n");
+    } else {
+        out.append("Program exited normally with status ");
+        out.appendDecimal(WEXITSTATUS(status));
+        out.append('\n');
+    }
+    out.commit();
+}
@@ -0,0 +1,159 @@
+/**
+ * File: trace-output.h
+ * --------------------
+ * Exports the TraceOutput class, which is the sink all trace output flows through, along with
+ * the syscallEvent record describing a single traced system call and the routine that knows how
+ * to pretty-print one.
+ *
+ * TraceOutput formats into a large, preallocated ring buffer, and a dedicated writer thread drains
+ * the ring to a file descriptor in large batches.  Exactly one thread (the tracer) may append to a
+ * TraceOutput, and the hand-off between it and the writer thread is lock-free: the mutex and condition
+ * variable are only ever touched when the writer has nothing to do and needs to be woken up.
+ */
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+#include "trace-system-calls.h"
+
+class TraceOutput {
+ public:
+
+/**
+ * Constructor: TraceOutput
+ * ------------------------
+ * Configures the sink to publish everything appended to it to the supplied
+ * descriptor (which the TraceOutput does not own, and never closes).  The capacity
+ * is rounded up to the nearest power of two.
+ */
+  TraceOutput(int fd, size_t capacity = kDefaultCapacity);
+
+/**
+ * Destructor: ~TraceOutput
+ * ------------------------
+ * Commits anything appended but not yet committed, waits for the writer thread
+ * to publish all of it, and then shuts the writer thread down.
+ */
+  ~TraceOutput();
+
+/**
+ * Methods: append, appendDecimal, appendHex
+ * -----------------------------------------
+ * Append raw bytes, decimal integers, and (unprefixed, lowercase) hexadecimal integers
+ * to the record currently being built.  None of them allocate, and none of them make the
+ * appended bytes visible to the writer thread until commit is called.
+ */
+  void append(const char *bytes, size_t length);
+  void append(const std::string& str) { append(str.data(), str.size()); }
+  void append(const char *str);
+  void append(char ch) { append(&ch, 1); }
+  void appendDecimal(long long value);
+  void appendHex(unsigned long long value);
+
+/**
+ * Method: commit
+ * --------------
+ * Makes everything appended since the previous commit visible to the writer thread.
+ * Even when the ring fills up partway through a record, only what precedes the record is
+ * handed to the writer early, so the writer only ever sees whole records (unless a single
+ * record is too large to fit in the ring at all, in which case it has to be split).
+ */
+  void commit();
+
+/**
+ * Method: flush
+ * -------------
+ * Commits and then blocks until everything committed has been written out.
+ */
+  void flush();
+
+ private:
+  static const size_t kDefaultCapacity = 1 << 20;
+  static const size_t kBatchSize = 1 << 16;
+
+  int fd;
+  size_t capacity;
+  std::unique_ptr<char[]> ring;
+  size_t head;                     // producer-private: where the next appended byte goes
+  size_t recordStart;              // producer-private: where the record being built begins
+  std::atomic<size_t> published;   // everything before this is committed
+  std::atomic<size_t> consumed;    // everything before this has been written
+  std::atomic<bool> writerIdle;
+  bool flushRequested;
+  bool done;
+  std::mutex m;
+  std::condition_variable cv;
+  std::thread writer;
+
+  void reserve(size_t length);
+  void wakeWriter(bool flushing);
+  void drain(size_t start, size_t end);
+  void writerLoop();
+
+  TraceOutput(const TraceOutput& original) = delete;
+  TraceOutput& operator=(const TraceOutput& rhs) = delete;
+};
+
+/**
+ * Constant: kMaxSyscallArgs
+ * -------------------------
+ * x86_64 passes at most six arguments to a system call.
+ */
+static const int kMaxSyscallArgs = 6;
+
+/**
+ * Type: syscallEvent
+ * ------------------
+ * Bundles everything captured about a single system call so it can be printed (or
+ * logged in binary form and printed later on by trace-decode).
+ *
+ *   tid: the id of the thread that made the system call
+ *   syscall: the system call number
+ *   numArgs: the number of arguments the system call takes, according to its signature
+ *   args: the raw argument values pulled out of the registers
+ *   strings: the C strings args[i] addressed, if bit i of stringMask is set
+ *   stringMask: bit i is set iff args[i] is a string argument
+ *   signatureMissing: true if trace had no signature information for the system call
+ *   returned: false for system calls (exit, exit_group) that never return
+ *   retval: the system call's return value, if returned is true
+ */
+struct syscallEvent {
+  pid_t tid = 0;
+  int syscall = -1;
+  int numArgs = 0;
+  long args[kMaxSyscallArgs];
+  std::string strings[kMaxSyscallArgs];
+  unsigned stringMask = 0;
+  bool signatureMissing = false;
+  bool returned = true;
+  long retval = 0;
+};
+
+/**
+ * Function: printSyscallEvent
+ * ---------------------------
+ * Pretty-prints the supplied event as a single line of trace output, e.g.
+ *
+ *     open("/etc/ld.so.cache", 524288, 1) = 3
+ *     [pid 1234] read(3, 140737297235728, 832) = -9 EBADF
+ *
+ * The line is tagged with the thread id only when tagWithPid is true, and only the
+ * system call number and raw return value are printed when simple is true.  Names and
+ * return value formats come from the supplied systemCallTable, and errno constants from the
+ * supplied errno-indexed table, so printing an event never does anything heavier than an array lookup.
+ */
+void printSyscallEvent(TraceOutput& out, const syscallEvent& event, const systemCallTable& systemCalls,
+                       const std::vector<std::string>& errorConstants, bool simple, bool tagWithPid);
+
+/**
+ * Function: printProgramExit
+ * --------------------------
+ * Prints the line reporting how the traced program ended, given its wait status.
+ */
+void printProgramExit(TraceOutput& out, int status);
@@ -400,3 +400,43 @@ void compileSystemCallData(map<int, string> &systemCallNumbers,
     collectSystemCallNumbers(systemCallNumbers, systemCallNames);
     collectSystemCallSignatures(systemCallSignatures, systemCallNames, rebuild);
 }
+
+/**
+ * Function: returnTypeOf
+ * ----------------------
+ * Identifies the handful of system calls whose return values need special treatment.
+ */
+static scReturnType returnTypeOf(const string &name) {
+    if (name == "mmap" || name == "brk") return SYSCALL_RETURNS_ADDRESS;
+    if (name == "exit" || name == "exit_group") return SYSCALL_NEVER_RETURNS;
+    return SYSCALL_RETURNS_INTEGER;
+}
+
+/**
+ * Function: compileSystemCallTable
+ * --------------------------------
+ * Compiles the usual three maps, and then flattens them into a table indexed by system call number,
+ * precomputing everything about each entry that would otherwise be recomputed for every traced system call.
+ */
+void compileSystemCallTable(systemCallTable &table, bool rebuild) {
+    if (!table.empty()) throw TraceException("The table supplied to compileSystemCallTable must be empty.");
+    map<int, string> systemCallNumbers;
+    map<string, int> systemCallNames;
+    map<string, systemCallSignature> systemCallSignatures;
+    compileSystemCallData(systemCallNumbers, systemCallNames, systemCallSignatures, rebuild);
+    if (systemCallNumbers.empty()) return;
+
+    table.resize(systemCallNumbers.crbegin()->first + 1);
+    for (const pair<const int, string> &p: systemCallNumbers) {
+        systemCallEntry &entry = table[p.first];
+        entry.name = p.second;
+        entry.returnType = returnTypeOf(p.second);
+        auto found = systemCallSignatures.find(p.second);
+        if (found == systemCallSignatures.cend()) continue;
+        entry.hasSignature = true;
+        entry.signature = found->second;
+        for (size_t i = 0; i < entry.signature.size(); i++) {
+            if (entry.signature[i] == SYSCALL_STRING) entry.stringMask |= 1u << i;
+        }
+    }
+}
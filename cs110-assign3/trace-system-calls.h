@@ -7,6 +7,7 @@
  
 #pragma once
 #include <map>
+#include <string>
 #include <vector>
 #include <ostream>
 
@@ -82,3 +83,53 @@ typedef std::vector<scParamType> systemCallSignature;
 void compileSystemCallData(std::map<int, std::string>& systemCallNumbers,
                            std::map<std::string, int>& systemCallNames,
                            std::map<std::string, systemCallSignature>& systemCallSignatures, bool rebuild);
+
+/**
+ * Type: scReturnType
+ * ------------------
+ * Summarizes how a system call's return value should be printed: as an integer
+ * (SYSCALL_RETURNS_INTEGER), as an address in hex (SYSCALL_RETURNS_ADDRESS, e.g. mmap
+ * and brk), or not at all, since the system call never returns (SYSCALL_NEVER_RETURNS,
+ * e.g. exit and exit_group).
+ */
+enum scReturnType {
+  SYSCALL_RETURNS_INTEGER,
+  SYSCALL_RETURNS_ADDRESS,
+  SYSCALL_NEVER_RETURNS
+};
+
+/**
+ * Type: systemCallEntry
+ * ---------------------
+ * Bundles everything trace needs to know to print a single system call, precomputed
+ * so that nothing needs to be looked up by name while tracing.
+ *
+ *   name: the name of the system call (or the empty string if no system call has this number)
+ *   hasSignature: true if the signature of the system call is known
+ *   signature: the system call's parameter types, if hasSignature is true
+ *   stringMask: bit i is set iff signature[i] is SYSCALL_STRING
+ *   returnType: how the system call's return value should be printed
+ */
+struct systemCallEntry {
+  std::string name;
+  bool hasSignature = false;
+  systemCallSignature signature;
+  unsigned stringMask = 0;
+  scReturnType returnType = SYSCALL_RETURNS_INTEGER;
+};
+
+/**
+ * Type: systemCallTable
+ * ---------------------
+ * A dense table of systemCallEntrys indexed by system call number.
+ */
+typedef std::vector<systemCallEntry> systemCallTable;
+
+/**
+ * Function: compileSystemCallTable
+ * --------------------------------
+ * Initializes the supplied (empty) table with one entry for every system call number between 0 and the
+ * largest system call number, inclusive.  The table is built from the same information compileSystemCallData
+ * surfaces, and the rebuild flag means the same thing it does there.
+ */
+void compileSystemCallTable(systemCallTable& table, bool rebuild);
@@ -8,15 +8,25 @@
  *    + the name of the system call,
  *    + the values of all of its arguments, and
  *    + the system calls return value
+ *
+ * When invoked with --follow, trace also follows every process and thread the traced program
+ * creates (via PTRACE_O_TRACEFORK, PTRACE_O_TRACEVFORK, and PTRACE_O_TRACECLONE), and each line
+ * of output is tagged with the pid (or tid) that made the system call.
+ *
+ * When invoked with --binary=<file>, trace writes a compact binary log (see trace-log.h) to the named
+ * file instead, which trace-decode can pretty-print later on.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <iostream>
-#include <sstream>
-#include <map>
-#include <set>
+#include <unordered_map>
+#include <vector>
 
 #include <unistd.h> // for fork, execvp
+#include <fcntl.h>  // for open
+#include <signal.h> // for raise
 #include <string.h> // for memchr, strerror
 #include <sys/ptrace.h>
 #include <sys/reg.h>
@@ -25,9 +35,44 @@
 #include "trace-error-constants.h"
 #include "trace-system-calls.h"
 #include "trace-exception.h"
+#include "trace-output.h"
+#include "trace-log.h"
 
 using namespace std;
 
+/**
+ * Type: tracee
+ * ------------
+ * Bundles everything trace needs to remember about a single traced thread of execution
+ * between successive ptrace stops.  Every tracee alternates between syscall-enter and
+ * syscall-exit stops, and because several tracees can be stopped midway through a system call
+ * at the same time, the arguments captured on entry are held here until the return value is known.
+ *
+ *   inSyscall: true if the most recent syscall stop was a syscall-enter stop
+ *   awaitingInitialStop: true if a newly attached tracee has yet to report its initial SIGSTOP
+ *   event: everything captured about the system call currently in flight
+ */
+struct tracee {
+    bool inSyscall = false;
+    bool awaitingInitialStop = true;
+    syscallEvent event;
+};
+
+/**
+ * Type: traceContext
+ * ------------------
+ * Bundles the system call tables and the output configuration shared by every tracee.  Both
+ * tables are dense arrays (indexed by system call number and errno, respectively) built once
+ * at startup, so no string comparisons or tree walks happen while tracing.
+ */
+struct traceContext {
+    systemCallTable systemCalls;
+    vector<string> errorConstants;
+    bool simple;
+    bool follow;
+    bool binary;
+};
+
 long accessRegister(int &argid){
 
     if (argid > 5) {
@@ -45,105 +90,208 @@ long accessRegister(int &argid){
     }
 }
 
-string processRetVal(map<int, string> &errorConstants, int &sc_id, string &sc_name, long &retval){
-    if (sc_id == 12 || sc_id == 9){
-        stringstream ss;
-        ss << hex << retval;
-        return "0x" + ss.str();
-    } else {
-        if (retval >= 0) return to_string(retval);
-        if (retval == -38) return "0";
-        string retMessage = errorConstants[abs(retval)];
-        return to_string(retval) + " " + retMessage;
+/**
+ * Function: readString
+ * --------------------
+ * Pulls the C string residing at the supplied address out of the tracee's address space one word
+ * at a time.
+ */
+static void readString(pid_t pid, long address, string &str) {
+    str.clear();
+    while (true) {
+        errno = 0;
+        long word = ptrace(PTRACE_PEEKDATA, pid, address, 0);
+        if (errno != 0) break;
+        const char *chars = reinterpret_cast<const char *>(&word);
+        const char *end = static_cast<const char *>(memchr(chars, '\0', sizeof(long)));
+        str.append(chars, end == NULL ? sizeof(long) : end - chars);
+        if (end != NULL) break;
+        address += sizeof(long);
     }
 }
 
-void printSyscall(pid_t &pid, int& sc_id, string& sc_name,
-        systemCallSignature &signature, map<int, string> &errorConstants, bool& simple){
-
-    long sc_return = ptrace(PTRACE_PEEKUSER, pid, RAX * sizeof(long), 0);
+/**
+ * Function: captureSyscall
+ * ------------------------
+ * Pulls the number and arguments of the system call the supplied tracee is entering out of
+ * its registers (and address space, for string arguments) and into the supplied event.
+ */
+static void captureSyscall(pid_t pid, syscallEvent &event, traceContext &context) {
+    event.tid = pid;
+    event.syscall = ptrace(PTRACE_PEEKUSER, pid, ORIG_RAX * sizeof(long), 0);
+    event.numArgs = 0;
+    event.stringMask = 0;
+    event.signatureMissing = false;
+    event.returned = true;
+    event.retval = 0;
 
-    if (simple){
-        cout << "syscall(" << sc_id << ") = ";
-        if (sc_id == 60 || sc_id == 231) {
-            cout << "<no return>";
-        } else {
-            cout << sc_return;
-        }
-        cout << endl;
-    } else {
-        cout << sc_name << "(";
-        for (int i = 0; i < signature.size(); ++i){
-            if (signature[i] == SYSCALL_STRING){
-                int str_iter = 0;
-                char arg_char;
-                cout << '"';
-                while(true){
-                    arg_char = ptrace(PTRACE_PEEKDATA, pid,
-                            ptrace(PTRACE_PEEKUSER, pid, accessRegister(i), 0) + str_iter*sizeof(char), 0);
-                    arg_char = arg_char & 0xFF;
-                    if (arg_char == '\0') break;
-                    ++str_iter;
-                    cout << arg_char;
-                }
-                cout << '"';
-            } else {
-                long arg = ptrace(PTRACE_PEEKUSER, pid, accessRegister(i), 0);
-                if (signature[i] == SYSCALL_INTEGER) {
-                    cout << int(arg);
-                } else {
-                    cout << arg;
-                }
-            }
+    if (event.syscall < 0 || size_t(event.syscall) >= context.systemCalls.size()) {
+        event.signatureMissing = true;
+        return;
+    }
+    const systemCallEntry &entry = context.systemCalls[event.syscall];
+    event.returned = entry.returnType != SYSCALL_NEVER_RETURNS;
+    if (context.simple && !context.binary) return;
+    if (!entry.hasSignature) {
+        event.signatureMissing = true;
+        return;
+    }
 
-            if (i < signature.size() -1) {
-                cout << ", ";
-            } else {
-                cout << ") = ";
-            }
+    event.numArgs = min<int>(entry.signature.size(), kMaxSyscallArgs);
+    event.stringMask = entry.stringMask;
+    for (int i = 0; i < event.numArgs; ++i){
+        long arg = ptrace(PTRACE_PEEKUSER, pid, accessRegister(i), 0);
+        if (entry.signature[i] == SYSCALL_STRING){
+            readString(pid, arg, event.strings[i]);
+        } else if (entry.signature[i] == SYSCALL_INTEGER) {
+            arg = int(arg);
         }
+        event.args[i] = arg;
+    }
+}
 
+/**
+ * Function: publishEvent
+ * ----------------------
+ * Publishes a fully captured system call, either as a line of text or as a binary log record.
+ */
+static void publishEvent(TraceOutput &out, const syscallEvent &event, traceContext &context) {
+    if (context.binary) {
+        encodeSyscallEvent(out, event);
+    } else {
+        printSyscallEvent(out, event, context.systemCalls, context.errorConstants,
+                          context.simple, context.follow);
     }
 }
 
+/**
+ * Function: handleSyscallStop
+ * ---------------------------
+ * Advances the supplied tracee through a syscall-enter or syscall-exit stop.  The arguments are
+ * captured on entry (while they're still sitting in the registers), and the system call is published
+ * on exit once the return value is available.  exit and exit_group never reach an exit stop,
+ * so they're published right away.
+ */
+static void handleSyscallStop(pid_t tid, tracee &t, TraceOutput &out, traceContext &context) {
+    if (!t.inSyscall) {
+        t.inSyscall = true;
+        captureSyscall(tid, t.event, context);
+        if (!t.event.returned) publishEvent(out, t.event, context);
+        return;
+    }
 
-void trace(bool& simple, bool& rebuild, char *argv[]){
+    t.inSyscall = false;
+    if (!t.event.returned) return;
+    t.event.retval = ptrace(PTRACE_PEEKUSER, tid, RAX * sizeof(long), 0);
+    publishEvent(out, t.event, context);
+}
 
-    map<int, string> systemCallNumbers;
-    map<std::string, int> systemCallNames;
-    map<std::string, systemCallSignature> systemCallSignatures;
-    compileSystemCallData(systemCallNumbers, systemCallNames, systemCallSignatures, rebuild);
+/**
+ * Function: trace
+ * ---------------
+ * Forks off the program identified by argv, and then drives a single waitpid(-1, __WALL) event loop
+ * over every tracee until all of them have exited.  Each tracee is resumed the moment its stop has been
+ * handled, so tracees only ever wait on one another for as long as the tracer itself takes to process
+ * a stop.  All output flows through a TraceOutput, so the tracer never blocks on the terminal.
+ * Returns the wait status of the initial process.
+ */
+static int trace(traceContext &context, bool rebuild, const string &binaryLog, char *argv[]){
 
-    map<int, string> errorConstants;
-    compileSystemCallErrorStrings(errorConstants);
+    compileSystemCallTable(context.systemCalls, rebuild);
+    compileSystemCallErrorStrings(context.errorConstants);
 
     pid_t pid = fork();
-
     if (pid == 0){
         ptrace(PTRACE_TRACEME, 0, 0, 0);
+        raise(SIGSTOP); // let the tracer install its options before execvp
         execvp(argv[0], argv);
+        cerr << argv[0] << ": Command not found." << endl;
+        exit(1);
+    }
+
+    int stat;
+    waitpid(pid, &stat, 0);
+    long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL;
+    if (context.follow) options |= PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE;
+    ptrace(PTRACE_SETOPTIONS, pid, 0, options);
+
+    int outfd = STDOUT_FILENO;
+    if (context.binary) {
+        outfd = open(binaryLog.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (outfd == -1) {
+            kill(pid, SIGKILL);
+            throw TraceException("Failed to open the file named \"" + binaryLog + "\".");
+        }
     }
+    TraceOutput out(outfd);
+    if (context.binary) encodeLogHeader(out, context.follow);
+
+    unordered_map<pid_t, tracee> tracees;
+    tracees[pid].awaitingInitialStop = false;
+    ptrace(PTRACE_SYSCALL, pid, 0, 0);
+
+    int rootStatus = 0;
+    while (!tracees.empty()) {
+        pid_t tid = waitpid(-1, &stat, __WALL);
+        if (tid == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (WIFEXITED(stat) || WIFSIGNALED(stat)) {
+            auto found = tracees.find(tid);
+            if (found != tracees.end() && found->second.inSyscall && found->second.event.returned) {
+                found->second.event.returned = false; // killed midway through a system call
+                publishEvent(out, found->second.event, context);
+            }
+            tracees.erase(tid);
+            if (tid == pid) rootStatus = stat;
+            continue;
+        }
+        if (!WIFSTOPPED(stat)) continue;
 
-    while(true){
-        int stat;
-        waitpid(pid, &stat, 0);
-        if (WIFSTOPPED(stat) && WSTOPSIG(stat) == SIGTRAP){
-            long syscall_id = ptrace(PTRACE_PEEKUSER, pid, ORIG_RAX * sizeof(long), 0);
-            long syscall_ret = ptrace(PTRACE_PEEKUSER, pid, RAX * sizeof(long), 0);
-            ptrace(PTRACE_SYSCALL, pid, 0, 0);
+        tracee &t = tracees[tid]; // a new child's first stop may well beat its parent's fork event
+        int sig = WSTOPSIG(stat);
+        int event = stat >> 16;
+        int deliver = 0;
+        if (sig == (SIGTRAP | 0x80)) {
+            handleSyscallStop(tid, t, out, context);
+        } else if (event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK || event == PTRACE_EVENT_CLONE) {
+            unsigned long child;
+            ptrace(PTRACE_GETEVENTMSG, tid, 0, &child);
+            tracees.emplace(pid_t(child), tracee()); // no-op if the child has already reported in
+        } else if (event != 0) {
+            // other ptrace events (e.g. PTRACE_EVENT_EXEC) are just acknowledged
+        } else if (sig == SIGSTOP && t.awaitingInitialStop) {
+            t.awaitingInitialStop = false; // swallow the SIGSTOP every auto-attached tracee starts with
+        } else {
+            deliver = sig; // a genuine signal, so pass it along
         }
-        if (WIFEXITED(stat) || WIFSIGNALED(stat)) break;
+        ptrace(PTRACE_SYSCALL, tid, 0, deliver);
+    }
+
+    if (context.binary) {
+        encodeProgramExit(out, rootStatus);
+        out.flush();
+        close(outfd);
+    } else {
+        printProgramExit(out, rootStatus);
     }
+    return rootStatus;
 }
 
 int main(int argc, char *argv[]) {
-    bool simple = false, rebuild = false;
-    int numFlags = processCommandLineFlags(simple, rebuild, argv);
+    traceContext context;
+    context.simple = context.follow = false;
+    bool rebuild = false;
+    string binaryLog;
+    int numFlags = processCommandLineFlags(context.simple, rebuild, context.follow, binaryLog, argv);
+    context.binary = !binaryLog.empty();
     if (argc - numFlags == 1) {
         cout << "Nothing to trace... exiting." << endl;
         return 0;
     }
 
-
-    return 0;
+    int stat = trace(context, rebuild, binaryLog, argv + numFlags + 1);
+    return WIFSIGNALED(stat) ? 128 + WTERMSIG(stat) : WEXITSTATUS(stat);
 }
@@ -0,0 +1,74 @@
+/**
+ * File: stsh-command-hash.cc
+ * --------------------------
+ * Presents the implementation of the STSHCommandHash class.
+ */
+
+#include "stsh-command-hash.h"
+#include <cstdlib>     // for getenv
+#include <unistd.h>    // for access
+#include <sys/stat.h>  // for stat
+using namespace std;
+
+static const char *const kDefaultPath = "/bin:/usr/bin";
+
+/**
+ * Function: isExecutableFile
+ * --------------------------
+ * Returns true if and only if the supplied path names a regular file
+ * we're allowed to execute (directories are typically executable too,
+ * but they can't be exec'ed).
+ */
+static bool isExecutableFile(const string& candidate) {
+  struct stat st;
+  if (stat(candidate.c_str(), &st) == -1 || !S_ISREG(st.st_mode)) return false;
+  return access(candidate.c_str(), X_OK) == 0;
+}
+
+/**
+ * Method: checkPath
+ * -----------------
+ * Discards the whole table if PATH has changed since it was last consulted.
+ */
+void STSHCommandHash::checkPath() {
+  const char *current = getenv("PATH");
+  if (current == NULL) current = kDefaultPath;
+  if (path != current) {
+    entries.clear();
+    path = current;
+  }
+}
+
+string STSHCommandHash::resolve(const string& command) {
+  if (command.find('/') != string::npos) return command;
+  checkPath();
+  auto found = entries.find(command);
+  if (found != entries.end()) {
+    found->second.hits++;
+    return found->second.path;
+  }
+
+  size_t start = 0;
+  while (start <= path.size()) {
+    size_t end = path.find(':', start);
+    if (end == string::npos) end = path.size();
+    string dir = path.substr(start, end - start);
+    if (dir.empty()) dir = "."; // an empty PATH entry means the current directory
+    string candidate = dir + "/" + command;
+    if (isExecutableFile(candidate)) {
+      entries[command] = {candidate, 1};
+      return candidate;
+    }
+    start = end + 1;
+  }
+
+  return "";
+}
+
+ostream& operator<<(ostream& os, const STSHCommandHash& hash) {
+  os << "hits\tcommand" << endl;
+  for (const pair<const string, STSHCommandHash::entry>& p: hash.entries) {
+    os << "   " << p.second.hits << "\t" << p.second.path << endl;
+  }
+  return os;
+}
@@ -0,0 +1,82 @@
+/**
+ * File: stsh-command-hash.h
+ * -------------------------
+ * Defines the STSHCommandHash class, which remembers where in the PATH
+ * each command was found, much like bash's hash table.  Without it, every
+ * launch goes through execvp, which tries execve on every PATH entry in turn
+ * until one of them works.  With it, the PATH is searched (via access rather
+ * than execve) the first time a command is run, and every later launch is a
+ * single execv on the remembered path:
+ *
+ *     static void launch(STSHCommandHash& hash, char *argv[]) {
+ *       std::string path = hash.resolve(argv[0]);
+ *       if (path.empty()) throw STSHException(std::string(argv[0]) + ": Command not found.");
+ *       execv(path.c_str(), argv);
+ *       if (errno == ENOENT) hash.forget(argv[0]); // the executable moved since we hashed it
+ *     }
+ *
+ * The whole table is discarded whenever the PATH changes.
+ */
+
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <iostream>
+
+class STSHCommandHash {
+
+/**
+ * Function: operator<<
+ * Usage: cout << hash;
+ * --------------------
+ * Lists every remembered command along with the number of times it's
+ * been resolved, in the same format bash's hash builtin uses.
+ */
+  friend std::ostream& operator<<(std::ostream& os, const STSHCommandHash& hash);
+
+public:
+
+/**
+ * Method: resolve
+ * ---------------
+ * Returns the path that should be handed to execv in order to run the
+ * named command.  Commands containing a '/' are returned as is, and are never
+ * remembered.  All others are looked up in the table, and on a miss the PATH
+ * is searched and the result remembered.  The empty string is returned if the
+ * command can't be found anywhere along the PATH.
+ */
+  std::string resolve(const std::string& command);
+
+/**
+ * Method: forget
+ * --------------
+ * Removes the named command from the table, so the next call to
+ * resolve searches the PATH again.
+ */
+  void forget(const std::string& command) { entries.erase(command); }
+
+/**
+ * Method: clear
+ * -------------
+ * Forgets every remembered command (as with hash -r).
+ */
+  void clear() { entries.clear(); }
+
+/**
+ * Method: empty
+ * -------------
+ * Returns true if and only if no commands are currently remembered.
+ */
+  bool empty() const { return entries.empty(); }
+
+private:
+  struct entry {
+    std::string path;
+    size_t hits;
+  };
+
+  std::unordered_map<std::string, entry> entries;
+  std::string path; // the value of PATH the table was built against
+
+  void checkPath();
+};
@@ -15,24 +15,31 @@ using namespace std;
 STSHJob STSHJobList::njob; // njob stands for no-job
 
 STSHJob &STSHJobList::addJob(const STSHJobState &state) {
-    jobs[next] = STSHJob(next, state);
-    return jobs[next++];
+    STSHJob &job = jobs[next];
+    job = STSHJob(next++, state);
+    job.owner = this;
+    updateForegroundJob(job);
+    return job;
 }
 
-bool STSHJobList::hasForegroundJob() const {
-    const STSHJob &job = getForegroundJob();
-    return &job != &njob;
+void STSHJobList::indexProcess(STSHJob &job, pid_t pid) {
+    processIndex[pid] = &job;
 }
 
-STSHJob &STSHJobList::getForegroundJob() {
-    for (pair<const size_t, STSHJob> &p: jobs) {
-        STSHJob &job = p.second;
-        if (job.getState() == kForeground) {
-            return job;
-        }
+void STSHJobList::updateForegroundJob(STSHJob &job) {
+    if (job.getState() == kForeground) {
+        foreground = &job;
+    } else if (foreground == &job) {
+        foreground = nullptr;
     }
+}
 
-    return njob;
+bool STSHJobList::hasForegroundJob() const {
+    return foreground != nullptr;
+}
+
+STSHJob &STSHJobList::getForegroundJob() {
+    return foreground == nullptr ? njob : *foreground;
 }
 
 const STSHJob &STSHJobList::getForegroundJob() const {
@@ -58,14 +65,8 @@ bool STSHJobList::containsProcess(pid_t pid) const {
 }
 
 STSHJob &STSHJobList::getJobWithProcess(pid_t pid) {
-    for (pair<const size_t, STSHJob> &p: jobs) {
-        STSHJob &job = p.second;
-        if (job.containsProcess(pid)) {
-            return job;
-        }
-    }
-
-    return njob;
+    auto found = processIndex.find(pid);
+    return found == processIndex.end() ? njob : *found->second;
 }
 
 const STSHJob &STSHJobList::getJobWithProcess(pid_t pid) const {
@@ -92,11 +93,26 @@ void STSHJobList::synchronize(STSHJob &job) {
         }
     }
 
+    for (const STSHProcess &process: processes) {
+        processIndex.erase(process.getID());
+    }
+    if (foreground == &job) foreground = nullptr;
+    if (onCompletion) onCompletion(job);
     jobs.erase(job.getNum());
 }
 
+void STSHJobList::printUsage(ostream &os) const {
+    for (const pair<const size_t, STSHJob> &p: jobs)
+        p.second.printUsage(os);
+}
+
+void STSHJobList::forEachJob(const function<void(const STSHJob &job)> &fn) const {
+    for (const auto &p: jobs)
+        fn(p.second);
+}
+
 ostream &operator<<(ostream &os, const STSHJobList &joblist) {
-    for (const pair<size_t, STSHJob> &p: joblist.jobs)
+    for (const auto &p: joblist.jobs)
         os << p.second << endl;
     return os;
 }
@@ -36,6 +36,8 @@
 #include <cstddef>
 #include <string>
 #include <map>
+#include <unordered_map>
+#include <functional>
 #include <iostream>
 #include <sys/types.h>
 
@@ -66,6 +68,7 @@ public:
  * ------------------------
  * Returns true if and only if the receiving STSHJobList has
  * a foreground job (of course, there can be at most one.)
+ * The foreground job is cached, so this runs in constant time.
  */
     bool hasForegroundJob() const;
 
@@ -103,7 +106,8 @@ public:
  * Method: containsProcess
  * -----------------------
  * Returns true iff some process within some
- * job within the job list has the specified pid.
+ * job within the job list has the specified pid.  Every
+ * pid is indexed, so this runs in constant time.
  */
     bool containsProcess(pid_t pid) const;
 
@@ -120,6 +124,37 @@ public:
 
     const STSHJob &getJobWithProcess(pid_t pid) const;
 
+/**
+ * Method: printUsage
+ * ------------------
+ * Prints every job in the list (in order of job number) along with the
+ * resource usage of each of its processes, as STSHJob::printUsage does.
+ */
+    void printUsage(std::ostream &os) const;
+
+/**
+ * Method: forEachJob
+ * ------------------
+ * Invokes the supplied function on every job in the list, in order of job number.
+ */
+    void forEachJob(const std::function<void(const STSHJob &job)> &fn) const;
+
+/**
+ * Method: setCompletionHandler
+ * ----------------------------
+ * Installs a function to be called on each job just after its last process
+ * terminates, and just before the job is removed from the job list.
+ */
+    void setCompletionHandler(const std::function<void(const STSHJob &job)> &handler) { onCompletion = handler; }
+
+/**
+ * Method: size
+ * ------------
+ * Returns the number of jobs in the job list (jobs are removed
+ * as soon as all of their processes have terminated).
+ */
+    size_t size() const { return jobs.size(); }
+
 /**
  * Method: synchronize
  * -------------------
@@ -132,8 +167,28 @@ public:
  */
     void synchronize(STSHJob &job);
 
+    STSHJobList() {}
+
 private:
     size_t next = 1;
     std::map<size_t, STSHJob> jobs; // maps work, because we want to publish in order of job number
+    std::unordered_map<pid_t, STSHJob *> processIndex; // maps every pid to the job containing it
+    STSHJob *foreground = nullptr; // the one foreground job, or nullptr if there isn't one
+    std::function<void(const STSHJob &job)> onCompletion;
     static STSHJob njob;
+
+/**
+ * Methods: indexProcess, updateForegroundJob
+ * ------------------------------------------
+ * Invoked by the STSHJobs owned by the job list whenever a process is added
+ * or the job state changes, so that the pid index and the cached foreground
+ * job never go stale.
+ */
+    void indexProcess(STSHJob &job, pid_t pid);
+    void updateForegroundJob(STSHJob &job);
+
+    STSHJobList(const STSHJobList &original) = delete;
+    STSHJobList &operator=(const STSHJobList &rhs) = delete;
+
+    friend class STSHJob;
 };
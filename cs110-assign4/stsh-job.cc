@@ -5,8 +5,11 @@
  */
 
 #include "stsh-job.h"
+#include "stsh-job-list.h"
 #include <iomanip> // for setw
 #include <sstream> // for ostringstream
+#include <algorithm> // for min, max
+#include <sys/time.h> // for timeradd
 using namespace std;
 
 STSHProcess STSHJob::nprocess;
@@ -17,19 +20,75 @@ bool STSHJob::containsProcess(pid_t pid) const {
 }
 
 STSHProcess& STSHJob::getProcess(pid_t pid) {
-  for (STSHProcess& process: processes) {
-    if (process.getID() == pid) {
-      return process;
-    }
-  }
-  
-  return nprocess;
+  auto found = indices.find(pid);
+  if (found == indices.end()) return nprocess;
+  return processes[found->second];
 }
 
 const STSHProcess& STSHJob::getProcess(pid_t pid) const {
   return const_cast<STSHJob *>(this)->getProcess(pid);
 }
 
+void STSHJob::addProcess(const STSHProcess& process) {
+  indices[process.getID()] = processes.size();
+  processes.push_back(process);
+  if (owner != nullptr) owner->indexProcess(*this, process.getID());
+}
+
+void STSHJob::setState(STSHJobState state) {
+  this->state = state;
+  if (owner != nullptr) owner->updateForegroundJob(*this);
+}
+
+struct rusage STSHJob::getUsage() const {
+  struct rusage total = {};
+  for (const STSHProcess& process: processes) {
+    if (!process.hasUsage()) continue;
+    const struct rusage& usage = process.getUsage();
+    timeradd(&total.ru_utime, &usage.ru_utime, &total.ru_utime);
+    timeradd(&total.ru_stime, &usage.ru_stime, &total.ru_stime);
+    total.ru_maxrss = max(total.ru_maxrss, usage.ru_maxrss);
+    total.ru_nvcsw += usage.ru_nvcsw;
+    total.ru_nivcsw += usage.ru_nivcsw;
+  }
+  return total;
+}
+
+double STSHJob::getWallTime() const {
+  if (processes.empty()) return 0;
+  chrono::steady_clock::time_point start = processes[0].getStartTime();
+  chrono::steady_clock::time_point end = processes[0].getEndTime();
+  for (const STSHProcess& process: processes) {
+    start = min(start, process.getStartTime());
+    end = max(end, process.getEndTime());
+  }
+  return chrono::duration<double>(end - start).count();
+}
+
+void STSHJob::printUsage(ostream& os) const {
+  ostringstream oss;
+  oss << "[" << num << "]";
+  string indent(oss.str().size() + 1, ' ');
+  os << oss.str() << " ";
+  if (processes.empty()) {
+    os << "(job is empty, devoid of processes)" << endl;
+    return;
+  }
+  for (size_t i = 0; i < processes.size(); i++) {
+    const STSHProcess& process = processes[i];
+    if (i > 0) os << indent;
+    os << process << endl;
+    double wall = chrono::duration<double>(process.getEndTime() - process.getStartTime()).count();
+    if (process.hasUsage()) {
+      os << indent << "      " << formatUsage(process.getUsage(), wall) << endl;
+    } else {
+      ostringstream real;
+      real << fixed << setprecision(3) << "real " << wall << "s (not yet reaped)";
+      os << indent << "      " << real.str() << endl;
+    }
+  }
+}
+
 ostream& operator<<(ostream& os, const STSHJob& job) {
   ostringstream oss;
   oss << "[" << job.num << "]";
@@ -25,7 +25,11 @@
 #include "stsh-process.h"
 #include <cstddef>  // for size_t
 #include <vector>   // for vector
+#include <unordered_map> // for unordered_map
 #include <iostream> // for ostream
+#include <sys/resource.h> // for struct rusage
+
+class STSHJobList;
 
 /**
  * Enumerated Type: STSHJobState
@@ -79,8 +83,9 @@ public:
  * Method: addProcess
  * ------------------
  * Appends the provided STSHProcess to be sequence of previously appended processes.
+ * If the job is owned by an STSHJobList, the job list's pid index is updated as well.
  */
-    void addProcess(const STSHProcess &process) { processes.push_back(process); }
+    void addProcess(const STSHProcess &process);
 
 /**
  * Method: getProcesses
@@ -120,9 +125,10 @@ public:
 /**
  * Method: setState
  * ----------------
- * Sets the job state (which must be either kForeground or kBackground).
+ * Sets the job state (which must be either kForeground or kBackground).  If the job
+ * is owned by an STSHJobList, the job list's cached foreground job is updated as well.
  */
-    void setState(STSHJobState state) { this->state = state; }
+    void setState(STSHJobState state);
 
 /**
  * Method: getGroupID
@@ -132,9 +138,50 @@ public:
  */
     pid_t getGroupID() const { return processes.empty() ? 0 : processes[0].getID(); }
 
+/**
+ * Methods: isTimed, setTimed
+ * --------------------------
+ * Get and set whether the job's resource usage should be reported
+ * once it completes (as it is for jobs launched via time).
+ */
+    bool isTimed() const { return timed; }
+
+    void setTimed(bool timed) { this->timed = timed; }
+
+/**
+ * Method: getUsage
+ * ----------------
+ * Returns the combined resource usage of every process in the job that's
+ * been reaped.  CPU times and context switches are summed, and maxrss is
+ * the largest of the processes' maxrss values.
+ */
+    struct rusage getUsage() const;
+
+/**
+ * Method: getWallTime
+ * -------------------
+ * Returns the number of seconds between the launch of the job's first process
+ * and the reaping of its last one (or now, if some processes are still around).
+ */
+    double getWallTime() const;
+
+/**
+ * Method: printUsage
+ * ------------------
+ * Prints the job just as operator<< does, except that each process
+ * is followed by a line summarizing its resource usage (as formatUsage does)
+ * if it's been reaped, or just its wall time so far if it hasn't.
+ */
+    void printUsage(std::ostream &os) const;
+
 private:
     size_t num;
     std::vector<STSHProcess> processes;
+    std::unordered_map<pid_t, size_t> indices; // maps pids to positions within processes
     STSHJobState state;
+    bool timed = false;
+    STSHJobList *owner = nullptr; // the job list holding this job, if any
     static STSHProcess nprocess;
+
+    friend class STSHJobList;
 };
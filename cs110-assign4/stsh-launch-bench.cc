@@ -0,0 +1,77 @@
+/**
+ * File: stsh-launch-bench.cc
+ * --------------------------
+ * Measures how many jobs per second launchPipeline can start (and
+ * the shell can reap) for pipelines of 1, 4, and 16 stages.  Each job
+ * is a pipeline of /bin/true processes, so nearly all of the time goes
+ * to launching and reaping.
+ *
+ * Usage: ./stsh-launch-bench [<jobs-per-size>] [<ballast-in-MB>]
+ *
+ * The optional ballast is allocated and touched before timing begins, so
+ * the shell's footprint can be inflated to confirm that launch cost doesn't
+ * grow with it (as it does when each stage is fork()ed).
+ */
+
+#include "stsh-launcher.h"
+#include "stsh-command-hash.h"
+#include "stsh-parse-utils.h"
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+using namespace std;
+
+static const size_t kDefaultJobsPerSize = 500;
+static const size_t kStageCounts[] = {1, 4, 16};
+static const string kUsage = "Usage: ./stsh-launch-bench [<jobs-per-size>] [<ballast-in-MB>]";
+
+static string buildCommandLine(size_t numStages) {
+  string line = "true";
+  for (size_t i = 1; i < numStages; i++) line += " | true";
+  return line;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 3) {
+    cerr << kUsage << endl;
+    return 1;
+  }
+  size_t jobsPerSize = kDefaultJobsPerSize;
+  size_t ballastMB = 0;
+  try {
+    if (argc > 1) jobsPerSize = parseNumber(argv[1], kUsage);
+    if (argc > 2) ballastMB = parseNumber(argv[2], kUsage);
+  } catch (const STSHException& e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  vector<char> ballast(ballastMB << 20);
+  if (!ballast.empty()) memset(ballast.data(), 1, ballast.size());
+
+  STSHCommandHash hash;
+  cout << "ballast: " << ballastMB << "MB, jobs per pipeline size: " << jobsPerSize << endl;
+  for (size_t numStages: kStageCounts) {
+    pipeline p(buildCommandLine(numStages));
+    vector<pid_t> pids;
+    pids.reserve(numStages);
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < jobsPerSize; i++) {
+      pids.clear();
+      launchPipeline(p, hash, [&pids](pid_t pid, const command& cmd, chrono::steady_clock::time_point started,
+                                   chrono::steady_clock::time_point execed) {
+        if (pid != 0) pids.push_back(pid);
+      });
+      for (pid_t pid: pids) waitpid(pid, NULL, 0);
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    cout << setw(3) << numStages << "-stage pipelines: "
+         << fixed << setprecision(1) << setw(9) << jobsPerSize / elapsed.count() << " jobs/sec, "
+         << setw(9) << jobsPerSize * numStages / elapsed.count() << " processes/sec" << endl;
+  }
+  return 0;
+}
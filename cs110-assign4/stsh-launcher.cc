@@ -0,0 +1,186 @@
+/**
+ * File: stsh-launcher.cc
+ * ----------------------
+ * Presents the implementation of launchPipeline.
+ */
+
+#include "stsh-launcher.h"
+#include <cerrno>
+#include <string>
+#include <memory>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+using namespace std;
+
+extern char **environ;
+
+/**
+ * Function: openRedirection
+ * -------------------------
+ * Opens the named redirection file (close-on-exec, so that only
+ * the process it's dup2'ed into ever sees it), or returns -1 if
+ * there's no such redirection.
+ */
+static int openRedirection(const string& file, int flags) {
+  if (file.empty()) return -1;
+  int fd = open(file.c_str(), flags | O_CLOEXEC, 0644);
+  if (fd == -1) throw STSHException("Could not open \"" + file + "\".");
+  return fd;
+}
+
+/**
+ * Function: spawnCommand
+ * ----------------------
+ * Spawns a single command with the supplied argv, attributes, and file actions,
+ * and returns its pid, or 0 if it couldn't be spawned.  If the command hash
+ * handed back a path that's since gone stale, the stale entry is forgotten and
+ * the PATH is searched one more time.
+ */
+static pid_t spawnCommand(const command& cmd, char *argv[], STSHCommandHash& hash,
+                          const posix_spawnattr_t& attr, const posix_spawn_file_actions_t& actions) {
+  for (int attempt = 0; attempt < 2; attempt++) {
+    string path = hash.resolve(cmd.command);
+    if (path.empty()) return 0;
+    pid_t pid;
+    int error = posix_spawn(&pid, path.c_str(), &actions, &attr, argv, environ);
+    if (error == 0) return pid;
+    if (error != ENOENT || path == cmd.command) return 0;
+    hash.forget(cmd.command);
+  }
+  return 0;
+}
+
+static size_t pipeSize = 0; // 0 means pipes are left at the system default size
+
+size_t getPipeSize() {
+  return pipeSize;
+}
+
+void setPipeSize(size_t bytes) {
+  if (bytes != 0) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) throw STSHException("Could not create a pipe.");
+    int result = fcntl(fds[0], F_SETPIPE_SZ, (int) bytes);
+    close(fds[0]);
+    close(fds[1]);
+    if (result == -1) throw STSHException("Pipes can't be resized to " + to_string(bytes) + " bytes.");
+  }
+  pipeSize = bytes;
+}
+
+void createPipe(int fds[2]) {
+  if (pipe2(fds, O_CLOEXEC) == -1) throw STSHException("Could not create a pipe.");
+  if (pipeSize != 0) fcntl(fds[0], F_SETPIPE_SZ, (int) pipeSize);
+}
+
+/**
+ * Function: launch
+ * ----------------
+ * Does the work of launchPipeline, threading the id of the process group through
+ * so that the pipelines of any process substitutions join the same group.
+ */
+static void launch(const pipeline& p, STSHCommandHash& hash, const LaunchHandler& handler,
+                   int stdinfd, int stdoutfd, pid_t& pgid) {
+  if (p.commands.empty()) throw STSHException("Missing command.");
+  vector<unique_ptr<pipeline>> substituted;
+  for (const substitution& sub: p.substitutions) substituted.emplace_back(new pipeline(sub.commandLine));
+
+  int infd = openRedirection(p.input, O_RDONLY);
+  int outfd;
+  try {
+    outfd = openRedirection(p.output, O_WRONLY | O_TRUNC | O_CREAT);
+  } catch (const STSHException& e) {
+    if (infd != -1) close(infd);
+    throw;
+  }
+  if (infd == -1) infd = stdinfd;
+  if (outfd == -1) outfd = stdoutfd;
+
+  // every pipe is close-on-exec, so each child only keeps the two ends dup2'ed onto its stdin and stdout
+  size_t numCommands = p.commands.size();
+  vector<int> fds(2 * (numCommands - 1));
+  for (size_t i = 0; i + 1 < numCommands; i++) createPipe(&fds[2 * i]);
+
+  // each substitution gets a pipe as well: the near end is passed to the command holding the
+  // substitution as a /dev/fd path, and the far end stands in for the substituted pipeline's stdout (or stdin).
+  // The paths go into copies of the argvs holding them, so the caller's pipeline is left as parsed.
+  size_t numSubstitutions = p.substitutions.size();
+  vector<int> nearfds(numSubstitutions), farfds(numSubstitutions);
+  vector<string> paths(numSubstitutions);
+  vector<vector<char *>> argvs(numCommands); // empty for every command that's spawned with its parsed argv
+  for (size_t i = 0; i < numSubstitutions; i++) {
+    const substitution& sub = p.substitutions[i];
+    int subfds[2];
+    createPipe(subfds);
+    nearfds[i] = sub.input ? subfds[0] : subfds[1];
+    farfds[i] = sub.input ? subfds[1] : subfds[0];
+    paths[i] = "/dev/fd/" + to_string(nearfds[i]);
+    vector<char *>& argv = argvs[sub.command];
+    if (argv.empty()) {
+      for (char **arg = p.commands[sub.command].argv; *arg != NULL; arg++) argv.push_back(*arg);
+      argv.push_back(NULL);
+    }
+    argv[sub.token] = const_cast<char *>(paths[i].c_str());
+  }
+
+  // children start with an empty signal mask (the shell blocks the signals it reads through its signalfd)
+  // and with the default dispositions for the signals the shell ignores
+  sigset_t mask, defaults;
+  sigemptyset(&mask);
+  sigemptyset(&defaults);
+  sigaddset(&defaults, SIGTTIN);
+  sigaddset(&defaults, SIGTTOU);
+
+  for (size_t i = 0; i < numCommands; i++) {
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setpgroup(&attr, pgid); // 0 means the new process leads a new group
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (i > 0) posix_spawn_file_actions_adddup2(&actions, fds[2 * (i - 1)], STDIN_FILENO);
+    else if (infd != -1) posix_spawn_file_actions_adddup2(&actions, infd, STDIN_FILENO);
+    if (i + 1 < numCommands) posix_spawn_file_actions_adddup2(&actions, fds[2 * i + 1], STDOUT_FILENO);
+    else if (outfd != -1) posix_spawn_file_actions_adddup2(&actions, outfd, STDOUT_FILENO);
+    for (size_t j = 0; j < numSubstitutions; j++) {
+      // dup2'ing a descriptor onto itself just clears its close-on-exec flag
+      if (p.substitutions[j].command == i) posix_spawn_file_actions_adddup2(&actions, nearfds[j], nearfds[j]);
+    }
+
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    char **argv = argvs[i].empty() ? p.commands[i].argv : argvs[i].data();
+    pid_t pid = spawnCommand(p.commands[i], argv, hash, attr, actions);
+    chrono::steady_clock::time_point execed = chrono::steady_clock::now();
+    if (pgid == 0) pgid = pid;
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    handler(pid, p.commands[i], started, execed);
+  }
+
+  for (int fd: fds) close(fd);
+  for (int fd: nearfds) close(fd);
+  if (infd != -1 && infd != stdinfd) close(infd);
+  if (outfd != -1 && outfd != stdoutfd) close(outfd);
+
+  for (size_t i = 0; i < numSubstitutions; i++) {
+    const substitution& sub = p.substitutions[i];
+    try {
+      launch(*substituted[i], hash, handler, sub.input ? -1 : farfds[i], sub.input ? farfds[i] : -1, pgid);
+    } catch (const STSHException& e) {
+      for (size_t j = i; j < numSubstitutions; j++) close(farfds[j]);
+      throw;
+    }
+    close(farfds[i]);
+  }
+}
+
+void launchPipeline(const pipeline& p, STSHCommandHash& hash, const LaunchHandler& handler,
+                    int stdinfd, int stdoutfd) {
+  pid_t pgid = 0;
+  launch(p, hash, handler, stdinfd, stdoutfd, pgid);
+}
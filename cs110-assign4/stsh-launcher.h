@@ -0,0 +1,74 @@
+/**
+ * File: stsh-launcher.h
+ * ---------------------
+ * Defines the launchPipeline function, which starts every process in
+ * a pipeline via posix_spawn.  posix_spawn never duplicates the shell's
+ * address space, so the cost of a launch doesn't depend on how much memory
+ * the shell itself has grown to use, and since all of the plumbing is described
+ * through spawn attributes and file actions, no shell code ever runs in a child.
+ */
+
+#pragma once
+#include "stsh-parser/stsh-parse.h"
+#include "stsh-command-hash.h"
+#include "stsh-exception.h"
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <sys/types.h>
+
+/**
+ * Type: LaunchHandler
+ * -------------------
+ * Describes the callback launchPipeline invokes for each command it tries to
+ * launch.  The pid is 0 if the command couldn't be launched (e.g. because it
+ * doesn't exist).  started is when the launch began, and execed is when posix_spawn
+ * returned, which glibc's posix_spawn doesn't do until the child has exec'ed (the
+ * caller is suspended, as with vfork, in the meantime), so the launch took everything
+ * from started until execed.
+ */
+typedef std::function<void(pid_t pid, const command& cmd, std::chrono::steady_clock::time_point started,
+                           std::chrono::steady_clock::time_point execed)> LaunchHandler;
+
+/**
+ * Function: launchPipeline
+ * ------------------------
+ * Launches one process per command in the supplied pipeline, each in the same
+ * new process group (led by the first process launched), with each process's
+ * standard output feeding the next one's standard input, and with the pipeline's
+ * input and output redirected as requested.  Executables are located via the
+ * supplied command hash.  If supplied, stdinfd and stdoutfd stand in for the
+ * pipeline's standard input and output wherever the pipeline itself doesn't redirect them.
+ *
+ * Each process substitution is launched as a pipeline of its own, in the same process
+ * group, after the pipeline's own commands, and the argument it appeared in is replaced
+ * with the /dev/fd path the command should open to read its output (or feed its input).
+ *
+ * The handler is invoked once per command, in the order the commands are launched.  A
+ * command that couldn't be launched has its neighbors see EOF (or EPIPE) in its place.
+ * An STSHException is thrown (before anything is launched) if either redirection file
+ * can't be opened, or if a substitution can't be parsed.  (A substitution whose own
+ * redirection file can't be opened is only discovered once the pipeline itself is running.)
+ */
+void launchPipeline(const pipeline& p, STSHCommandHash& hash, const LaunchHandler& handler,
+                    int stdinfd = -1, int stdoutfd = -1);
+
+/**
+ * Function: createPipe
+ * --------------------
+ * Creates a close-on-exec pipe, sized according to the current pipe size
+ * setting.  Every pipe launchPipeline creates is created this way.
+ */
+void createPipe(int fds[2]);
+
+/**
+ * Functions: getPipeSize, setPipeSize
+ * -----------------------------------
+ * Get and set the capacity (in bytes) pipes are grown (or shrunk) to via F_SETPIPE_SZ
+ * as they're created, where 0 means the system default is left alone.  Large pipes let
+ * pipeline stages run further ahead of one another, and cut down on context switches
+ * when a lot of data is flowing between stages.  setPipeSize throws an STSHException if
+ * the system won't allow pipes of the requested size.
+ */
+size_t getPipeSize();
+void setPipeSize(size_t bytes);
@@ -1,40 +1,202 @@
 /**
  * File: tsh-parse.c
  * -----------------
- * Presents the implementation of parseCommandLine, as documented
- * in tsh-parse.h.  It mostly delegates the process to yyparse, which
- * is generated in lexer.c and parser.h/.c by yacc from the context free grammar
- * specified in commands.y and by flex from the tokenization rules in commands.l
+ * Presents the implementation of the pipeline constructor, as documented
+ * in tsh-parse.h.  The command line is copied into an arena, which is then
+ * tokenized in place: each token is compacted toward the front of the arena
+ * (which is how quotes are stripped) and NULL terminated where it ends, so the
+ * write position never overtakes the read position.  The argument vectors are
+ * laid out at the front of the same arena, ahead of the characters.
  */
 
 #include "stsh-parse.h"
 #include "stsh-parse-exception.h"
-#include "scanner.h"
-#include "parser.h" // for yyparse
-#include <string>
-#include <cstdlib>
+#include <cstring>
 using namespace std;
 
-typedef struct yy_buffer_state *YY_BUFFER_STATE;
-extern int yyparse(pipeline &finalPipeline);
-extern YY_BUFFER_STATE yy_scan_string(const char * str);
-extern void yy_delete_buffer(YY_BUFFER_STATE buffer);
+namespace {
+
+enum tokenType {
+  kWord, kInput, kOutput, kPipe, kAmpersand, kInputSubstitution, kOutputSubstitution, kEnd
+};
+
+/**
+ * Class: tokenizer
+ * ----------------
+ * Hands back the tokens of a NULL-terminated, arena-held command line one at
+ * a time, rewriting the line in place as it goes.  Because each word is NULL
+ * terminated by overwriting whatever character follows it, an operator immediately
+ * following a word (as with the | in "ls|wc") is remembered until the next call.
+ * A < or > immediately followed by a ( introduces a process substitution, which is handed
+ * back as a single word holding everything between the parentheses.
+ */
+class tokenizer {
+ public:
+  tokenizer(char *line) : read(line), write(line), pending(kEnd), hasPending(false) {}
+
+  tokenType next(char *& word) {
+    tokenType op;
+    bool foundOperator = hasPending;
+    if (hasPending) {
+      op = pending;
+      hasPending = false;
+    } else {
+      while (isSpace(*read)) read++;
+      if (*read == '\0') return kEnd;
+      foundOperator = isOperator(*read, op);
+      if (foundOperator) read++;
+    }
+    if (foundOperator) {
+      if ((op == kInput || op == kOutput) && *read == '(') {
+        word = substitution();
+        return op == kInput ? kInputSubstitution : kOutputSubstitution;
+      }
+      return op;
+    }
+
+    word = write;
+    while (*read != '\0' && !isSpace(*read) && !isOperator(*read, op)) {
+      if (*read != '"') {
+        *write++ = *read++;
+        continue;
+      }
+      read++;
+      while (*read != '"') {
+        if (*read == '\0') throw STSHParseException("Unterminated quote.");
+        if (*read == '\\' && (read[1] == '"' || read[1] == '\\')) read++;
+        *write++ = *read++;
+      }
+      read++;
+    }
+
+    char delimiter = *read;
+    if (delimiter != '\0') read++;
+    *write++ = '\0'; // may overwrite the delimiter, which is why it's been saved
+    if (isOperator(delimiter, pending)) hasPending = true;
+    return kWord;
+  }
+
+ private:
+  char *read;
+  char *write;
+  tokenType pending;
+  bool hasPending;
+
+  /**
+   * Method: substitution
+   * --------------------
+   * Consumes everything through the parenthesis matching the one read points to,
+   * and returns the text between them (quotes and all, since that text will be parsed
+   * again as a pipeline of its own).  The parentheses themselves are dropped, so the
+   * text's NULL terminator never overwrites anything still to be read.  Text that's
+   * blank is rejected, since there'd be nothing to run.
+   */
+  char *substitution() {
+    char *start = write;
+    size_t depth = 1;
+    read++;
+    while (true) {
+      char ch = *read;
+      if (ch == '\0') throw STSHParseException("Unterminated process substitution.");
+      if (ch == '"') {
+        *write++ = *read++;
+        while (*read != '"') {
+          if (*read == '\0') throw STSHParseException("Unterminated quote.");
+          if (*read == '\\' && read[1] != '\0') *write++ = *read++;
+          *write++ = *read++;
+        }
+        *write++ = *read++;
+        continue;
+      }
+      read++;
+      if (ch == '(') depth++;
+      if (ch == ')' && --depth == 0) break;
+      *write++ = ch;
+    }
+    *write++ = '\0';
+    bool blank = true;
+    for (char *ch = start; *ch != '\0' && blank; ch++) blank = isSpace(*ch);
+    if (blank) throw STSHParseException("Missing command.");
+    return start;
+  }
+
+  static bool isSpace(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+  }
+
+  static bool isOperator(char ch, tokenType& op) {
+    switch (ch) {
+    case '<': op = kInput; return true;
+    case '>': op = kOutput; return true;
+    case '|': op = kPipe; return true;
+    case '&': op = kAmpersand; return true;
+    default: return false;
+    }
+  }
+};
 
-pipeline::pipeline(const string& str) {
-  YY_BUFFER_STATE state = yy_scan_string(str.c_str());
-  int result = yyparse(*this);
-  yy_delete_buffer(state);
-  if (result != 0) throw STSHParseException();
 }
 
-pipeline::~pipeline() {
-  input.clear();
-  output.clear();
-  for (const command& cmd: commands) {
-    for (size_t i = 0; i <= kMaxArguments && cmd.tokens[i] != NULL; i++) {
-      free(cmd.tokens[i]);
+pipeline::pipeline(const string& str) {
+  // every token occupies at least one character and is followed by at least one delimiter
+  // (or the end of the line), so there are at most (n + 1)/2 words, and there are no more
+  // commands (each of which needs a NULL to end its argument vector) than words
+  size_t numSlots = str.size() + 2;
+  arena.reset(new char[numSlots * sizeof(char *) + str.size() + 1]);
+  char **slots = reinterpret_cast<char **>(arena.get());
+  char *line = arena.get() + numSlots * sizeof(char *);
+  memcpy(line, str.c_str(), str.size() + 1);
+
+  tokenizer tokens(line);
+  char **next = slots;
+  char **argv = slots;
+  size_t outputCommand = 0;
+  while (true) {
+    char *word = NULL;
+    tokenType type = tokens.next(word);
+    if (type == kWord || type == kInputSubstitution || type == kOutputSubstitution) {
+      if (background) throw STSHParseException("& may only appear at the end of a command line.");
+      if (type != kWord) {
+        substitution sub = {type == kInputSubstitution, word, commands.size(), size_t(next - argv)};
+        substitutions.push_back(sub);
+      }
+      *next++ = word;
+      continue;
     }
+
+    if (type == kInput || type == kOutput) {
+      char *file = NULL;
+      if (tokens.next(file) != kWord) throw STSHParseException("Missing file name for redirection.");
+      if (type == kInput) {
+        if (!commands.empty()) throw STSHParseException("Only the first command may redirect its input.");
+        input = file;
+      } else {
+        output = file;
+        outputCommand = commands.size();
+      }
+      continue;
+    }
+
+    if (type == kAmpersand) {
+      background = true;
+      continue;
+    }
+
+    // a pipe or the end of the line completes the current command
+    if (next == argv) {
+      if (type == kEnd && commands.empty() && input.empty() && output.empty() && !background) break; // empty line
+      throw STSHParseException("Missing command.");
+    }
+    if (type == kPipe && background) throw STSHParseException("& may only appear at the end of a command line.");
+    *next++ = NULL;
+    command cmd = {argv[0], argv + 1, argv};
+    commands.push_back(cmd);
+    argv = next;
+    if (type == kEnd) break;
   }
+
+  if (!output.empty() && outputCommand != commands.size() - 1)
+    throw STSHParseException("Only the last command may redirect its output.");
 }
 
 ostream& operator<<(ostream& os, const pipeline& p) {
@@ -42,9 +204,13 @@ ostream& operator<<(ostream& os, const pipeline& p) {
   if (!p.output.empty()) os << "Output File: " << p.output << endl;
   for (size_t i = 0; i < p.commands.size(); i++) {
     os << "Executable " << i << ": " << p.commands[i].command << endl;
-    for (size_t j = 0; j <= kMaxArguments && p.commands[i].tokens[j] != NULL; j++) {
+    for (size_t j = 0; p.commands[i].tokens[j] != NULL; j++) {
       os << "       Arg " << j << ": " << p.commands[i].tokens[j] << endl;
     }
   }
+  for (const substitution& sub: p.substitutions) {
+    os << "Substitution " << (sub.input ? "<(" : ">(") << sub.commandLine << ")"
+       << " for executable " << sub.command << ", argv[" << sub.token << "]" << endl;
+  }
   return os;
 }
@@ -12,21 +12,39 @@
 
 #include <vector>
 #include <string>
+#include <memory>
 #include <iostream>
 
-const size_t kMaxCommandLength = 32;
-const size_t kMaxArguments = 32;
-
+/**
+ * Every command's C strings and argument vector live in a single arena
+ * owned by the surrounding pipeline, so a command is only valid for as
+ * long as its pipeline is.  There are no limits on the number of arguments
+ * or on their lengths.
+ */
 struct command {
-  char command[kMaxCommandLength + 1]; // NULL terminated
-  char *tokens[kMaxArguments + 1]; // array, C strings are all NULL terminated
+  char *command;  // the executable's name, NULL terminated (and always equal to argv[0])
+  char **tokens;  // the arguments following the executable's name, NULL terminated (and always equal to argv + 1)
+  char **argv;    // the executable's name followed by the arguments, ready to be handed to exec as is
+};
+
+/**
+ * A process substitution, written <(pipeline) or >(pipeline) in place of an
+ * argument.  The argument is replaced by a /dev/fd path at launch time, which
+ * reads the substituted pipeline's output (for <) or feeds its input (for >).
+ */
+struct substitution {
+  bool input;               // true for <(...), false for >(...)
+  std::string commandLine;  // the text between the parentheses
+  size_t command;           // the index of the command whose argument vector holds the substitution
+  size_t token;             // the index of the substitution within that argument vector
 };
 
 struct pipeline {
   std::string input;   // empty if no input redirection file to first command
   std::string output;  // empty if no output redirection file from last command
   std::vector<command> commands;
-  bool background;
+  std::vector<substitution> substitutions; // in the order they appear
+  bool background = false;
 
 /**
  * Accepts a command line and parses it to construct the pipeline.
@@ -66,13 +84,23 @@ struct pipeline {
  * input and output redirection, and those options can be specified in any
  * order. That is: "< input" , "> output", and  "command [args...]" can be
  * written in any order.
+ *
+ * Any argument may instead be a process substitution, as with
+ *
+ *   diff <(sort a) <(sort b)
+ *
+ * in which case the argument vector holds the substitution's command line
+ * until it's replaced at launch time.
+ *
+ * The line is tokenized with a single pass over a copy of it held in a single
+ * arena allocation: quotes are stripped and each token is NULL terminated in place,
+ * and each command's argument vector is built within that same arena, so no token
+ * is ever copied (or allocated) individually.
  */
   pipeline(const std::string& str);
 
-/**
- * It frees the dynamically allocated char *s containing the argument lists.
- */
-  ~pipeline();
+ private:
+  std::unique_ptr<char[]> arena;
 };
 
 std::ostream& operator<<(std::ostream& os, const pipeline& p);
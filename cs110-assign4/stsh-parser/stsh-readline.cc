@@ -15,6 +15,9 @@
 #include <cctype>
 #include <locale>
 #include <getopt.h>
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
 #include "string-utils.h"
 using namespace std;
 
@@ -71,3 +74,77 @@ bool readline(string& line) {
     add_history(line.c_str());
   return true;
 }
+
+/**
+ * Function: waitForInput
+ * ----------------------
+ * Blocks until standard input is readable (or has hit EOF), handing
+ * control to onEvent each time the event descriptor becomes readable in
+ * the meantime.
+ */
+static void waitForInput(int eventfd, const function<void()>& onEvent) {
+  while (true) {
+    struct pollfd fds[] = {{STDIN_FILENO, POLLIN, 0}, {eventfd, POLLIN, 0}};
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    if (fds[1].revents & POLLIN) onEvent();
+    if (fds[0].revents != 0) return;
+  }
+}
+
+static string pending;        // raw input read in but not yet handed back as a line
+static bool exhausted = false;
+static bool callbackDone;
+static char *callbackLine;
+
+static void acceptLine(char *s) {
+  callbackLine = s;
+  callbackDone = true;
+  rl_callback_handler_remove();
+}
+
+bool readline(string& line, int eventfd, const function<void()>& onEvent) {
+  line.clear();
+  if (!history) {
+    cout << prompt << flush;
+    while (true) {
+      size_t newline = pending.find('\n');
+      if (newline != string::npos) {
+        line = pending.substr(0, newline);
+        pending.erase(0, newline + 1);
+        break;
+      }
+      if (exhausted) {
+        line.swap(pending);
+        if (line.empty()) return false;
+        break;
+      }
+      waitForInput(eventfd, onEvent);
+      char buffer[4096];
+      ssize_t count = read(STDIN_FILENO, buffer, sizeof(buffer));
+      if (count > 0) {
+        pending.append(buffer, count);
+      } else if (count == 0 || (errno != EINTR && errno != EAGAIN)) {
+        exhausted = true;
+      }
+    }
+    trim(line);
+    return true;
+  }
+
+  callbackDone = false;
+  rl_callback_handler_install(prompt.c_str(), acceptLine);
+  while (!callbackDone) {
+    waitForInput(eventfd, onEvent);
+    rl_callback_read_char();
+  }
+  if (callbackLine == NULL) return false;
+  line = callbackLine;
+  free(callbackLine);
+  trim(line);
+  if (!line.empty())
+    add_history(line.c_str());
+  return true;
+}
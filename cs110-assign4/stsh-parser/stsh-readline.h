@@ -10,6 +10,7 @@
 #define _stsh_readline_
 
 #include <string>
+#include <functional>
 
 /**
  * Function: rlinit
@@ -29,4 +30,16 @@ void rlinit(int argc, char *argv[]);
  */
 bool readline(std::string& line);
 
+/**
+ * Function: readline
+ * ------------------
+ * Behaves just like the version above, except that it never blocks on standard
+ * input alone: while waiting for the next line, it also polls the supplied descriptor
+ * (typically a signalfd), and invokes onEvent each time that descriptor becomes
+ * readable.  onEvent is responsible for draining the descriptor.  Input is pulled
+ * directly from file descriptor 0, so this version shouldn't be mixed with the one above,
+ * or with direct reads from cin.
+ */
+bool readline(std::string& line, int eventfd, const std::function<void()>& onEvent);
+
 #endif
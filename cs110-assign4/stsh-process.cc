@@ -6,6 +6,7 @@
 
 #include "stsh-process.h"
 #include <iomanip>  // for setw, left
+#include <sstream>  // for ostringstream
 using namespace std;
 
 STSHProcess::STSHProcess(pid_t pid, const command& command, STSHProcessState state) : pid(pid), state(state) {
@@ -14,6 +15,28 @@ STSHProcess::STSHProcess(pid_t pid, const command& command, STSHProcessState sta
     tokens.push_back(*tokenp);
 }
 
+void STSHProcess::recordExit(const struct rusage& usage) {
+  this->usage = usage;
+  end = chrono::steady_clock::now();
+  reaped = true;
+}
+
+chrono::steady_clock::time_point STSHProcess::getEndTime() const {
+  return reaped ? end : chrono::steady_clock::now();
+}
+
+static double toSeconds(const struct timeval& tv) {
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+string formatUsage(const struct rusage& usage, double wall) {
+  ostringstream oss;
+  oss << fixed << setprecision(3)
+      << "real " << wall << "s  user " << toSeconds(usage.ru_utime) << "s  sys " << toSeconds(usage.ru_stime) << "s"
+      << "  maxrss " << usage.ru_maxrss << "KB  csw " << usage.ru_nvcsw << "/" << usage.ru_nivcsw;
+  return oss.str();
+}
+
 static ostream& operator<<(ostream& os, STSHProcessState state) {
   const char *str = "Unknown";
   switch (state) {
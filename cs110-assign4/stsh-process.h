@@ -17,6 +17,8 @@
 #include <vector>   // for vector
 #include <string>   // for string
 #include <iostream> // for ostream
+#include <chrono>   // for steady_clock
+#include <sys/resource.h> // for struct rusage
 
 /**
  * Enumerated Type: STSHProcessState
@@ -80,8 +82,57 @@ public:
  */
   void setState(STSHProcessState state) { this->state = state; }
 
+/**
+ * Method: recordExit
+ * ------------------
+ * Records the resource usage reported by wait4 when the process was reaped,
+ * and stops the process's wall clock.
+ */
+  void recordExit(const struct rusage& usage);
+
+/**
+ * Method: hasUsage
+ * ----------------
+ * Returns true if and only if the process has been reaped, so that
+ * getUsage reports its final resource usage.
+ */
+  bool hasUsage() const { return reaped; }
+
+/**
+ * Method: getUsage
+ * ----------------
+ * Returns the process's resource usage, as reported by wait4.  The
+ * usage is all zeroes until the process has been reaped.
+ */
+  const struct rusage& getUsage() const { return usage; }
+
+/**
+ * Methods: getStartTime, getEndTime
+ * ---------------------------------
+ * Return the moment the process was added to stsh's bookkeeping (which is
+ * right after it's launched) and the moment it was reaped (or the current time,
+ * if it hasn't been reaped yet).
+ */
+  std::chrono::steady_clock::time_point getStartTime() const { return start; }
+  std::chrono::steady_clock::time_point getEndTime() const;
+
 private:
   pid_t pid;
   std::vector<std::string> tokens;
   STSHProcessState state;
+  bool reaped = false;
+  struct rusage usage = {};
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point end;
 };
+
+/**
+ * Function: formatUsage
+ * ---------------------
+ * Returns a one-line summary of the supplied resource usage and wall time, e.g.
+ *
+ *     real 1.204s  user 0.930s  sys 0.012s  maxrss 4436KB  csw 12/87
+ *
+ * where csw lists the voluntary and involuntary context switches.
+ */
+std::string formatUsage(const struct rusage& usage, double wall);
@@ -8,11 +8,11 @@
  */
 
 #include <signal.h>
+#include <sys/signalfd.h>
+#include <cerrno>
+#include <unistd.h>
 #include "stsh-signal.h"
 #include "stsh-exception.h"
-#include "stsh-job-list.h"
-#include "stsh-job.h"
-#include "stsh_v1.cc"
 
 using namespace std;
 
@@ -25,23 +25,24 @@ void installSignalHandler(int signum, handler_t handler) {
         throw STSHException("Failed to install a handler for signal with number " + to_string(signum) + ".");
 }
 
-void foregroundProcessHandler(int sig) {
-    while(true){
-        pid_t pid;
-        int stat;
-        if ( (pid = waitpid(-1, &stat, WNOHANG | WUNTRACED)) < 0) break;
+int createSignalDescriptor(initializer_list<int> signums) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int signum: signums) sigaddset(&mask, signum);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        throw STSHException("Failed to block signals to be delivered via signalfd.");
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) throw STSHException("Failed to create a signalfd.");
+    return fd;
+}
 
-        if (joblist.containsProcess(pid)){
-            STSHJob &job = joblist.getJobWithProcess(pid);
-            if (job.containsProcess(pid)){
-                STSHProcess &process = job.getProcess(pid);
-                if (WIFSTOPPED(stat)) {
-                    process.setState(kStopped);
-                } else if (WIFEXITED(stat)){
-                    process.setState(kTerminated);
-                }
-                joblist.synchronize(job);
-            }
-        }
+int readSignal(int fd, struct signalfd_siginfo *info) {
+    struct signalfd_siginfo local;
+    if (info == NULL) info = &local;
+    while (true) {
+        ssize_t count = read(fd, info, sizeof(*info));
+        if (count == sizeof(*info)) return info->ssi_signo;
+        if (count == -1 && errno == EINTR) continue;
+        return 0; // EAGAIN: nothing pending
     }
 }
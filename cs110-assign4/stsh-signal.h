@@ -9,6 +9,9 @@
  */
 
 #pragma once
+#include <cstddef>
+#include <initializer_list>
+#include <sys/signalfd.h>
 
 /**
  * Type: handler_t
@@ -30,10 +33,21 @@ typedef void (*handler_t)(int);
 void installSignalHandler(int signum, handler_t handler);
 
 /**
- * Function: foregroundProcessHandler
- * ------------------------------
- * Handles SIGCHLD for foreground process
+ * Function: createSignalDescriptor
+ * --------------------------------
+ * Blocks the specified signals and returns a non-blocking, close-on-exec
+ * signalfd through which they're delivered instead, so they can be handled
+ * synchronously (e.g. from within a poll loop) rather than asynchronously
+ * from within a signal handler.
  */
-void foregroundProcessHandler(int sig);
-
+int createSignalDescriptor(std::initializer_list<int> signums);
 
+/**
+ * Function: readSignal
+ * --------------------
+ * Returns the number of the next signal pending on the supplied signalfd,
+ * or 0 if no signals are pending.  If info is supplied, it's filled with
+ * everything the signalfd reported about the signal (e.g. the pid of the
+ * child behind a SIGCHLD).
+ */
+int readSignal(int fd, struct signalfd_siginfo *info = NULL);
@@ -0,0 +1,147 @@
+/**
+ * File: stsh-trace.cc
+ * -------------------
+ * Presents the implementation of the STSHTrace class.
+ */
+
+#include "stsh-trace.h"
+#include <algorithm>
+#include <iomanip>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+static const char *const kEventNames[] = {
+  "spawn", "exec", "stop", "cont", "exit", "reap", "tcsetpgrp"
+};
+
+void STSHTrace::enable(size_t numEvents) {
+  disable();
+  size_t size = 2;
+  while (size < numEvents) size <<= 1;
+  entries.reset(new entry[size]);
+  capacity = size;
+  clear();
+  enabled.store(true, memory_order_relaxed);
+}
+
+void STSHTrace::clear() {
+  for (size_t i = 0; i < capacity; i++) entries[i].sequence.store(0, memory_order_relaxed);
+  next.store(0, memory_order_release);
+}
+
+void STSHTrace::record(STSHTraceEvent event, pid_t pid, size_t job, clock::time_point when) {
+  if (!enabled.load(memory_order_relaxed)) return;
+  uint64_t index = next.fetch_add(1, memory_order_relaxed);
+  entry& e = entries[index & (capacity - 1)];
+  e.sequence.store(0, memory_order_relaxed); // marks the slot as being rewritten
+  atomic_thread_fence(memory_order_release);
+  e.when = when;
+  e.pid = pid;
+  e.job = job;
+  e.event = event;
+  e.sequence.store(index + 1, memory_order_release);
+}
+
+/**
+ * Method: forEach
+ * ---------------
+ * Visits every event still in the ring, oldest first.  An event that's
+ * overwritten while it's being read (which can only happen if record is called
+ * from a signal handler, or from another thread) is skipped rather than
+ * reported half old and half new.
+ */
+template <typename Visitor>
+void STSHTrace::forEach(Visitor visit) const {
+  uint64_t end = next.load(memory_order_acquire);
+  uint64_t start = end > capacity ? end - capacity : 0;
+  for (uint64_t i = start; i < end; i++) {
+    const entry& e = entries[i & (capacity - 1)];
+    if (e.sequence.load(memory_order_acquire) != i + 1) continue;
+    clock::time_point when = e.when;
+    pid_t pid = e.pid;
+    size_t job = e.job;
+    STSHTraceEvent event = e.event;
+    atomic_thread_fence(memory_order_acquire);
+    if (e.sequence.load(memory_order_relaxed) != i + 1) continue;
+    visit(when, pid, job, event);
+  }
+}
+
+/**
+ * Function: microseconds
+ * ----------------------
+ * Returns the length of the supplied duration in (fractional) microseconds.
+ */
+static double microseconds(STSHTrace::clock::duration d) {
+  return chrono::duration<double, micro>(d).count();
+}
+
+ostream& operator<<(ostream& os, const STSHTrace& trace) {
+  bool first = true;
+  STSHTrace::clock::time_point origin;
+  os << setw(14) << "time (us)" << setw(9) << "pid" << setw(6) << "job" << "  event" << endl;
+  trace.forEach([&](STSHTrace::clock::time_point when, pid_t pid, size_t job, STSHTraceEvent event) {
+    if (first) origin = when;
+    first = false;
+    os << fixed << setprecision(3) << setw(14) << microseconds(when - origin)
+       << setw(9) << pid << setw(6) << job << "  " << kEventNames[event] << endl;
+  });
+  return os;
+}
+
+/**
+ * Function: printLatencies
+ * ------------------------
+ * Prints the number of samples along with their minimum, median, 99th
+ * percentile, maximum, and mean, all in microseconds.
+ */
+static void printLatencies(ostream& os, const string& name, vector<double>& samples) {
+  os << name << ": ";
+  if (samples.empty()) {
+    os << "no samples" << endl;
+    return;
+  }
+  sort(samples.begin(), samples.end());
+  double total = 0;
+  for (double sample: samples) total += sample;
+  size_t n = samples.size();
+  os << n << (n == 1 ? " sample, " : " samples, ") << fixed << setprecision(1)
+     << "min " << samples[0] << "us, median " << samples[n / 2] << "us, p99 "
+     << samples[min(n - 1, n * 99 / 100)] << "us, max " << samples[n - 1]
+     << "us, mean " << total / n << "us" << endl;
+}
+
+void STSHTrace::printSummary(ostream& os) const {
+  unordered_map<pid_t, clock::time_point> spawned, exited;
+  vector<double> spawnToExec, wakeToReap;
+  size_t handoffs = 0;
+  forEach([&](clock::time_point when, pid_t pid, size_t job, STSHTraceEvent event) {
+    switch (event) {
+    case kSpawnEvent: spawned[pid] = when; break;
+    case kExitEvent: exited[pid] = when; break;
+    case kTcsetpgrpEvent: handoffs++; break;
+    case kExecEvent: {
+      auto found = spawned.find(pid);
+      if (found == spawned.end()) break;
+      spawnToExec.push_back(microseconds(when - found->second));
+      spawned.erase(found);
+      break;
+    }
+    case kReapEvent: {
+      auto found = exited.find(pid);
+      if (found == exited.end()) break;
+      wakeToReap.push_back(microseconds(when - found->second));
+      exited.erase(found);
+      break;
+    }
+    default: break;
+    }
+  });
+  uint64_t recorded = next.load(memory_order_acquire);
+  os << recorded << " events recorded, " << min<uint64_t>(recorded, capacity) << " retained, "
+     << handoffs << " terminal hand-offs" << endl;
+  printLatencies(os, "spawn-to-exec", spawnToExec);
+  printLatencies(os, "wake-to-reap", wakeToReap);
+}
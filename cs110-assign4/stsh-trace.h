@@ -0,0 +1,125 @@
+/**
+ * File: stsh-trace.h
+ * ------------------
+ * Defines the STSHTrace class, an opt-in log of the job control events
+ * stsh drives and observes: every spawn and exec, every stop, continue,
+ * and exit the shell is told about, every reap, and every hand-off of the
+ * terminal via tcsetpgrp.  Events are recorded into a fixed-size ring, so
+ * a long-running shell only ever retains the most recent ones, and recording
+ * never allocates, blocks, or takes a lock (so it's even safe from within
+ * a signal handler).  While tracing is disabled, recording an event costs a
+ * single load.
+ */
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <sys/types.h>
+
+/**
+ * Type: STSHTraceEvent
+ * --------------------
+ * Enumerates the kinds of events that can be traced.  spawn is recorded as
+ * posix_spawn is invoked and exec once it returns (by which point the child
+ * has exec'ed).  stop, cont, and exit are stamped when the shell wakes to drain
+ * its signalfd, not when the child changed state, and reap as the shell collects
+ * an exited child via wait4.
+ */
+enum STSHTraceEvent {
+  kSpawnEvent, kExecEvent, kStopEvent, kContEvent, kExitEvent, kReapEvent, kTcsetpgrpEvent
+};
+
+class STSHTrace {
+
+/**
+ * Function: operator<<
+ * Usage: cout << trace;
+ * ---------------------
+ * Dumps every event still in the ring, oldest first, with times
+ * relative to the oldest one.
+ */
+  friend std::ostream& operator<<(std::ostream& os, const STSHTrace& trace);
+
+public:
+  typedef std::chrono::steady_clock clock;
+
+/**
+ * Constructor: STSHTrace
+ * ----------------------
+ * Constructs a disabled trace.  No memory is set aside for events
+ * until tracing is enabled.
+ */
+  STSHTrace() : capacity(0), enabled(false), next(0) {}
+  STSHTrace(const STSHTrace& other) = delete;
+  STSHTrace& operator=(const STSHTrace& rhs) = delete;
+
+/**
+ * Method: enable
+ * --------------
+ * Starts recording events into a ring with room for (at least) the
+ * supplied number of events, discarding anything recorded so far.
+ */
+  void enable(size_t numEvents = kDefaultCapacity);
+
+/**
+ * Method: disable
+ * ---------------
+ * Stops recording events.  Whatever's been recorded is retained until
+ * the trace is cleared or enabled again.
+ */
+  void disable() { enabled.store(false, std::memory_order_relaxed); }
+
+/**
+ * Method: isEnabled
+ * -----------------
+ * Returns true if and only if events are currently being recorded.
+ */
+  bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+/**
+ * Method: clear
+ * -------------
+ * Discards every recorded event.
+ */
+  void clear();
+
+/**
+ * Method: record
+ * --------------
+ * Records an event on behalf of the supplied process (or process group, for
+ * tcsetpgrp) and job, where the job number is 0 if the process isn't part of
+ * any job.  The event is stamped with the current time unless a time is supplied.
+ */
+  void record(STSHTraceEvent event, pid_t pid, size_t job, clock::time_point when = clock::now());
+
+/**
+ * Method: printSummary
+ * --------------------
+ * Summarizes the spawn-to-exec and wake-to-reap latencies of every process
+ * for which both events are still in the ring.  Since exit events are stamped
+ * when the shell wakes to its SIGCHLD, wake-to-reap measures how long the shell
+ * takes to collect a child it knows has exited, not how long the child waited.
+ */
+  void printSummary(std::ostream& os) const;
+
+  static const size_t kDefaultCapacity = 4096;
+
+private:
+  struct entry {
+    std::atomic<uint64_t> sequence; // one more than the event's index once written, and 0 while being written
+    clock::time_point when;
+    pid_t pid;
+    size_t job;
+    STSHTraceEvent event;
+  };
+
+  std::unique_ptr<entry[]> entries;
+  size_t capacity; // always a power of two
+  std::atomic<bool> enabled;
+  std::atomic<uint64_t> next; // the index of the next event to be recorded
+
+  template <typename Visitor> void forEach(Visitor visit) const;
+};
@@ -7,11 +7,15 @@
 #include "stsh-parser/stsh-parse.h"
 #include "stsh-parser/stsh-readline.h"
 #include "stsh-parser/stsh-parse-exception.h"
+#include "stsh-parser/string-utils.h"
 #include "stsh-signal.h"
 #include "stsh-job-list.h"
 #include "stsh-job.h"
 #include "stsh-parse-utils.h"
 #include "stsh-process.h"
+#include "stsh-command-hash.h"
+#include "stsh-launcher.h"
+#include "stsh-trace.h"
 #include <cstring>
 #include <iostream>
 #include <string>
@@ -20,15 +24,36 @@
 #include <unistd.h>  // for fork
 #include <signal.h>  // for kill
 #include <sys/wait.h>
+#include <sys/resource.h> // for wait4
 #include <cassert>
+#include <fstream>
+#include <sstream>
+#include <getopt.h>
+#include <cerrno>
+#include <poll.h>
 using namespace std;
 
 static STSHJobList joblist; // the one piece of global data we need so signal handlers can access it
+static int signalsfd; // the signalfd through which SIGCHLD, SIGINT, SIGTSTP, and SIGQUIT are delivered
+static STSHCommandHash commandHash; // remembers where along the PATH each command lives
+static STSHTrace trace; // the job control events recorded once tracing is enabled via stshtrace
+static bool batch = false; // true if commands come from a script (-f) or the command line (-c)
+static size_t maxJobs = 0; // the most jobs allowed to run at once (via -j, in batch mode only), or 0 if there's no cap
+static size_t coprocJob = 0; // the number of the coprocess's job, or 0 if there's no coprocess
+static int coprocInput = -1; // the shell's end of the pipe feeding the coprocess's standard input
+static int coprocOutput = -1; // the shell's end of the pipe draining the coprocess's standard output
 static const string kFgUsage = "Usage: fg <jobid>.";
 static const string kBgUsage = "Usage: bg <jobid>.";
 static const string kSlayUsage = "Usage: slay <jobid> <index> | <pid>.";
 static const string kHaltUsage = "Usage: halt <jobid> <index> | <pid>.";
 static const string kContUsage = "Usage: cont <jobid> <index> | <pid>.";
+static const string kJobsUsage = "Usage: jobs [-l].";
+static const string kTimeUsage = "Usage: time <pipeline>.";
+static const string kHashUsage = "Usage: hash [-r] [<command> ...].";
+static const string kPipeSizeUsage = "Usage: pipesize [<bytes>].";
+static const string kTraceUsage = "Usage: stshtrace [on [<events>] | off | clear | -s].";
+static const string kCoprocUsage = "Usage: coproc [-c | <pipeline>].";
+static const string kStshUsage = "Usage: ./stsh [--suppress-prompt] [--no-history] [(-f <script> | -c <commands>) [-j <max-jobs>]]";
 
 /**
  * Function: getArgvLen
@@ -36,40 +61,222 @@ static const string kContUsage = "Usage: cont <jobid> <index> | <pid>.";
  * Gets cmd.tokens valid length.
  */
 static size_t getArgvLen(const command& cmd) {
-  for (size_t i = 0; i < kMaxArguments + 1; i++) {
-    if (cmd.tokens[i] == NULL) return i;
-  }
-  return kMaxArguments;
+  size_t i = 0;
+  while (cmd.tokens[i] != NULL) i++;
+  return i;
+}
+
+/**
+ * Function: jobNumberOf
+ * -------------------
+ * Returns the number of the job the supplied process belongs to, or 0
+ * if it doesn't belong to any.
+ */
+static size_t jobNumberOf(pid_t pid) {
+  if (!joblist.containsProcess(pid)) return 0;
+  return joblist.getJobWithProcess(pid).getNum();
+}
+
+/**
+ * Function: giveTerminalTo
+ * -------------------
+ * Hands control of the terminal to the supplied process group, which
+ * is the group of the supplied job (or the shell's own group, if job is 0).
+ */
+static void giveTerminalTo(pid_t pgid, size_t job) {
+  if (tcsetpgrp(STDIN_FILENO, pgid) == 0) trace.record(kTcsetpgrpEvent, pgid, job);
 }
 
 /**
  * Function: updateJobList
  * -------------------
- * Updates the joblist for given pid and state.
+ * Updates the joblist for given pid and state, recording the resource usage
+ * wait4 reported if the process has terminated.
  */
-static void updateJobList(pid_t pid, STSHProcessState state) {
+static void updateJobList(pid_t pid, STSHProcessState state, const struct rusage& usage) {
   if (!joblist.containsProcess(pid)) return;
   STSHJob& job = joblist.getJobWithProcess(pid);
   assert(job.containsProcess(pid));
   STSHProcess& process = job.getProcess(pid);
   process.setState(state);
+  if (state == kTerminated) process.recordExit(usage);
   joblist.synchronize(job);
 }
 
+/**
+ * Function: reapChildren
+ * ----------------------
+ * Reaps every child whose state has changed and updates the job list to match.
+ * Children are reaped with wait4, so that the resource usage of those that have
+ * terminated can be recorded.
+ * This runs in normal context (never from within a signal handler) whenever the
+ * signalfd reports a SIGCHLD, and since several SIGCHLDs can be coalesced into one,
+ * everything that can be reaped is reaped in a single batch.
+ */
+static void reapChildren() {
+  pid_t pid;
+  while (true) {
+    int status;
+    struct rusage usage;
+    pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage);
+    if (pid <= 0) break;
+    STSHProcessState state = kTerminated;
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      state = kTerminated;
+    } else if (WIFSTOPPED(status)) {
+      state = kStopped;
+    } else if (WIFCONTINUED(status)) {
+      state = kRunning;
+    }
+    if (state == kTerminated) trace.record(kReapEvent, pid, jobNumberOf(pid));
+    updateJobList(pid, state, usage);
+  }
+  // give stdin control back to shell
+  if (!joblist.hasForegroundJob() && tcgetpgrp(STDIN_FILENO) != getpgrp()) {
+    giveTerminalTo(getpgrp(), 0);
+  }
+}
+
+/**
+ * Function: passSigToFgJob
+ * -------------------
+ * Passes the signal to the foreground job.
+ */
+static void passSigToFgJob(int sig) {
+  if (joblist.hasForegroundJob()) {
+    kill(-joblist.getForegroundJob().getGroupID(), sig);
+  }
+}
+
+/**
+ * Function: abandonBatch
+ * ----------------------
+ * Responds to a SIGINT or SIGTERM in batch mode, where jobs may be running in the
+ * background and would never hear about it otherwise: every job is killed, and the
+ * shell exits with the status a shell killed by the signal would report.
+ */
+static void abandonBatch(int sig) {
+  joblist.forEachJob([](const STSHJob& job) {
+    if (job.getGroupID() != 0) kill(-job.getGroupID(), SIGKILL);
+  });
+  exit(128 + sig);
+}
+
+/**
+ * Function: traceChildSignal
+ * --------------------------
+ * Records the child state change behind a SIGCHLD, stamped with woke, the time the
+ * shell woke up to drain the signalfd.  SIGCHLD is blocked rather than handled, so
+ * that's the earliest the shell can know of the change; the time the child actually
+ * exited isn't available.  Several SIGCHLDs can be coalesced into one, in which case
+ * only one of the state changes is recorded here (though every exited child is still
+ * recorded when it's reaped).
+ */
+static void traceChildSignal(const struct signalfd_siginfo& info, STSHTrace::clock::time_point woke) {
+  if (!trace.isEnabled()) return;
+  pid_t pid = info.ssi_pid;
+  switch (info.ssi_code) {
+  case CLD_EXITED:
+  case CLD_KILLED:
+  case CLD_DUMPED: trace.record(kExitEvent, pid, jobNumberOf(pid), woke); break;
+  case CLD_STOPPED: trace.record(kStopEvent, pid, jobNumberOf(pid), woke); break;
+  case CLD_CONTINUED: trace.record(kContEvent, pid, jobNumberOf(pid), woke); break;
+  }
+}
+
+/**
+ * Function: handlePendingSignals
+ * ------------------------------
+ * Drains the signalfd and responds to every signal pending on it.  Child
+ * state changes are handled last, after every pending signal has been read.
+ */
+static void handlePendingSignals() {
+  STSHTrace::clock::time_point woke = STSHTrace::clock::now();
+  bool childrenChanged = false;
+  while (true) {
+    struct signalfd_siginfo info;
+    int sig = readSignal(signalsfd, &info);
+    if (sig == 0) break;
+    switch (sig) {
+    case SIGCHLD: childrenChanged = true; traceChildSignal(info, woke); break;
+    case SIGINT:
+      if (batch) abandonBatch(sig);
+      passSigToFgJob(sig);
+      break;
+    case SIGTERM: abandonBatch(sig); break; // only routed through the signalfd in batch mode
+    case SIGTSTP: passSigToFgJob(sig); break;
+    case SIGQUIT: exit(0);
+    }
+  }
+  if (childrenChanged) reapChildren();
+}
+
+/**
+ * Function: waitForSignals
+ * -------------------
+ * Blocks until at least one signal is pending on the signalfd, and then
+ * handles everything pending.
+ */
+static void waitForSignals() {
+  struct pollfd pfd = {signalsfd, POLLIN, 0};
+  if (poll(&pfd, 1, -1) == -1 && errno != EINTR) return;
+  handlePendingSignals();
+}
+
 /**
  * Function: waitForFgJobToFinish
  * -------------------
- * Makes main process hang for foreground job to finish.
+ * Makes main process hang for foreground job to finish, handling
+ * signals as they arrive on the signalfd.
  */
 static void waitForFgJobToFinish() {
-  sigset_t additions, existingmask;
-  sigemptyset(&additions);
-  sigaddset(&additions, SIGCHLD);
-  sigprocmask(SIG_BLOCK, &additions, &existingmask);
   while (joblist.hasForegroundJob()) {
-    sigsuspend(&existingmask);
+    waitForSignals();
+  }
+}
+
+/**
+ * Function: countRunningJobs
+ * --------------------------
+ * Counts the jobs that occupy one of the slots capped by -j: every job with a process
+ * that hasn't stopped or terminated, other than the coprocess, which runs for as long
+ * as the shell keeps its input open.
+ */
+static size_t countRunningJobs() {
+  size_t count = 0;
+  joblist.forEachJob([&count](const STSHJob& job) {
+    if (job.getNum() == coprocJob) return;
+    for (const STSHProcess& process: job.getProcesses()) {
+      if (process.getState() != kStopped && process.getState() != kTerminated) {
+        count++;
+        return;
+      }
+    }
+  });
+  return count;
+}
+
+/**
+ * Function: waitForJobSlot
+ * -------------------
+ * If the number of jobs has been capped (via -j), makes main process
+ * hang until fewer than that many jobs are running.
+ */
+static void waitForJobSlot() {
+  while (maxJobs > 0 && countRunningJobs() >= maxJobs) {
+    waitForSignals();
+  }
+}
+
+/**
+ * Function: waitForAllJobs
+ * -------------------
+ * Makes main process hang until every job has finished.
+ */
+static void waitForAllJobs() {
+  while (joblist.size() > 0) {
+    waitForSignals();
   }
-  sigprocmask(SIG_UNBLOCK, &additions, NULL);
 }
 
 /**
@@ -127,6 +334,7 @@ static STSHJob& getBgJobFromInput(const command& cmd, const string& usage, const
 static void fg(const command& cmd) {
   const string& usage = kFgUsage;
   STSHJob& job = getBgJobFromInput(cmd, usage, "fg");
+  giveTerminalTo(job.getGroupID(), job.getNum());
   for (const auto& p : job.getProcesses()) {
     if (p.getState() == kStopped) {
       kill(-job.getGroupID(), SIGCONT);
@@ -191,205 +399,524 @@ static void cont(const command& cmd) {
 }
 
 /**
- * Function: handleBuiltin
- * -----------------------
- * Examines the leading command of the provided pipeline to see if
- * it's a shell builtin, and if so, handles and executes it.  handleBuiltin
- * returns true if the command is a builtin, and false otherwise.
+ * Function: hashCommands
+ * -------------------
+ * Builtin handler for hash.  With no arguments, lists every remembered
+ * command.  -r forgets all of them, and any other arguments are looked up
+ * along the PATH and remembered.
  */
-static const string kSupportedBuiltins[] = {"quit", "exit", "fg", "bg", "slay", "halt", "cont", "jobs"};
-static const size_t kNumSupportedBuiltins = sizeof(kSupportedBuiltins)/sizeof(kSupportedBuiltins[0]);
-static bool handleBuiltin(const pipeline& pipeline) {
-  const command& cmd = pipeline.commands[0];
-  const string& command = cmd.command;
-  auto iter = find(kSupportedBuiltins, kSupportedBuiltins + kNumSupportedBuiltins, command);
-  if (iter == kSupportedBuiltins + kNumSupportedBuiltins) return false;
-  size_t index = iter - kSupportedBuiltins;
-
-  switch (index) {
-  case 0:
-  case 1: exit(0);
-  case 2: fg(cmd); break;
-  case 3: bg(cmd); break;
-  case 4: slay(cmd); break;
-  case 5: halt(cmd); break;
-  case 6: cont(cmd); break;
-  case 7: cout << joblist; break;
-  default: throw STSHException("Internal Error: Builtin command not supported."); // or not implemented yet
+static void hashCommands(const command& cmd) {
+  size_t argc = getArgvLen(cmd);
+  if (argc == 0) {
+    if (commandHash.empty()) cout << "hash: hash table empty" << endl;
+    else cout << commandHash;
+    return;
+  }
+  size_t i = 0;
+  if (strcmp(cmd.tokens[0], "-r") == 0) {
+    commandHash.clear();
+    i++;
   }
+  for (; i < argc; i++) {
+    if (cmd.tokens[i][0] == '-') throw STSHException(kHashUsage);
+    if (commandHash.resolve(cmd.tokens[i]).empty()) {
+      throw STSHException("hash: " + string(cmd.tokens[i]) + ": not found");
+    }
+  }
+}
 
-  return true;
+/**
+ * Function: pipesize
+ * -------------------
+ * Builtin handler for pipesize.  With no arguments, prints the capacity
+ * every new pipe is given.  Otherwise sets it, where 0 restores the
+ * system default.
+ */
+static void pipesize(const command& cmd) {
+  size_t argc = getArgvLen(cmd);
+  if (argc == 0) {
+    size_t bytes = getPipeSize();
+    if (bytes == 0) cout << "pipesize: system default" << endl;
+    else cout << "pipesize: " << bytes << " bytes" << endl;
+    return;
+  }
+  if (argc > 1) throw STSHException(kPipeSizeUsage);
+  setPipeSize(parseNumber(cmd.tokens[0], kPipeSizeUsage));
 }
 
 /**
- * Function: reapChild
+ * Function: stshtrace
  * -------------------
- * Signal handler for SIGCHLD.
+ * Builtin handler for stshtrace.  With no arguments, dumps every job control
+ * event still in the trace.  on starts tracing (optionally retaining more than
+ * the default number of events), off stops it, clear discards every event, and
+ * -s summarizes spawn-to-exec and wake-to-reap latencies.
  */
-static void reapChild(int sig) {
-  pid_t pid;
-  while (true) {
-    int status;
-    pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED);
-    if (pid <= 0) break;
-    STSHProcessState state = kTerminated;
-    if (WIFEXITED(status) || WIFSIGNALED(status)) {
-      state = kTerminated;
-    } else if (WIFSTOPPED(status)) {
-      state = kStopped;
-    } else if (WIFCONTINUED(status)) {
-      state = kRunning;
-    }
-    updateJobList(pid, state);
+static void stshtrace(const command& cmd) {
+  size_t argc = getArgvLen(cmd);
+  if (argc == 0) {
+    cout << trace;
+    return;
   }
-  // give stdin control back to shell
-  if (!joblist.hasForegroundJob()) {
-    tcsetpgrp(STDIN_FILENO, getpgrp());
+  string option = cmd.tokens[0];
+  if (option == "on" && argc <= 2) {
+    size_t numEvents = STSHTrace::kDefaultCapacity;
+    if (argc == 2) numEvents = parseNumber(cmd.tokens[1], kTraceUsage);
+    if (numEvents == 0) throw STSHException(kTraceUsage);
+    trace.enable(numEvents);
+  } else if (argc > 1) {
+    throw STSHException(kTraceUsage);
+  } else if (option == "off") {
+    trace.disable();
+  } else if (option == "clear") {
+    trace.clear();
+  } else if (option == "-s") {
+    trace.printSummary(cout);
+  } else {
+    throw STSHException(kTraceUsage);
   }
 }
 
+static void quit(const command& cmd) { exit(0); }
 /**
- * Function: passSigToFgJob
+ * Function: jobs
  * -------------------
- * Passes the signal to the foreground job.
+ * Builtin handler for jobs.  jobs -l also lists the resource usage
+ * of every process.
  */
-static void passSigToFgJob(int sig) {
-  if (joblist.hasForegroundJob()) {
-    kill(-joblist.getForegroundJob().getGroupID(), sig);
+static void jobs(const command& cmd) {
+  size_t argc = getArgvLen(cmd);
+  if (argc == 0) cout << joblist;
+  else if (argc == 1 && strcmp(cmd.tokens[0], "-l") == 0) joblist.printUsage(cout);
+  else throw STSHException(kJobsUsage);
+}
+
+/**
+ * Type: builtin
+ * -------------
+ * Pairs the name of a builtin with the function that handles it.
+ */
+struct builtin {
+  const char *name;
+  void (*handler)(const command& cmd);
+};
+
+static const builtin kSupportedBuiltins[] = {
+  {"quit", quit}, {"exit", quit}, {"fg", fg}, {"bg", bg}, {"slay", slay},
+  {"halt", halt}, {"cont", cont}, {"jobs", jobs}, {"hash", hashCommands},
+  {"pipesize", pipesize}, {"stshtrace", stshtrace}
+};
+static const size_t kNumSupportedBuiltins = sizeof(kSupportedBuiltins)/sizeof(kSupportedBuiltins[0]);
+
+/**
+ * Class: BuiltinTable
+ * -------------------
+ * A perfect hash table of the supported builtins.  A name's slot is computed
+ * from its first character, its last character, and its length, and the multiplier
+ * applied to the first character is chosen at startup as the smallest one that sends
+ * every builtin to its own slot.  Recognizing a builtin (or rejecting a command that
+ * isn't one) costs one hash and at most one strcmp.
+ */
+static const size_t kBuiltinTableSize = 32;
+static const size_t kMaxBuiltinMultiplier = 1024;
+class BuiltinTable {
+public:
+  BuiltinTable() {
+    for (multiplier = 1; multiplier <= kMaxBuiltinMultiplier; multiplier++) {
+      if (populate()) return;
+    }
+    assert(false); // grow kBuiltinTableSize if this ever happens
+  }
+
+  const builtin *lookup(const char *name) const {
+    const builtin *candidate = slots[slotFor(name)];
+    if (candidate == NULL || strcmp(candidate->name, name) != 0) return NULL;
+    return candidate;
   }
+
+private:
+  size_t multiplier;
+  const builtin *slots[kBuiltinTableSize];
+
+  size_t slotFor(const char *name) const {
+    size_t length = strlen(name);
+    if (length == 0) return 0;
+    size_t first = (unsigned char) name[0];
+    size_t last = (unsigned char) name[length - 1];
+    return (first * multiplier + last + length) % kBuiltinTableSize;
+  }
+
+  bool populate() {
+    fill(slots, slots + kBuiltinTableSize, (const builtin *) NULL);
+    for (const builtin& b: kSupportedBuiltins) {
+      size_t slot = slotFor(b.name);
+      if (slots[slot] != NULL) return false;
+      slots[slot] = &b;
+    }
+    return true;
+  }
+};
+
+static const BuiltinTable kBuiltinTable;
+
+/**
+ * Function: handleBuiltin
+ * -----------------------
+ * Examines the leading command of the provided pipeline to see if
+ * it's a shell builtin, and if so, handles and executes it.  handleBuiltin
+ * returns true if the command is a builtin, and false otherwise.
+ */
+static bool handleBuiltin(const pipeline& pipeline) {
+  const command& cmd = pipeline.commands[0];
+  const builtin *b = kBuiltinTable.lookup(cmd.command);
+  if (b == NULL) return false;
+  b->handler(cmd);
+  return true;
 }
 
 /**
  * Function: installSignalHandlers
  * -------------------------------
- * Installs user-defined signals handlers for four signals
- * (once you've implemented signal handlers for SIGCHLD,
- * SIGINT, and SIGTSTP, you'll add more installSignalHandler calls) and
- * ignores two others.
+ * Ignores SIGTTIN and SIGTTOU, and routes SIGCHLD, SIGINT, SIGTSTP, and
+ * SIGQUIT (and SIGTERM, in batch mode) through a signalfd instead of through
+ * signal handlers.  Those are then handled synchronously by handlePendingSignals,
+ * whether the shell is waiting on the user or on a foreground job.
  */
 static void installSignalHandlers() {
-  installSignalHandler(SIGQUIT, [](int sig) { exit(0); });
   installSignalHandler(SIGTTIN, SIG_IGN);
   installSignalHandler(SIGTTOU, SIG_IGN);
-  installSignalHandler(SIGCHLD, reapChild);
-  installSignalHandler(SIGINT, passSigToFgJob);
-  installSignalHandler(SIGTSTP, passSigToFgJob);
+  if (batch) signalsfd = createSignalDescriptor({SIGCHLD, SIGINT, SIGTSTP, SIGQUIT, SIGTERM});
+  else signalsfd = createSignalDescriptor({SIGCHLD, SIGINT, SIGTSTP, SIGQUIT});
 }
 
 /**
- * Function: createProcess
+ * Function: launchJob
  * -------------------
- * Creates a new process on behalf of the provided pipeline and
- * command id, add the process to the given job.
- */
-static void createProcess(STSHJob& job, const pipeline& p, int cmdid, int fds[]) {
-  const command& cmd = p.commands[cmdid];
-  int numCommands = p.commands.size();
-  bool first = cmdid == 0;
-  bool last = cmdid == (numCommands - 1);
-  pid_t pid = fork();
-  if (pid == 0) {
-    setpgid(0, job.getGroupID());
-    // close unrelated fds
-    for (int i = 0; i < (numCommands - 1) * 2; i++) {
-      if (!(i >= (cmdid-1)*2 && i < (cmdid+1)*2)) close(fds[i]);
-    }
-    // close related fds
-    if (!first) {
-      close(fds[cmdid * 2 - 1]); // don't write to previous process
-      dup2(fds[(cmdid-1) * 2], 0); // redirect stdin to the previous fd_read
-      close(fds[(cmdid-1) * 2]);
-    } else if (!p.input.empty()) {
-      int infd = open(p.input.c_str(), O_RDONLY);
-      if (infd == -1) throw STSHException("Could not open \"" + p.input + "\".");
-      dup2(infd, 0); // redirect stdin to infd
-      close(infd);
-    }
-    if (!last) {
-      close(fds[cmdid * 2]); // don't read from next process
-      dup2(fds[cmdid * 2 + 1], 1); // redirect stdout to the next fd_write
-      close(fds[cmdid * 2 + 1]);
-    } else if (!p.output.empty()) {
-      int outfd = open(p.output.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0644);
-      if (outfd == -1) throw STSHException("Could not open \"" + p.output + "\".");
-      dup2(outfd, 1); // redirect stdout to outfd
-      close(outfd);
-    }
-    char *new_argv[kMaxArguments + 1 + 1];
-    new_argv[0] = (char *) cmd.command;
-    for (size_t i = 1; i <= kMaxArguments + 1; i++) {
-      new_argv[i] = cmd.tokens[i - 1];
-      if (new_argv[i] == NULL) break;
-    }
-    execvp(cmd.command, new_argv);
-    throw STSHException(string(cmd.command) + ": Command not found.");
+ * Adds a new job to the job list on behalf of the provided pipeline (and any
+ * process substitutions within it), launches its processes, and returns the job's
+ * number, or 0 if nothing could be launched, in which case the job is discarded.
+ * Adding the job before its processes are launched is safe because child state
+ * changes are only ever processed synchronously, by handlePendingSignals.  If
+ * supplied, stdinfd and stdoutfd stand in for the pipeline's standard input and output.
+ */
+static size_t launchJob(const pipeline& p, bool timed, int stdinfd = -1, int stdoutfd = -1) {
+  STSHJob& job = joblist.addJob(p.background ? kBackground : kForeground);
+  job.setTimed(timed);
+  try {
+    launchPipeline(p, commandHash, [&job](pid_t pid, const command& cmd, STSHTrace::clock::time_point started,
+                                         STSHTrace::clock::time_point execed) {
+      if (pid == 0) {
+        cerr << cmd.command << ": Command not found." << endl;
+        return;
+      }
+      job.addProcess(STSHProcess(pid, cmd));
+      trace.record(kSpawnEvent, pid, job.getNum(), started);
+      trace.record(kExecEvent, pid, job.getNum(), execed);
+    }, stdinfd, stdoutfd);
+  } catch (const STSHException& e) {
+    // a substitution may have failed after the rest of the job was launched, in which
+    // case whatever's running is left to finish in the background
+    if (!job.getProcesses().empty()) job.setState(kBackground);
+    joblist.synchronize(job);
+    throw;
+  }
+  if (job.getProcesses().empty()) {
+    joblist.synchronize(job); // nothing was launched, so the job is discarded
+    return 0;
+  }
+  return job.getNum();
+}
+
+/**
+ * Function: printJobSummary
+ * -------------------------
+ * Prints the number of the supplied job followed by the pids of its processes.
+ */
+static void printJobSummary(const STSHJob& job) {
+  cout << "[" << job.getNum() << "]";
+  for (const auto& p : job.getProcesses()) {
+    cout << " " << p.getID();
   }
-  // ensure the process group exists before adding the second process
-  if (first) setpgid(pid, pid);
-  job.addProcess(STSHProcess(pid, cmd));
 }
 
 /**
  * Function: createJob
  * -------------------
- * Creates a new job on behalf of the provided pipeline.
- */
-static void createJob(const pipeline& p) {
-  STSHJobState jobState = kForeground;
-  if (p.background) jobState = kBackground;
-  STSHJob& job = joblist.addJob(jobState);
-  const vector<command>& commands = p.commands;
-  size_t numCommands = commands.size();
-  // create numCommands - 1 pipes for inter-process communication
-  int fds[(numCommands - 1) * 2];
-  for (size_t i = 0; i < numCommands - 1; i++) {
-    pipe(fds + i * 2);
-  }
-  // create processes
-  for (size_t i = 0; i < numCommands; i++) {
-    createProcess(job, p, i, fds);
-  }
-  // close all inter-process pipes since they are not needed by parent
-  for (size_t i = 0; i < (numCommands - 1) * 2; i++) {
-    close(fds[i]);
-  }
-  // handle background job
+ * Creates a new job on behalf of the provided pipeline, whose resource usage
+ * is reported once it completes if timed is true.  A foreground job is waited
+ * on, and a background job is announced (unless we're running in batch mode).
+ */
+static void createJob(const pipeline& p, bool timed) {
+  size_t num = launchJob(p, timed);
+  if (num == 0) return;
+  STSHJob& job = joblist.getJob(num);
+  // handle background job (which is only announced when running interactively)
   if (p.background) {
-    cout << "[" << job.getNum() << "]";
-    for (const auto& p : job.getProcesses()) {
-      cout << " " << p.getID();
-    }
+    if (batch) return;
+    printJobSummary(job);
     cout << endl;
     return;
   }
   // give stdin control to foreground process group
-  tcsetpgrp(STDIN_FILENO, job.getGroupID());
+  giveTerminalTo(job.getGroupID(), job.getNum());
   waitForFgJobToFinish();
 }
 
+/**
+ * Function: closeCoprocessInput
+ * -----------------------------
+ * Closes the shell's end of the pipe feeding the coprocess's standard input,
+ * which lets the coprocess see EOF (once no other process holds it open).
+ */
+static void closeCoprocessInput() {
+  if (coprocInput != -1) close(coprocInput);
+  coprocInput = -1;
+}
+
+/**
+ * Function: closeCoprocessOutput
+ * ------------------------------
+ * Closes the shell's end of the pipe draining the coprocess's standard output,
+ * discarding whatever the coprocess has written that's yet to be read.
+ */
+static void closeCoprocessOutput() {
+  if (coprocOutput != -1) close(coprocOutput);
+  coprocOutput = -1;
+}
+
+/**
+ * Function: coproc
+ * ----------------
+ * Handles the coproc reserved word.  coproc <pipeline> launches the pipeline as a
+ * background job whose standard input and output are pipes back to the shell.
+ * The shell's ends of those pipes are left open across exec, so that later commands
+ * can write to and read from the coprocess through their /dev/fd paths, e.g.
+ *
+ *     stsh> coproc sort
+ *     [1] 4711 write to /dev/fd/5, read from /dev/fd/6
+ *     stsh> echo banana > /dev/fd/5
+ *     stsh> echo apple > /dev/fd/5
+ *     stsh> coproc -c
+ *     stsh> cat /dev/fd/6
+ *
+ * coproc -c closes the pipe to the coprocess's standard input (so it sees EOF), as does
+ * its completion, and coproc on its own describes the current coprocess.  Only one
+ * coprocess may run at a time, and whatever it writes can be read until another one is
+ * started.  Every later command inherits the shell's ends, so a command that's still
+ * running when coproc -c is issued delays the coprocess's EOF until it exits.
+ */
+static void coproc(string line) {
+  trim(line);
+  if (line.empty()) {
+    if (coprocJob == 0 && coprocOutput == -1) {
+      cout << "coproc: no coprocess" << endl;
+      return;
+    }
+    cout << "coproc: ";
+    if (coprocJob == 0) cout << "finished";
+    else cout << "job " << coprocJob;
+    if (coprocInput != -1) cout << ", write to /dev/fd/" << coprocInput;
+    if (coprocOutput != -1) cout << ", read from /dev/fd/" << coprocOutput;
+    cout << endl;
+    return;
+  }
+  if (line == "-c") {
+    closeCoprocessInput();
+    return;
+  }
+  if (line[0] == '-') throw STSHException(kCoprocUsage);
+  if (coprocJob != 0) throw STSHException("coproc: job " + to_string(coprocJob) + " is still running.");
+
+  pipeline p(line);
+  closeCoprocessOutput(); // whatever's left of the previous coprocess's output is discarded
+  p.background = true;
+  int toCoproc[2], fromCoproc[2];
+  createPipe(toCoproc);
+  try {
+    createPipe(fromCoproc);
+  } catch (const STSHException& e) {
+    close(toCoproc[0]);
+    close(toCoproc[1]);
+    throw;
+  }
+  size_t num = 0;
+  try {
+    num = launchJob(p, false, toCoproc[0], fromCoproc[1]);
+  } catch (const STSHException& e) {
+    for (int fd: {toCoproc[0], toCoproc[1], fromCoproc[0], fromCoproc[1]}) close(fd);
+    throw;
+  }
+  close(toCoproc[0]);
+  close(fromCoproc[1]);
+  if (num == 0) {
+    close(toCoproc[1]);
+    close(fromCoproc[0]);
+    return;
+  }
+  // the shell's ends are created close-on-exec like every other pipe, but they're
+  // only useful to later commands if they survive exec
+  fcntl(toCoproc[1], F_SETFD, 0);
+  fcntl(fromCoproc[0], F_SETFD, 0);
+  coprocJob = num;
+  coprocInput = toCoproc[1];
+  coprocOutput = fromCoproc[0];
+  printJobSummary(joblist.getJob(num));
+  cout << " write to /dev/fd/" << coprocInput << ", read from /dev/fd/" << coprocOutput << endl;
+}
+
+/**
+ * Function: jobCompleted
+ * ----------------------
+ * Invoked by the job list as each job completes.  Reports the resource usage of the job
+ * if it was launched via time, and closes the pipe to the coprocess's standard input if
+ * it was the coprocess.
+ */
+static void jobCompleted(const STSHJob& job) {
+  if (job.getNum() == coprocJob) {
+    closeCoprocessInput();
+    coprocJob = 0;
+  }
+  if (!job.isTimed()) return;
+  cerr << formatUsage(job.getUsage(), job.getWallTime()) << endl;
+}
+
+/**
+ * Function: evaluate
+ * ------------------
+ * Parses and executes a single line of input.  A line prefixed with time
+ * has its job's resource usage reported once the job completes (the time
+ * prefix is ignored for builtins), and a line prefixed with coproc is
+ * handed to coproc.  Whenever the number of jobs
+ * is capped, a new job isn't launched until a slot frees up, and in batch mode
+ * every job is run in the background, so up to maxJobs of them run in parallel.
+ */
+static void evaluate(string line) {
+  if (line.empty() || line[0] == '#') return;
+  try {
+    if (line == "coproc" || startsWith(line, "coproc ")) {
+      coproc(line.substr(strlen("coproc")));
+      return;
+    }
+    bool timed = line == "time" || startsWith(line, "time ");
+    if (timed) {
+      line.erase(0, strlen("time"));
+      if (trim(line).empty()) throw STSHException(kTimeUsage);
+    }
+    pipeline p(line);
+    if (p.commands.empty()) return; // nothing but white space
+    bool builtin = handleBuiltin(p);
+    if (builtin) return;
+    if (batch && maxJobs > 0) p.background = true;
+    waitForJobSlot();
+    createJob(p, timed);
+  } catch (const STSHException& e) {
+    cerr << e.what() << endl;
+  }
+}
+
+/**
+ * Function: runBatch
+ * ------------------
+ * Evaluates every line from the supplied stream in order, handling any pending
+ * signals in between, and then waits for every job to finish.  The shell's ends of
+ * the coprocess's pipes are closed first, since nothing's left to write to or read
+ * from them, and a coprocess would otherwise wait on its standard input forever.
+ */
+static void runBatch(istream& commands) {
+  string line;
+  while (getline(commands, line)) {
+    handlePendingSignals();
+    evaluate(trim(line));
+  }
+  closeCoprocessInput();
+  closeCoprocessOutput();
+  waitForAllJobs();
+}
+
+/**
+ * Function: parseOptions
+ * ----------------------
+ * Consumes the batch mode flags (-f <script>, -c <commands>, and -j <max-jobs>, which
+ * is only accepted alongside one of the other two), and hands the readline flags over
+ * to rlinit when running interactively.  The text of the
+ * commands is placed in the supplied string, as is the name of the script, in which case
+ * fromFile is set to true.
+ */
+static void parseOptions(int argc, char *argv[], string& commands, bool& fromFile) {
+  struct option options[] = {
+    {"suppress-prompt", no_argument, NULL, 's'},
+    {"no-history", no_argument, NULL, 'n'},
+    {"file", required_argument, NULL, 'f'},
+    {"command", required_argument, NULL, 'c'},
+    {"jobs", required_argument, NULL, 'j'},
+    {NULL, 0, NULL, 0},
+  };
+
+  vector<char *> rlargv = {argv[0]};
+  while (true) {
+    int ch = getopt_long(argc, argv, "snf:c:j:", options, NULL);
+    if (ch == -1) break;
+    switch (ch) {
+    case 's': rlargv.push_back(const_cast<char *>("--suppress-prompt")); break;
+    case 'n': rlargv.push_back(const_cast<char *>("--no-history")); break;
+    case 'f':
+    case 'c':
+      if (batch) throw STSHException(kStshUsage);
+      batch = true;
+      fromFile = ch == 'f';
+      commands = optarg;
+      break;
+    case 'j': maxJobs = parseNumber(optarg, kStshUsage); break;
+    default: throw STSHException(kStshUsage);
+    }
+  }
+  if (optind < argc) throw STSHException(kStshUsage);
+  if (maxJobs > 0 && !batch) throw STSHException(kStshUsage); // a capped REPL could block with no way out
+  if (batch) return;
+  rlargv.push_back(NULL);
+  optind = 0; // so rlinit's getopt_long starts over
+  rlinit(rlargv.size() - 1, rlargv.data()); // configures stsh-readline library so readline works properly
+}
+
 /**
  * Function: main
  * --------------
  * Defines the entry point for a process running stsh.
  * The main function is little more than a read-eval-print
- * loop (i.e. a repl).
+ * loop (i.e. a repl), unless commands are supplied via -f or -c,
+ * in which case they're run in batch mode.
  */
 int main(int argc, char *argv[]) {
-  pid_t stshpid = getpid();
-  installSignalHandlers();
-  rlinit(argc, argv); // configures stsh-readline library so readline works properly
+  string commands;
+  bool fromFile = false;
+  try {
+    parseOptions(argc, argv, commands, fromFile);
+  } catch (const STSHException& e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+  installSignalHandlers(); // only once the options are in, since batch mode also routes SIGTERM
+  joblist.setCompletionHandler(jobCompleted);
+
+  if (batch) {
+    if (!fromFile) {
+      istringstream iss(commands);
+      runBatch(iss);
+      return 0;
+    }
+    ifstream script(commands);
+    if (!script) {
+      cerr << "Could not open \"" << commands << "\"." << endl;
+      return 1;
+    }
+    runBatch(script);
+    return 0;
+  }
+
   while (true) {
     string line;
-    if (!readline(line)) break;
-    if (line.empty()) continue;
-    try {
-      pipeline p(line);
-      bool builtin = handleBuiltin(p);
-      if (!builtin) createJob(p);
-    } catch (const STSHException& e) {
-      cerr << e.what() << endl;
-      if (getpid() != stshpid) exit(0); // if exception is thrown from child process, kill it
-    }
+    if (!readline(line, signalsfd, handlePendingSignals)) break;
+    evaluate(line);
   }
 
   return 0;
@@ -0,0 +1,110 @@
+/**
+ * File: cpu-topology.cc
+ * ---------------------
+ * Presents the implementation of the CPUTopology class and pinThread.
+ */
+
+#include "cpu-topology.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <tuple>
+#include <dirent.h>   // for opendir, readdir, closedir
+#include <sched.h>    // for sched_getaffinity, sched_setaffinity, CPU_SET, etc
+using namespace std;
+
+static const string kCPUDirectory = "/sys/devices/system/cpu/cpu";
+
+/**
+ * Function: readNumber
+ * --------------------
+ * Returns the number stored in the specified sysfs file, or the
+ * supplied default if the file can't be read.
+ */
+static int readNumber(const string &path, int defaultValue) {
+    ifstream infile(path.c_str());
+    int value;
+    if (infile >> value) return value;
+    return defaultValue;
+}
+
+/**
+ * Function: readNode
+ * ------------------
+ * Returns the NUMA node of the specified CPU, which sysfs presents as a link
+ * named node<n> in the CPU's own directory, or 0 if there's no such link.
+ */
+static int readNode(int cpu) {
+    DIR *dir = opendir((kCPUDirectory + to_string(cpu)).c_str());
+    if (dir == NULL) return 0;
+    int node = 0;
+    while (struct dirent *entry = readdir(dir)) {
+        if (strncmp(entry->d_name, "node", 4) == 0 && isdigit(entry->d_name[4])) {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+CPUTopology::CPUTopology() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        string topology = kCPUDirectory + to_string(cpu) + "/topology/";
+        cpus.push_back({cpu, readNode(cpu), readNumber(topology + "physical_package_id", 0),
+                        readNumber(topology + "core_id", cpu)});
+    }
+    sort(cpus.begin(), cpus.end(), [](const CPUInfo &a, const CPUInfo &b) {
+        return make_tuple(a.node, a.package, a.core, a.id) < make_tuple(b.node, b.package, b.core, b.id);
+    });
+}
+
+vector<int> CPUTopology::getNodes() const {
+    vector<int> nodes;
+    for (const CPUInfo &cpu: cpus) {
+        if (nodes.empty() || nodes.back() != cpu.node) nodes.push_back(cpu.node);
+    }
+    return nodes;
+}
+
+vector<int> CPUTopology::getCPUsOnNode(int node) const {
+    vector<int> onNode;
+    for (const CPUInfo &cpu: cpus) {
+        if (cpu.node == node) onNode.push_back(cpu.id);
+    }
+    return onNode;
+}
+
+int CPUTopology::getNodeOf(int cpu) const {
+    for (const CPUInfo &info: cpus) {
+        if (info.id == cpu) return info.node;
+    }
+    return -1;
+}
+
+ostream &operator<<(ostream &os, const CPUTopology &topology) {
+    for (int node: topology.getNodes()) {
+        os << "node " << node << ":";
+        for (const CPUInfo &cpu: topology.getCPUs()) {
+            if (cpu.node == node) os << " cpu" << cpu.id << " (socket " << cpu.package << ", core " << cpu.core << ")";
+        }
+        os << endl;
+    }
+    return os;
+}
+
+bool pinThread(const vector<int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu: cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    return CPU_COUNT(&set) > 0 && sched_setaffinity(0, sizeof(set), &set) == 0;
+}
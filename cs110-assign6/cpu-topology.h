@@ -0,0 +1,76 @@
+/**
+ * File: cpu-topology.h
+ * --------------------
+ * Defines the CPUTopology class, which describes the CPUs the calling process
+ * is allowed to run on: the NUMA node, socket, and core each belongs to, as
+ * reported by Linux under /sys/devices/system.  Also defines pinThread, which
+ * restricts the calling thread to a set of those CPUs.
+ *
+ * Only sysfs and sched_setaffinity are used, so nothing needs libnuma.  On a
+ * machine (or a kernel) without NUMA support, every CPU is reported on node 0.
+ */
+
+#ifndef _cpu_topology_
+#define _cpu_topology_
+
+#include <cstddef>  // for size_t
+#include <ostream>  // for ostream
+#include <vector>   // for vector
+
+struct CPUInfo {
+    int id;
+    int node;
+    int package; // the socket
+    int core;    // unique within the package, and shared by hyperthreads
+};
+
+class CPUTopology {
+public:
+
+/**
+ * Reads the topology of every CPU the calling thread may run on.
+ */
+    CPUTopology();
+
+/**
+ * Returns every CPU in the topology, ordered by node, then
+ * package, then core, then CPU id.
+ */
+    const std::vector<CPUInfo> &getCPUs() const { return cpus; }
+
+/**
+ * Returns the ids of the nodes with at least one CPU in the topology, in
+ * increasing order.
+ */
+    std::vector<int> getNodes() const;
+
+/**
+ * Returns the ids of the topology's CPUs on the specified node.
+ */
+    std::vector<int> getCPUsOnNode(int node) const;
+
+/**
+ * Returns the node the specified CPU belongs to, or -1 if it isn't in
+ * the topology.
+ */
+    int getNodeOf(int cpu) const;
+
+private:
+    std::vector<CPUInfo> cpus;
+};
+
+/**
+ * Lists each node of the topology along with its CPUs, and the
+ * package and core of each of those.
+ */
+std::ostream &operator<<(std::ostream &os, const CPUTopology &topology);
+
+/**
+ * Function: pinThread
+ * -------------------
+ * Restricts the calling thread to the supplied CPUs, returning true on
+ * success and false if none of them may be used (or the list is empty).
+ */
+bool pinThread(const std::vector<int> &cpus);
+
+#endif
@@ -0,0 +1,191 @@
+/**
+ * File: task.h
+ * ------------
+ * Defines the Task class, a move-only replacement for std::function<void(void)>
+ * used to hold the thunks handed to a ThreadPool.  A std::function must be
+ * copyable, only stores the smallest of callables without allocating, and is
+ * typically copied more than once on its way to the thread that runs it.  A Task
+ * is only ever moved, stores any callable of up to kInlineSize bytes within
+ * itself, and stores larger ones in blocks recycled through per-thread freelists
+ * (see Task::allocate), so that creating one doesn't normally allocate at all.
+ */
+
+#ifndef _task_
+#define _task_
+
+#include <cstddef>      // for size_t, max_align_t
+#include <new>          // for placement new
+#include <type_traits>  // for decay, enable_if, integral_constant, is_same, is_nothrow_move_constructible
+#include <utility>      // for forward, move
+
+class Task {
+public:
+    static const size_t kInlineSize = 64;
+
+/**
+ * Constructs an empty Task, which mustn't be invoked.
+ */
+    Task() : ops(NULL) {}
+
+/**
+ * Constructs a Task that invokes (its own copy of) the supplied callable, which
+ * must be invocable with no arguments.  The callable is moved in if it's an rvalue.
+ */
+    template <typename F, typename = typename std::enable_if<
+                  !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F &&f) {
+        typedef typename std::decay<F>::type callable;
+        store<callable>(std::forward<F>(f), std::integral_constant<bool, storedInline<callable>()>());
+    }
+
+    Task(Task &&other) noexcept : ops(other.ops) {
+        if (ops != NULL) ops->move(other.storage, storage);
+        other.ops = NULL;
+    }
+
+    Task &operator=(Task &&rhs) noexcept {
+        if (this != &rhs) {
+            reset();
+            ops = rhs.ops;
+            if (ops != NULL) ops->move(rhs.storage, storage);
+            rhs.ops = NULL;
+        }
+        return *this;
+    }
+
+    ~Task() { reset(); }
+
+/**
+ * Invokes the stored callable.
+ */
+    void operator()() { ops->invoke(storage); }
+
+/**
+ * Returns true if and only if the Task holds a callable.
+ */
+    explicit operator bool() const { return ops != NULL; }
+
+/**
+ * Destroys the stored callable without invoking it, first calling its cancel()
+ * method, if it has one, so that anything waiting for it to run can be told
+ * it never will.  Leaves the Task empty.
+ */
+    void cancel() {
+        if (ops != NULL) ops->cancel(storage);
+        reset();
+    }
+
+/**
+ * Destroys the stored callable (if any), leaving the Task empty.
+ */
+    void reset() {
+        if (ops != NULL) ops->destroy(storage);
+        ops = NULL;
+    }
+
+/**
+ * Returns a block of at least the specified number of bytes, suitably aligned
+ * for any type.  Blocks of up to 4KB are rounded up to a power of two
+ * and come from the calling thread's freelist for that size, which, when
+ * empty, is refilled with a batch of blocks released by other threads, and only
+ * falls back on operator new when there are none.  The block must eventually be
+ * passed to release along with the same size.
+ */
+    static void *allocate(size_t size);
+
+/**
+ * Returns a block obtained from allocate to the calling thread's freelist.
+ * Since Tasks are usually created on one thread and destroyed on another,
+ * a thread whose freelist grows too long passes a batch of its blocks on
+ * to whichever thread next runs out.
+ */
+    static void release(void *block, size_t size);
+
+private:
+    struct operations {
+        void (*invoke)(void *storage);
+        void (*move)(void *from, void *to);
+        void (*destroy)(void *storage);
+        void (*cancel)(void *storage);
+    };
+
+    template <typename F>
+    static auto cancelCallable(F &f, int) -> decltype(f.cancel(), void()) { f.cancel(); }
+
+    template <typename F>
+    static void cancelCallable(F &, long) {}
+
+/**
+ * Callables are stored inline when they fit and can be moved without
+ * throwing (so that Tasks can be), and in a separate block otherwise.
+ */
+    template <typename F>
+    static constexpr bool storedInline() {
+        return sizeof(F) <= kInlineSize && alignof(F) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible<F>::value;
+    }
+
+    template <typename C, typename F>
+    void store(F &&f, std::true_type /* inline */) {
+        new (storage) C(std::forward<F>(f));
+        ops = &inlineOperations<C>::table;
+    }
+
+    template <typename C, typename F>
+    void store(F &&f, std::false_type /* inline */) {
+        void *block = allocate(sizeof(C));
+        try {
+            new (block) C(std::forward<F>(f));
+        } catch (...) {
+            release(block, sizeof(C));
+            throw;
+        }
+        *reinterpret_cast<void **>(storage) = block;
+        ops = &heapOperations<C>::table;
+    }
+
+    template <typename F>
+    struct inlineOperations {
+        static void invoke(void *storage) { (*static_cast<F *>(storage))(); }
+        static void move(void *from, void *to) {
+            new (to) F(std::move(*static_cast<F *>(from)));
+            static_cast<F *>(from)->~F();
+        }
+        static void destroy(void *storage) { static_cast<F *>(storage)->~F(); }
+        static void cancel(void *storage) { cancelCallable(*static_cast<F *>(storage), 0); }
+        static const operations table;
+    };
+
+    template <typename F>
+    struct heapOperations {
+        static void invoke(void *storage) { (**static_cast<F **>(storage))(); }
+        static void move(void *from, void *to) { *static_cast<F **>(to) = *static_cast<F **>(from); }
+        static void destroy(void *storage) {
+            F *f = *static_cast<F **>(storage);
+            f->~F();
+            release(f, sizeof(F));
+        }
+        static void cancel(void *storage) { cancelCallable(**static_cast<F **>(storage), 0); }
+        static const operations table;
+    };
+
+    alignas(std::max_align_t) unsigned char storage[kInlineSize];
+    const operations *ops;
+
+    Task(const Task &original) = delete;
+    Task &operator=(const Task &rhs) = delete;
+};
+
+template <typename F>
+const Task::operations Task::inlineOperations<F>::table = {
+    &Task::inlineOperations<F>::invoke, &Task::inlineOperations<F>::move, &Task::inlineOperations<F>::destroy,
+    &Task::inlineOperations<F>::cancel
+};
+
+template <typename F>
+const Task::operations Task::heapOperations<F>::table = {
+    &Task::heapOperations<F>::invoke, &Task::heapOperations<F>::move, &Task::heapOperations<F>::destroy,
+    &Task::heapOperations<F>::cancel
+};
+
+#endif
@@ -4,170 +4,681 @@
  * Presents the implementation of the ThreadPool class.
  */
 
-#include <numeric>
 #include "thread-pool.h"
-#include "ostreamlock.h"
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <sched.h>       // for sched_getcpu
+#include <sys/syscall.h> // for SYS_gettid
+#include <unistd.h>      // for syscall
 
 using namespace std;
 
-ThreadPool::ThreadPool(size_t numThreads) :
-        wts(numThreads),
-        workerAvailable(numThreads, true),
-        allWorkerFinished(-numThreads), jobAvailable(numThreads),
-        workLoad(numThreads) {
+static const size_t kNumSpins = 64; // how many times an idle worker looks for a thunk before going to sleep
+static const size_t kDefaultWeights[kNumPriorities] = {8, 4, 1};
 
-    dt = thread(&ThreadPool::dispatcher, this);
+/**
+ * Every worker thread notes the pool it belongs to and its ID within
+ * that pool, so that schedule can tell when it's being called by one of
+ * the pool's own workers.
+ */
+static thread_local ThreadPool *currentPool = NULL;
+static thread_local size_t currentWorkerID = 0;
 
-    for (size_t workerID = 0; workerID < numThreads; ++workerID){
-        wts[workerID] = thread(&ThreadPool::worker, this, workerID);
+/**
+ * Function: spreadOrder
+ * ---------------------
+ * Returns the CPUs of the specified node in the order workers should be dealt
+ * out to them: the first CPU of every core, then the second (hyperthread) of
+ * every core, and so on, so that workers only share cores once they must.
+ */
+static vector<int> spreadOrder(const CPUTopology &machine, int node) {
+    map<pair<int, int>, vector<int>> cores;
+    for (const CPUInfo &cpu: machine.getCPUs()) {
+        if (cpu.node == node) cores[make_pair(cpu.package, cpu.core)].push_back(cpu.id);
     }
+    vector<int> order;
+    for (size_t sibling = 0; order.size() < machine.getCPUsOnNode(node).size(); sibling++) {
+        for (const auto &core: cores) {
+            if (sibling < core.second.size()) order.push_back(core.second[sibling]);
+        }
+    }
+    return order;
+}
+
+/**
+ * Function: placementsFor
+ * -----------------------
+ * Decides where each of the specified number of workers should run under
+ * the supplied affinity (see ThreadPoolAffinity).
+ */
+static vector<WorkerPlacement> placementsFor(size_t numThreads, ThreadPoolAffinity affinity) {
+    vector<WorkerPlacement> placements(numThreads, WorkerPlacement{vector<int>(), -1, 0, -1});
+    CPUTopology machine;
+    vector<int> nodes = machine.getNodes();
+    if (affinity == kUnpinned || nodes.empty()) return placements;
+    vector<vector<int>> orders;
+    for (int node: nodes) orders.push_back(spreadOrder(machine, node));
+    for (size_t workerID = 0; workerID < numThreads; workerID++) {
+        size_t n = workerID % nodes.size();
+        placements[workerID].node = nodes[n];
+        if (affinity == kPinnedToNode) {
+            placements[workerID].cpus = orders[n];
+        } else {
+            placements[workerID].cpus.push_back(orders[n][(workerID / nodes.size()) % orders[n].size()]);
+        }
+    }
+    return placements;
+}
+
+/**
+ * Function: placementsOn
+ * ----------------------
+ * Places one worker on each of the supplied CPUs.
+ */
+static vector<WorkerPlacement> placementsOn(const vector<int> &cpus) {
+    CPUTopology machine;
+    vector<WorkerPlacement> placements;
+    for (int cpu: cpus) placements.push_back(WorkerPlacement{vector<int>(1, cpu), machine.getNodeOf(cpu), 0, -1});
+    return placements;
+}
 
-    cout << oslock << "successfully initialized" << endl << osunlock;
+ThreadPool::ThreadPool(size_t numThreads, ThreadPoolAffinity affinity) :
+        ThreadPool(placementsFor(numThreads, affinity), ElasticPolicy{numThreads, numThreads}) {}
 
-    cout << oslock << "detaching threads" << endl << osunlock;
-    dt.detach();
-    for (auto &t: wts) t.detach();
-    cout << oslock << "successfully detached" << endl << osunlock;
+ThreadPool::ThreadPool(const vector<int> &cpus) :
+        ThreadPool(placementsOn(cpus), ElasticPolicy{cpus.size(), cpus.size()}) {}
 
+ThreadPool::ThreadPool(const ElasticPolicy &policy, ThreadPoolAffinity affinity) :
+        ThreadPool(placementsFor(max(max<size_t>(policy.minThreads, 1), policy.maxThreads), affinity), policy) {}
+
+/**
+ * There's one worker for every placement, but only the first minThreads of them
+ * have threads to begin with.  Each thread allocates its own worker record (see run),
+ * and the constructor waits until they all have, so that the records exist by the
+ * time anything is scheduled.  Only then does the supervisor (if any) start.
+ */
+ThreadPool::ThreadPool(const vector<WorkerPlacement> &placements, const ElasticPolicy &policy) :
+        workers(placements.size()), placements(placements), threads(placements.size()), policy(policy),
+        maxInjectionQueueDepth(0), tasksDropped(0), tasksDemoted(0), numInjected(0), numUrgent(0), queued(0),
+        outstanding(0), numSleeping(0), exiting(false), live(placements.size(), false) {
+    for (size_t priority = 0; priority < kNumPriorities; priority++) {
+        lanes[priority] = lane{NULL, NULL, kDefaultWeights[priority], kDefaultWeights[priority]};
+    }
+    this->policy.maxThreads = placements.size();
+    this->policy.minThreads = min(policy.minThreads, placements.size());
+    numLive = numStarting = peakThreads = threadsSpawned = this->policy.minThreads;
+    threadsRetired = 0;
+    fill(live.begin(), live.begin() + this->policy.minThreads, true);
+    for (size_t workerID = 0; workerID < this->policy.minThreads; workerID++) spawn(workerID);
+    unique_lock<mutex> ul(sleepMtx);
+    startedCV.wait(ul, [this] { return numStarting == 0; });
+    if (isElastic()) supervisor = thread([this] { supervise(); });
 }
 
-void ThreadPool::schedule(const function<void(void)>& thunk) {
-    cout << oslock << "scheduling jobs" << endl << osunlock;
-    queueMtx.lock();
-    workQueue.push(thunk);
-    queueMtx.unlock();
-    queueCV.notify_all();
-    cout << oslock << "successfully scheduled" << endl << osunlock;
+/**
+ * Method: spawn
+ * -------------
+ * Starts a thread to run as the specified worker, which the caller must already
+ * have marked as live.  The worker's previous thread (if it ever had one) has
+ * retired, so it's joined first.
+ */
+void ThreadPool::spawn(size_t workerID) {
+    if (threads[workerID].joinable()) threads[workerID].join();
+    threads[workerID] = thread([this, workerID] { run(workerID); });
 }
 
-void ThreadPool::wait() {
-    queueMtx.lock();
-    waitCV.wait(queueMtx, [this](){ return workQueue.empty();});
-    queueMtx.unlock();
-    cout << "wait finished" << endl;
+/**
+ * Function: raiseTo
+ * -----------------
+ * Raises the supplied high-water mark to value if it's lower.  Only
+ * used on marks that a single thread writes, so no CAS loop is needed.
+ */
+static void raiseTo(atomic<size_t> &mark, size_t value) {
+    if (value > mark.load(memory_order_relaxed)) mark.store(value, memory_order_relaxed);
+}
+
+/**
+ * Function: record
+ * ----------------
+ * Counts the supplied duration in the appropriate bucket of a
+ * worker's histogram (see LatencyHistogram for the bucket bounds).
+ */
+static void record(atomic<uint64_t> *histogram, chrono::steady_clock::duration d) {
+    uint64_t ns = max<int64_t>(chrono::duration_cast<chrono::nanoseconds>(d).count(), 1);
+    size_t bucket = min<size_t>(63 - __builtin_clzll(ns), LatencyHistogram::kNumBuckets - 1);
+    histogram[bucket].fetch_add(1, memory_order_relaxed);
+}
+
+void ThreadPool::schedule(Task &&thunk) {
+    entry *e = makeEntry(std::move(thunk), NULL);
+    enqueue(e, e, 1, NULL, kNormalPriority);
+}
+
+void ThreadPool::schedule(Task &&thunk, const ScheduleOptions &options) {
+    entry *e = makeEntry(std::move(thunk), NULL);
+    e->deadline = options.deadline;
+    e->whenLate = options.whenLate;
+    enqueue(e, e, 1, NULL, options.priority);
 }
 
+void ThreadPool::setPriorityWeights(size_t high, size_t normal, size_t low) {
+    size_t weights[kNumPriorities] = {high, normal, low};
+    lock_guard<mutex> lg(injectionMtx);
+    for (size_t priority = 0; priority < kNumPriorities; priority++) {
+        lanes[priority].weight = lanes[priority].credit = max<size_t>(weights[priority], 1);
+    }
+}
 
-void ThreadPool::dispatcher() {
+ThreadPool::entry *ThreadPool::makeEntry(Task &&thunk, TaskGroup *group) {
+    return new (Task::allocate(sizeof(entry))) entry{std::move(thunk), clock::now(), clock::time_point(),
+                                                     kDropWhenLate, group, NULL};
+}
 
-    while(true){
+/**
+ * Method: enqueue
+ * ---------------
+ * Publishes the supplied list of count entries (linked through their next fields),
+ * pushing them onto the calling worker's own deque if it's one of ours (and they're
+ * of normal priority, with no deadline), or else appending them all to the specified
+ * lane of the injection queue at once, and then wakes as many sleeping workers as
+ * might be needed.  Only single entries ever have deadlines.
+ */
+void ThreadPool::enqueue(entry *first, entry *last, size_t count, TaskGroup *group, TaskPriority priority) {
+    if (group != NULL) group->outstanding += count;
+    outstanding += count;
+    queued += count; // before the thunks are published, so none is ever claimed before it's counted
+    if (currentPool == this && priority == kNormalPriority && first->deadline == clock::time_point()) {
+        worker &w = *workers[currentWorkerID].load();
+        for (entry *e = first, *next; e != NULL; e = next) {
+            next = e->next; // read before the push, after which a thief may run and free e
+            w.deque.push(e);
+        }
+        raiseTo(w.maxQueueDepth, w.deque.size());
+    } else {
+        lock_guard<mutex> lg(injectionMtx);
+        inject(first, last, count, priority);
+    }
+    if (count == 1) wakeOne();
+    else wakeAll();
+}
 
-        cout << oslock << "test1 empty: " << endl << osunlock;
-        cout << oslock << isQueueEmtpy() << endl << osunlock;
+/**
+ * Method: inject
+ * --------------
+ * Appends the supplied list of count entries to the specified lane of the
+ * injection queue.  The caller must hold injectionMtx.
+ */
+void ThreadPool::inject(entry *first, entry *last, size_t count, TaskPriority priority) {
+    lane &l = lanes[priority];
+    if (l.tail != NULL) l.tail->next = first;
+    else l.head = first;
+    l.tail = last;
+    if (priority == kHighPriority) numUrgent += count;
+    maxInjectionQueueDepth = max(maxInjectionQueueDepth, numInjected += count);
+}
 
-        queueMtx.lock();
-        if (workQueue.empty())
-        {
-            waitCV.notify_all();
-            queueCV.wait(queueMtx, [this](){
-                dispatchIdle = true;
-                descructorCV.notify_all();
-                return !workQueue.empty() || threadExist; });
+/**
+ * Method: nextInjected
+ * --------------------
+ * Removes and returns the entry at the front of the lane whose turn it is, or
+ * NULL if every lane is empty.  Each lane's turn lasts until it has handed out
+ * as many entries as its weight (or has none left to hand out), and once every
+ * lane with entries left has had its turn, they all start afresh.  The caller
+ * must hold injectionMtx.
+ */
+ThreadPool::entry *ThreadPool::nextInjected() {
+    for (size_t round = 0; round < 2; round++) {
+        for (size_t priority = 0; priority < kNumPriorities; priority++) {
+            lane &l = lanes[priority];
+            if (l.head == NULL || l.credit == 0) continue;
+            l.credit--;
+            entry *e = l.head;
+            l.head = e->next;
+            if (l.head == NULL) l.tail = NULL;
+            e->next = NULL;
+            if (priority == kHighPriority) numUrgent--;
+            numInjected--;
+            return e;
+        }
+        for (lane &l: lanes) l.credit = l.weight;
+    }
+    return NULL;
+}
 
-            if (threadExist) {
-                allWorkerFinished.signal(on_thread_exit);
-                break;
+/**
+ * Method: takeInjected
+ * --------------------
+ * Claims the next entry from the injection queue whose deadline (if any) hasn't
+ * passed, or returns NULL if there's no such entry.  Entries whose deadlines have
+ * passed along the way are demoted to the back of the low-priority lane (without
+ * their deadlines, so that it only happens once), or else dropped, which is done
+ * once the lock is released, since cancelling a thunk may well schedule others.
+ */
+ThreadPool::entry *ThreadPool::takeInjected() {
+    entry *e, *dropped = NULL;
+    {
+        lock_guard<mutex> lg(injectionMtx);
+        clock::time_point now;
+        while ((e = nextInjected()) != NULL && e->deadline != clock::time_point()) {
+            if (now == clock::time_point()) now = clock::now();
+            if (e->deadline >= now) break;
+            if (e->whenLate == kDemoteWhenLate) {
+                e->deadline = clock::time_point();
+                inject(e, e, 1, kLowPriority);
+                tasksDemoted++;
+            } else {
+                e->next = dropped;
+                dropped = e;
+                tasksDropped++;
             }
         }
-        queueMtx.unlock();
-
-        anyWorkerMtx.lock();
-        anyWorkerAvailable.wait(anyWorkerMtx, [this](){
-            return accumulate(workerAvailable.begin(), workerAvailable.end(), 0) > 0; });
-        anyWorkerMtx.unlock();
-
-        cout << oslock << "test2" << endl << osunlock;
-
-        if (!isQueueEmtpy()){
-
-            queueMtx.lock();
-            dispatchIdle = false;
-            queueMtx.unlock();
-
-            for (size_t i = 0; i<wts.size();++i){
-                if ( getWorkerState(i)){
-                    setWorkerState(false, i);
-                    if (!isQueueEmtpy()) {
-                        cout << oslock << "dispatching job " << i << endl << osunlock;
-                        queueMtx.lock();
-                        workLoad[i] = workQueue.front();
-                        workQueue.pop();
-                        queueMtx.unlock();
-                        jobAvailable[i].signal();
-                        cout << oslock << "dispatched job " << i << endl << osunlock;
-                    } else {
-                        workLoad[i] = NULL;
-                    }
+    }
+    while (dropped != NULL) {
+        entry *next = dropped->next;
+        queued--;
+        dropped->thunk.cancel();
+        finish(dropped);
+        dropped = next;
+    }
+    return e;
+}
+
+void ThreadPool::wait() {
+    unique_lock<mutex> ul(waitMtx);
+    waitCV.wait(ul, [this] { return outstanding.load() == 0; });
+}
+
+/**
+ * Method: wait
+ * ------------
+ * Waits for the supplied group's thunks.  One of the pool's own workers runs
+ * whatever thunks it can find in the meantime, so that thunks waiting for the thunks
+ * they've scheduled can't tie up every worker.  Either way, the group's mutex is
+ * acquired once the count reaches zero, since finish holds it from the moment it
+ * brings the count to zero until it's done with the group.
+ */
+void ThreadPool::wait(TaskGroup &group) {
+    if (onWorkerThread()) {
+        while (group.outstanding.load() > 0) {
+            if (!runPendingThunk()) this_thread::yield();
+        }
+    }
+    unique_lock<mutex> ul(group.m);
+    group.done.wait(ul, [&group] { return group.outstanding.load() == 0; });
+}
+
+bool ThreadPool::onWorkerThread() const {
+    return currentPool == this;
+}
+
+/**
+ * Method: runPendingThunk
+ * -----------------------
+ * Finds a thunk for the calling worker (which must be one of ours)
+ * and runs it.  Returns false if there wasn't one to be found.
+ */
+bool ThreadPool::runPendingThunk() {
+    entry *e = findEntry(currentWorkerID);
+    if (e == NULL) return false;
+    execute(*workers[currentWorkerID].load(), e);
+    return true;
+}
+
+/**
+ * Only workers that have ever had a thread are included.  Threads are always
+ * given to the lowest-numbered worker without one, so those come first.
+ */
+ThreadPoolStats ThreadPool::stats() const {
+    ThreadPoolStats stats;
+    {
+        lock_guard<mutex> lg(sleepMtx);
+        for (size_t workerID = 0; workerID < workers.size(); workerID++) {
+            const worker *w = workers[workerID].load();
+            if (w == NULL) continue;
+            stats.workers.push_back({w->tasksRun.load(memory_order_relaxed), w->steals.load(memory_order_relaxed),
+                                     chrono::nanoseconds(w->idleNanos.load(memory_order_relaxed)),
+                                     w->maxQueueDepth.load(memory_order_relaxed), live[workerID]});
+            for (size_t i = 0; i < LatencyHistogram::kNumBuckets; i++) {
+                stats.queueLatency.counts[i] += w->queueLatency[i].load(memory_order_relaxed);
+                stats.runTime.counts[i] += w->runTime[i].load(memory_order_relaxed);
+            }
+        }
+        stats.numThreads = numLive;
+        stats.peakThreads = peakThreads;
+        stats.threadsSpawned = threadsSpawned;
+        stats.threadsRetired = threadsRetired;
+    }
+    lock_guard<mutex> lg(injectionMtx);
+    stats.tasksDropped = tasksDropped;
+    stats.tasksDemoted = tasksDemoted;
+    stats.maxInjectionQueueDepth = maxInjectionQueueDepth;
+    return stats;
+}
+
+/**
+ * Method: run
+ * -----------
+ * The body of each worker thread, which pins itself as its placement dictates.
+ * The first thread to run as a given worker then allocates the worker's record
+ * (including its deque) once it's running there, so that the record's memory is
+ * local to it, and works out the order in which the worker should steal from the
+ * others: those on its own node first.  Then it runs thunks for as long as it can
+ * find them, and sleeps whenever it can't, until the pool is destroyed or the worker
+ * retires.  The time from a worker's first failure to find a thunk until it finds one
+ * (or learns it should exit) is counted as idle.
+ */
+void ThreadPool::run(size_t workerID) {
+    currentPool = this;
+    currentWorkerID = workerID;
+    WorkerPlacement placement = placements[workerID];
+    if (!placement.cpus.empty() && !pinThread(placement.cpus)) {
+        placement.cpus.clear();
+        placement.node = -1;
+    }
+    placement.tid = syscall(SYS_gettid);
+    {
+        lock_guard<mutex> lg(sleepMtx);
+        worker *allocated = workers[workerID].load();
+        if (allocated == NULL) {
+            allocated = new worker;
+            for (int sameNode = 1; sameNode >= 0; sameNode--) {
+                for (size_t i = 1; i < placements.size(); i++) {
+                    size_t victim = (workerID + i) % placements.size();
+                    bool onSameNode = placement.node != -1 && placements[victim].node == placement.node;
+                    if (onSameNode == (sameNode == 1)) allocated->victims.push_back(victim);
                 }
             }
+            workers[workerID].store(allocated);
         }
+        allocated->placement = placement;
+        allocated->lastCPU = sched_getcpu();
+        if (--numStarting == 0) startedCV.notify_all();
+    }
 
+    worker &w = *workers[workerID].load();
+    while (true) {
+        entry *e = findEntry(workerID);
+        if (e == NULL) {
+            clock::time_point idleStart = clock::now();
+            for (size_t spin = 1; spin < kNumSpins && e == NULL; spin++) {
+                this_thread::yield();
+                e = findEntry(workerID);
+            }
+            bool alive = e != NULL || sleep(workerID);
+            w.idleNanos.fetch_add(chrono::duration_cast<chrono::nanoseconds>(clock::now() - idleStart).count(),
+                                  memory_order_relaxed);
+            if (!alive) return;
+            w.lastCPU.store(sched_getcpu(), memory_order_relaxed);
+            if (e == NULL) continue;
+        }
+        execute(w, e);
     }
+}
 
+/**
+ * Method: execute
+ * ---------------
+ * Runs the thunk recorded in the supplied entry on the specified worker,
+ * recording how long it waited to start and how long it took to run.
+ */
+void ThreadPool::execute(worker &w, entry *e) {
+    clock::time_point start = clock::now();
+    record(w.queueLatency, start - e->scheduled);
+    clock::rep outerStart = w.busySince.load(memory_order_relaxed); // nonzero if run from within another thunk
+    w.busySince.store(start.time_since_epoch().count(), memory_order_relaxed);
+    e->thunk();
+    w.busySince.store(outerStart, memory_order_relaxed);
+    record(w.runTime, clock::now() - start);
+    w.tasksRun.fetch_add(1, memory_order_relaxed);
+    finish(e);
 }
 
+/**
+ * Method: findEntry
+ * -----------------
+ * Claims a thunk for the specified worker: the next one on the injection queue if
+ * there are any high-priority thunks there, or else the newest one on its own deque,
+ * or else the next one on the injection queue after all, or else the oldest one on
+ * the first other worker's deque that has one.  Returns NULL if none could be claimed.
+ */
+ThreadPool::entry *ThreadPool::findEntry(size_t workerID) {
+    worker &w = *workers[workerID].load();
+    entry *e = numUrgent.load() > 0 ? takeInjected() : NULL;
+    if (e == NULL) e = w.deque.pop();
+    if (e == NULL && numInjected.load() > 0) e = takeInjected();
+    for (size_t i = 0; e == NULL && i < w.victims.size(); i++) {
+        worker *victim = workers[w.victims[i]].load();
+        if (victim == NULL) continue; // it's never had a thread, so it's never had a thunk
+        e = victim->deque.steal();
+        if (e != NULL) w.steals.fetch_add(1, memory_order_relaxed);
+    }
+    if (e != NULL) queued--;
+    return e;
+}
 
-void ThreadPool::worker(int workerID) {
+/**
+ * Method: sleep
+ * -------------
+ * Puts the calling worker to sleep until there's something for it to do.  Returns
+ * false if it was woken because the pool is being destroyed, or if the worker has
+ * retired, which it does once it has slept for the policy's idleTimeout while the
+ * pool has more than minThreads workers.  (Its deque is empty, or it wouldn't be
+ * sleeping, so nothing is stranded.)  numSleeping is raised before queued is checked,
+ * and schedule raises queued before it checks numSleeping, so either the worker sees
+ * the new thunk or schedule sees the sleeping worker.  A thunk scheduled just as the
+ * last worker retires is left for the supervisor to notice.
+ */
+bool ThreadPool::sleep(size_t workerID) {
+    unique_lock<mutex> ul(sleepMtx);
+    numSleeping++;
+    auto ready = [this] { return queued.load() > 0 || exiting.load(); };
+    bool retiring = false;
+    if (!isElastic()) {
+        sleepCV.wait(ul, ready);
+    } else {
+        while (!retiring && !sleepCV.wait_for(ul, policy.idleTimeout, ready)) {
+            retiring = numLive > policy.minThreads;
+        }
+    }
+    numSleeping--;
+    if (retiring) {
+        live[workerID] = false;
+        numLive--;
+        threadsRetired++;
+    }
+    return !retiring && !exiting.load();
+}
 
-    while(true){
-        jobAvailable[workerID].wait();
+/**
+ * Method: supervise
+ * -----------------
+ * The body of an elastic pool's supervisor thread, which checks, twice every
+ * maxQueueAge, whether thunks are being left to wait (see starved), and if so,
+ * gives the lowest-numbered worker without a thread one.  Only one thread is
+ * added at a time, so that a brief stall doesn't flood the machine with them.
+ */
+void ThreadPool::supervise() {
+    chrono::milliseconds interval = max(policy.maxQueueAge / 2, chrono::milliseconds(1));
+    unique_lock<mutex> ul(sleepMtx);
+    while (!supervisorCV.wait_for(ul, interval, [this] { return exiting.load(); })) {
+        if (numLive == policy.maxThreads || queued.load() == 0 || !starved(clock::now())) continue;
+        size_t workerID = find(live.begin(), live.end(), false) - live.begin();
+        live[workerID] = true;
+        numLive++;
+        numStarting++;
+        threadsSpawned++;
+        peakThreads = max(peakThreads, numLive);
+        ul.unlock();
+        spawn(workerID);
+        ul.lock();
+    }
+}
 
-        if (threadExist) {
-            allWorkerFinished.signal(on_thread_exit);
-            break;
+/**
+ * Method: starved
+ * ---------------
+ * Returns true if the thunk at the front of any lane of the injection queue has
+ * been waiting for longer than maxQueueAge, or if every live worker has been running the same
+ * thunk for that long (so that any thunks on their deques are stuck as well).
+ * The caller must hold sleepMtx.
+ */
+bool ThreadPool::starved(clock::time_point now) {
+    {
+        lock_guard<mutex> lg(injectionMtx);
+        for (const lane &l: lanes) {
+            if (l.head != NULL && now - l.head->scheduled >= policy.maxQueueAge) return true;
         }
-
-        if (workLoad[workerID]) workLoad[workerID]();
-        setWorkerState(true, workerID);
-        anyWorkerAvailable.notify_all();
     }
+    for (size_t workerID = 0; workerID < workers.size(); workerID++) {
+        if (!live[workerID]) continue;
+        worker *w = workers[workerID].load();
+        clock::rep busySince = w == NULL ? 0 : w->busySince.load(memory_order_relaxed);
+        if (busySince == 0 || now - clock::time_point(clock::duration(busySince)) < policy.maxQueueAge) return false;
+    }
+    return true;
 }
 
-void ThreadPool::setWorkerState(bool state, int workerID) {
-    workerMtx.lock();
-    workerAvailable[workerID] = state;
-    workerMtx.unlock();
+void ThreadPool::wakeOne() {
+    if (numSleeping.load() == 0) return;
+    lock_guard<mutex> lg(sleepMtx);
+    sleepCV.notify_one();
 }
 
-bool ThreadPool::getWorkerState(int workerID) {
-    bool state;
-    workerMtx.lock();
-    state = workerAvailable[workerID];
-    workerMtx.unlock();
-    return state;
+void ThreadPool::wakeAll() {
+    if (numSleeping.load() == 0) return;
+    lock_guard<mutex> lg(sleepMtx);
+    sleepCV.notify_all();
 }
 
-bool ThreadPool::isQueueEmtpy() {
-    bool queueEmpty;
-    queueMtx.lock();
-    queueEmpty = workQueue.empty();
-    queueMtx.unlock();
-    return queueEmpty;
+/**
+ * Method: finish
+ * --------------
+ * Frees the supplied entry, and counts its thunk as finished.  A group's count
+ * is only ever brought to zero while holding the group's mutex, because a waiter
+ * may destroy the group as soon as it sees that count hit zero.
+ */
+void ThreadPool::finish(entry *e) {
+    TaskGroup *group = e->group;
+    e->~entry();
+    Task::release(e, sizeof(entry));
+    if (group != NULL) {
+        size_t count = group->outstanding.load();
+        while (count > 1 && !group->outstanding.compare_exchange_weak(count, count - 1)) {}
+        if (count <= 1) {
+            lock_guard<mutex> lg(group->m);
+            if (--group->outstanding == 0) group->done.notify_all();
+        }
+    }
+    if (--outstanding == 0) {
+        lock_guard<mutex> lg(waitMtx);
+        waitCV.notify_all();
+    }
 }
 
 ThreadPool::~ThreadPool() {
-
     wait();
+    {
+        lock_guard<mutex> lg(sleepMtx);
+        exiting = true;
+    }
+    sleepCV.notify_all();
+    supervisorCV.notify_all();
+    if (supervisor.joinable()) supervisor.join();
+    for (thread &t: threads) {
+        if (t.joinable()) t.join();
+    }
+    for (atomic<worker *> &w: workers) delete w.load();
+}
 
-    queueMtx.lock();
-    descructorCV.wait(queueMtx, [this](){return dispatchIdle;});
-    queueMtx.unlock();
+/**
+ * Only workers with a thread running as them right now are included.
+ */
+ThreadPoolTopology ThreadPool::topology() const {
+    ThreadPoolTopology topology;
+    topology.machine = machine;
+    lock_guard<mutex> lg(sleepMtx);
+    for (size_t workerID = 0; workerID < workers.size(); workerID++) {
+        const worker *w = workers[workerID].load();
+        if (!live[workerID] || w == NULL) continue;
+        topology.workers.push_back(w->placement);
+        topology.workers.back().lastCPU = w->lastCPU.load(memory_order_relaxed);
+    }
+    return topology;
+}
 
-    anyWorkerMtx.lock();
-    anyWorkerAvailable.wait(anyWorkerMtx,
-                            [this](){ return accumulate(workerAvailable.cbegin(), workerAvailable.cend(), 0) == wts.size();});
-    anyWorkerMtx.unlock();
+ostream &operator<<(ostream &os, const ThreadPoolTopology &topology) {
+    os << topology.machine;
+    os << setw(6) << "worker" << setw(9) << "tid" << setw(6) << "node" << setw(10) << "last cpu" << "  cpus" << endl;
+    for (size_t i = 0; i < topology.workers.size(); i++) {
+        const WorkerPlacement &w = topology.workers[i];
+        os << setw(6) << i << setw(9) << w.tid << setw(6);
+        if (w.node == -1) os << "any";
+        else os << w.node;
+        os << setw(10) << w.lastCPU << "  ";
+        if (w.cpus.empty()) os << "any";
+        for (size_t j = 0; j < w.cpus.size(); j++) os << (j == 0 ? "" : ",") << w.cpus[j];
+        os << endl;
+    }
+    return os;
+}
 
-    threadExist = true;
+uint64_t LatencyHistogram::total() const {
+    uint64_t total = 0;
+    for (uint64_t count: counts) total += count;
+    return total;
+}
 
-    for (auto &t: jobAvailable){
-        t.signal();
+chrono::nanoseconds LatencyHistogram::percentile(double p) const {
+    uint64_t rank = (uint64_t) (p / 100 * total()), seen = 0;
+    for (size_t i = 0; i < kNumBuckets; i++) {
+        seen += counts[i];
+        if (seen > rank) return chrono::nanoseconds(2LL << i);
     }
+    return chrono::nanoseconds(2LL << (kNumBuckets - 1));
+}
 
-    workQueue.push(NULL);
-    queueCV.notify_all();
+uint64_t ThreadPoolStats::tasksRun() const {
+    uint64_t total = 0;
+    for (const WorkerStats &w: workers) total += w.tasksRun;
+    return total;
+}
 
-    allWorkerFinished.wait();
-    cout << "destructor finished" << endl;
+/**
+ * Function: printHistogram
+ * ------------------------
+ * Prints the number of durations in the supplied histogram, along with
+ * upper bounds on their median, 90th, 99th, and 99.9th percentiles.
+ */
+static void printHistogram(ostream &os, const char *name, const LatencyHistogram &histogram) {
+    static const struct {
+        const char *name;
+        double p;
+    } kPercentiles[] = {{"p50", 50}, {"p90", 90}, {"p99", 99}, {"p99.9", 99.9}};
+    os << name << ": " << histogram.total() << " samples";
+    if (histogram.total() > 0) {
+        for (const auto &percentile: kPercentiles) {
+            os << ", " << percentile.name << " <= " << fixed << setprecision(1)
+               << chrono::duration<double, micro>(histogram.percentile(percentile.p)).count() << "us";
+        }
+    }
+    os << endl;
+}
 
+ostream &operator<<(ostream &os, const ThreadPoolStats &stats) {
+    os << setw(6) << "worker" << setw(12) << "tasks run" << setw(10) << "steals"
+       << setw(12) << "idle (ms)" << setw(11) << "max depth" << setw(6) << "live" << endl;
+    for (size_t i = 0; i < stats.workers.size(); i++) {
+        const WorkerStats &w = stats.workers[i];
+        os << setw(6) << i << setw(12) << w.tasksRun << setw(10) << w.steals << fixed << setprecision(1)
+           << setw(12) << chrono::duration<double, milli>(w.idleTime).count() << setw(11) << w.maxQueueDepth
+           << setw(6) << (w.live ? "yes" : "no") << endl;
+    }
+    os << "threads: " << stats.numThreads << " now, " << stats.peakThreads << " at peak, "
+       << stats.threadsSpawned << " spawned, " << stats.threadsRetired << " retired" << endl;
+    os << "late thunks: " << stats.tasksDropped << " dropped, " << stats.tasksDemoted << " demoted" << endl;
+    os << "max injection queue depth: " << stats.maxInjectionQueueDepth << endl;
+    printHistogram(os, "queue latency", stats.queueLatency);
+    printHistogram(os, "run time", stats.runTime);
+    return os;
 }
@@ -3,40 +3,338 @@
  * -------------------
  * This class defines the ThreadPool class, which accepts a collection
  * of thunks (which are zero-argument functions that don't return a value)
- * and schedules them in a FIFO manner to be executed by a constant number
- * of child threads that exist solely to invoke previously scheduled thunks.
+ * and schedules them to be executed by a constant number of child threads
+ * that exist solely to invoke previously scheduled thunks.
+ *
+ * There's no dispatcher thread.  Each worker owns a work-stealing deque: a
+ * thunk scheduled by one of the pool's own workers is pushed onto that worker's
+ * deque, and a thunk scheduled from anywhere else is appended to a shared
+ * injection queue.  A worker runs the thunks on its own deque newest first,
+ * then those on the injection queue oldest first, and once both are empty,
+ * steals the oldest thunk from some other worker's deque.  Workers with nothing
+ * to do sleep until something is scheduled.
+ *
+ * The injection queue is really three FIFO lanes, one per TaskPriority, which
+ * take turns in proportion to their weights, and a thunk can be given a deadline
+ * by which it should have started, after which it's dropped or demoted instead.
+ *
+ * The pool never prints anything.  Instead, every worker keeps its own counters
+ * and latency histograms (which only it ever writes), and stats() gathers them
+ * all into a ThreadPoolStats snapshot, which can be printed by whoever asked for it.
+ *
+ * Thunks can also be scheduled many at a time (with scheduleBatch), and through
+ * a TaskGroup, which can be waited for without waiting for the rest of the pool.
+ * Functions that return values can be submitted, which returns a Future for the
+ * result (see future.h).
+ *
+ * Workers can be pinned to CPUs or to NUMA nodes.  A pinned worker allocates its
+ * own deque once it's running where it's been pinned (so the deque's memory is
+ * local to it), and steals from workers on its own node before any others.
+ *
+ * A pool can also be elastic, in which case it keeps between a minimum and a
+ * maximum number of workers: a supervisor thread adds workers while thunks are
+ * left waiting (typically because the workers are all blocked on I/O), and workers
+ * that have had nothing to do for a while retire (see ElasticPolicy).
  */
 
 #ifndef _thread_pool_
 #define _thread_pool_
 
+#include <algorithm>   // for min, max
 #include <cstddef>     // for size_t
-#include <functional>  // for the function template used in the schedule signature
+#include <utility>     // for forward
 #include <thread>      // for thread
 #include <vector>      // for vector
-#include <queue>
+#include <atomic>      // for atomic
+#include <chrono>      // for steady_clock
+#include <cstdint>     // for uint64_t
+#include <ostream>     // for ostream
+#include <stdexcept>   // for runtime_error
 #include <mutex>
 #include <condition_variable>
-#include <iostream>
+#include <sys/types.h> // for pid_t
+
+#include "cpu-topology.h"
+#include "task.h"
+#include "work-stealing-deque.h"
+
+/**
+ * Type: LatencyHistogram
+ * ----------------------
+ * Counts durations in power-of-two buckets: counts[0] counts durations under
+ * 2ns, and counts[i] (for i > 0) counts those from 2^i ns up to (but not
+ * including) 2^(i + 1) ns, except that the last bucket counts everything longer.
+ */
+struct LatencyHistogram {
+    static const size_t kNumBuckets = 40;
+    uint64_t counts[kNumBuckets] = {};
+
+/**
+ * Returns the total number of durations counted.
+ */
+    uint64_t total() const;
+
+/**
+ * Returns an upper bound on the specified percentile (e.g. 99 for the
+ * 99th), which is the upper end of the bucket it falls in.
+ */
+    std::chrono::nanoseconds percentile(double p) const;
+};
+
+/**
+ * Type: WorkerStats
+ * -----------------
+ * Describes everything one of a ThreadPool's workers has done: how many thunks it has
+ * run, how many of those it stole from other workers, how long it has spent looking
+ * for (or sleeping while waiting for) something to do, and the most thunks its own
+ * deque has ever held at once.  In an elastic pool, a worker's counts carry over from
+ * one thread to the next, and live is false while there's no thread running as it.
+ */
+struct WorkerStats {
+    uint64_t tasksRun;
+    uint64_t steals;
+    std::chrono::nanoseconds idleTime;
+    size_t maxQueueDepth;
+    bool live;
+};
+
+/**
+ * Type: ThreadPoolStats
+ * ---------------------
+ * A snapshot of a ThreadPool's metrics, as returned by ThreadPool::stats.  queueLatency
+ * measures how long each thunk waited between being scheduled and starting to run,
+ * and runTime measures how long each took to run.  numThreads is the number of workers
+ * running now, and peakThreads the most there have ever been at once; threadsSpawned
+ * counts every worker thread ever started (the first ones included), and threadsRetired
+ * those that have since retired.  tasksDropped and tasksDemoted count the thunks whose
+ * deadlines passed while they were queued.  Since the workers keep running while the
+ * snapshot is taken, its parts may be very slightly out of step.
+ */
+struct ThreadPoolStats {
+    std::vector<WorkerStats> workers;
+    size_t numThreads;
+    size_t peakThreads;
+    uint64_t threadsSpawned;
+    uint64_t threadsRetired;
+    uint64_t tasksDropped;
+    uint64_t tasksDemoted;
+    size_t maxInjectionQueueDepth;
+    LatencyHistogram queueLatency;
+    LatencyHistogram runTime;
+
+/**
+ * Returns the total number of thunks run by all workers.
+ */
+    uint64_t tasksRun() const;
+};
+
+/**
+ * Prints a table of per-worker counters, the number of threads, and
+ * percentiles of the queue latency and run time histograms.
+ */
+std::ostream &operator<<(std::ostream &os, const ThreadPoolStats &stats);
+
+/**
+ * Type: ThreadPoolAffinity
+ * ------------------------
+ * How a ThreadPool places its workers: not at all, each on a single CPU,
+ * or each on all of the CPUs of a single NUMA node.  Pinned workers are
+ * dealt out across the nodes in turn, and across each node's CPUs in turn,
+ * so that a pool smaller than the machine is spread evenly across it.
+ */
+enum ThreadPoolAffinity {
+    kUnpinned, kPinnedToCPU, kPinnedToNode
+};
+
+/**
+ * Type: WorkerPlacement
+ * ---------------------
+ * Where one of a ThreadPool's workers may run (cpus is empty for an unpinned worker,
+ * and node is -1 for one not confined to a single node), along with its kernel thread
+ * id (as shown by top -H, say) and the CPU it was last seen running on.
+ */
+struct WorkerPlacement {
+    std::vector<int> cpus;
+    int node;
+    pid_t tid;
+    int lastCPU;
+};
+
+/**
+ * Type: ThreadPoolTopology
+ * ------------------------
+ * The machine's CPUs, as the pool sees them, and where each of the pool's workers
+ * has been placed among them, as returned by ThreadPool::topology.
+ */
+struct ThreadPoolTopology {
+    CPUTopology machine;
+    std::vector<WorkerPlacement> workers;
+};
+
+/**
+ * Prints the machine's nodes and CPUs, followed by each worker's placement.
+ */
+std::ostream &operator<<(std::ostream &os, const ThreadPoolTopology &topology);
+
+/**
+ * Type: ElasticPolicy
+ * -------------------
+ * The bounds within which an elastic ThreadPool sizes itself.  It starts with minThreads
+ * workers, and adds another (up to maxThreads in all) whenever the oldest thunk in any lane
+ * of the injection queue has waited for longer than maxQueueAge, or every worker has been
+ * busy with the same thunk for that long while other thunks wait.  A worker that has had
+ * nothing to do for idleTimeout retires, unless that would leave fewer than minThreads.
+ */
+struct ElasticPolicy {
+    size_t minThreads;
+    size_t maxThreads;
+    std::chrono::milliseconds maxQueueAge;
+    std::chrono::milliseconds idleTimeout;
+};
+
+/**
+ * Type: TaskPriority
+ * ------------------
+ * The lane of the injection queue a thunk waits in.  While thunks are waiting in
+ * more than one lane, the lanes take turns handing them out, each handing out as
+ * many per turn as its weight (see ThreadPool::setPriorityWeights), so that
+ * high-priority thunks jump ahead of the rest without starving them.
+ */
+enum TaskPriority {
+    kHighPriority, kNormalPriority, kLowPriority
+};
+
+static const size_t kNumPriorities = kLowPriority + 1;
+
+/**
+ * Type: LatePolicy
+ * ----------------
+ * What becomes of a thunk whose deadline passes before a worker gets to it: it's
+ * either dropped without being run (see Task::cancel), or demoted to the back of
+ * the low-priority lane, from which it will eventually be run regardless.
+ */
+enum LatePolicy {
+    kDropWhenLate, kDemoteWhenLate
+};
+
+/**
+ * Type: ScheduleOptions
+ * ---------------------
+ * How to queue a thunk: in which lane, and, optionally, with a deadline by which it
+ * should have started, along with what to do if it hasn't.  A default-constructed
+ * deadline means there isn't one, so ScheduleOptions{kHighPriority} sets only the lane.
+ */
+struct ScheduleOptions {
+    TaskPriority priority;
+    std::chrono::steady_clock::time_point deadline;
+    LatePolicy whenLate;
+};
+
+/**
+ * Class: DeadlineMissedException
+ * ------------------------------
+ * Thrown by the Future for a submitted function that was dropped because its
+ * deadline passed before it could start.
+ */
+class DeadlineMissedException : public std::runtime_error {
+public:
+    DeadlineMissedException() : std::runtime_error("deadline passed before the task could start") {}
+};
+
+class TaskGroup;
 
-#include "../extra/include/semaphore.h"
+template <typename T>
+class Future;
 
 class ThreadPool {
 public:
 
 /**
  * Constructs a ThreadPool configured to spawn up to the specified
- * number of threads.
+ * number of threads, placed as the supplied affinity dictates.
+ */
+    ThreadPool(size_t numThreads, ThreadPoolAffinity affinity = kUnpinned);
+
+/**
+ * Constructs a ThreadPool with one thread pinned to each of the
+ * supplied CPUs (which may be listed more than once).
+ */
+    ThreadPool(const std::vector<int> &cpus);
+
+/**
+ * Constructs an elastic ThreadPool, which keeps as many threads as the supplied
+ * policy dictates, each placed as the supplied affinity dictates (with the first
+ * maxThreads placements dealt out as though that many threads were wanted).
  */
-    ThreadPool(size_t numThreads);
+    ThreadPool(const ElasticPolicy &policy, ThreadPoolAffinity affinity = kUnpinned);
 
 /**
  * Schedules the provided thunk (which is something that can
  * be invoked as a zero-argument function without a return value)
- * to be executed by one of the ThreadPool's threads as soon as
- * all previously scheduled thunks have been handled.
+ * to be executed by one of the ThreadPool's threads.  Thunks scheduled
+ * from outside the pool start in the order they were scheduled, but a thunk
+ * that schedules further thunks will typically see the most recent of them
+ * run first, as with any work-stealing scheduler.
+ *
+ * The thunk is moved (if it's an rvalue) or copied into a Task just once, and
+ * never copied again, so thunks needn't be copyable.  Neither the Task nor the
+ * pool's record of it normally requires an allocation (see task.h).
+ */
+    template <typename F>
+    void schedule(F &&thunk) { schedule(Task(std::forward<F>(thunk))); }
+
+    void schedule(Task &&thunk);
+
+/**
+ * Schedules the provided thunk as above, but queued as the supplied options dictate.
+ * A thunk with a deadline, or with anything but normal priority, always goes through
+ * the injection queue, even when one of the pool's own workers schedules it, and a worker
+ * checks for high-priority thunks there before looking at its own deque.  Deadlines are
+ * checked as thunks are taken off the injection queue, so a thunk that has already
+ * started always runs to completion.
+ */
+    template <typename F>
+    void schedule(F &&thunk, const ScheduleOptions &options) { schedule(Task(std::forward<F>(thunk)), options); }
+
+    void schedule(Task &&thunk, const ScheduleOptions &options);
+
+/**
+ * Schedules the provided function (which takes no arguments, but may return a value)
+ * just as schedule would, and returns a Future for its result (see future.h).  If
+ * the function is dropped because its deadline passed, the Future throws a
+ * DeadlineMissedException.
+ */
+    template <typename F>
+    Future<typename std::result_of<typename std::decay<F>::type &()>::type> submit(F &&f);
+
+    template <typename F>
+    Future<typename std::result_of<typename std::decay<F>::type &()>::type> submit(F &&f,
+                                                                                 const ScheduleOptions &options);
+
+/**
+ * Sets how many thunks each lane of the injection queue hands out per turn while
+ * other lanes have thunks waiting too (see TaskPriority).  The weights start out
+ * as 8, 4, and 1, and any weight of 0 is treated as 1, so that no lane starves.
  */
-    void schedule(const std::function<void(void)> &thunk);
+    void setPriorityWeights(size_t high, size_t normal, size_t low);
+
+/**
+ * Schedules fn(i) for every i in [begin, end), as though schedule had been called
+ * once for each, but locking the pool's shared queue at most once and waking all
+ * sleeping workers at once.  fn is copied into every thunk, so it should be small
+ * (a lambda capturing by reference, say).
+ */
+    template <typename F>
+    void scheduleBatch(size_t begin, size_t end, const F &fn) { scheduleBatch(begin, end, fn, NULL); }
+
+/**
+ * Calls fn(i) for every i in [begin, end), split into chunks of grainSize
+ * indices (or, if grainSize is 0, into about four chunks per worker), and returns
+ * once they've all been made.  May be called from within a thunk, in which case the
+ * calling worker runs other thunks rather than blocking while it waits.
+ */
+    template <typename F>
+    void parallelFor(size_t begin, size_t end, const F &fn, size_t grainSize = 0);
 
 /**
  * Blocks and waits until all previously scheduled thunks
@@ -44,6 +342,17 @@ public:
  */
     void wait();
 
+/**
+ * Returns a snapshot of the pool's metrics.  The workers never stop to
+ * let this happen, so it's safe to call at any time, from any thread.
+ */
+    ThreadPoolStats stats() const;
+
+/**
+ * Returns the machine's topology and each worker's place in it.
+ */
+    ThreadPoolTopology topology() const;
+
 /**
  * Waits for all previously scheduled thunks to execute, and then
  * properly brings down the ThreadPool and any resources tapped
@@ -52,34 +361,106 @@ public:
     ~ThreadPool();
 
 private:
-    std::thread dt;                // dispatcher thread handle
-    std::vector<std::thread> wts;  // worker thread handles
-    void setWorkerState(bool state, int workerID);
-    bool getWorkerState(int workerID);
-    bool isQueueEmtpy();
+    typedef std::chrono::steady_clock clock;
 
-    std::vector<semaphore> jobAvailable;
+/**
+ * The pool's record of a scheduled thunk, which is allocated with Task::allocate
+ * (so that it's recycled through the same freelists as oversized thunks).
+ */
+    struct entry {
+        Task thunk;
+        clock::time_point scheduled;
+        clock::time_point deadline;            // or clock::time_point() if there isn't one
+        LatePolicy whenLate;
+        TaskGroup *group;                      // the group the thunk was scheduled through, if any
+        entry *next;                           // the next entry in a batch, or on the injection queue
+    };
 
-    semaphore allWorkerFinished;
+/**
+ * One lane of the injection queue, whose entries are linked through their next fields.
+ */
+    struct lane {
+        entry *head;                           // oldest first
+        entry *tail;
+        size_t weight;                         // how many entries it hands out per turn
+        size_t credit;                         // how many more it may hand out this turn
+    };
 
-    void dispatcher();
-    void worker(int workerID);
-    std::queue<std::function<void(void)>> workQueue;
-    std::condition_variable_any waitCV, queueCV, descructorCV;
+/**
+ * Everything a worker owns.  The metrics are only ever written by the
+ * worker itself, and are atomic only so that stats can read them at any time.
+ */
+    struct worker {
+        WorkStealingDeque<entry> deque; // pushed and popped only by this worker, stolen from by the others
+        WorkerPlacement placement;
+        std::vector<size_t> victims;    // the other workers, in the order to try stealing from them
+        std::atomic<int> lastCPU{-1};
+        std::atomic<clock::rep> busySince{0}; // when the thunk it's running started, or 0 if it isn't running one
+        std::atomic<uint64_t> tasksRun{0};
+        std::atomic<uint64_t> steals{0};
+        std::atomic<int64_t> idleNanos{0};
+        std::atomic<size_t> maxQueueDepth{0};
+        std::atomic<uint64_t> queueLatency[LatencyHistogram::kNumBuckets] = {};
+        std::atomic<uint64_t> runTime[LatencyHistogram::kNumBuckets] = {};
+    };
+
+    std::vector<std::atomic<worker *>> workers; // one per placement, each allocated by the first thread to run as it
+    std::vector<WorkerPlacement> placements;
+    std::vector<std::thread> threads;           // the latest thread to run as each worker, if any
+    std::thread supervisor;                     // only started if the pool is elastic
+    ElasticPolicy policy;
+    CPUTopology machine;
 
-    std::vector<std::condition_variable_any> workerCV;
-    std::mutex queueMtx;
+    mutable std::mutex injectionMtx;
+    lane lanes[kNumPriorities];                // thunks scheduled from outside the pool, or with options
+    size_t maxInjectionQueueDepth;
+    uint64_t tasksDropped;
+    uint64_t tasksDemoted;
+    std::atomic<size_t> numInjected;           // the size of the injection queue, readable without locking it
+    std::atomic<size_t> numUrgent;             // the size of its high-priority lane, likewise
+    std::atomic<size_t> queued;                // thunks scheduled but not yet claimed by a worker
+    std::atomic<size_t> outstanding;           // thunks scheduled but not yet finished
 
-    std::vector<std::function<void(void)>> workLoad;
-    std::mutex workerMtx;
-    std::vector<bool> workerAvailable;
+    mutable std::mutex sleepMtx;
+    std::condition_variable sleepCV;
+    std::atomic<size_t> numSleeping;
+    std::atomic<bool> exiting;
 
-    std::condition_variable_any anyWorkerAvailable;
-    std::mutex exitMtx, anyWorkerMtx;
-    bool dispatchIdle = true;
-    bool threadExist = false;
+    std::condition_variable startedCV;
+    std::condition_variable supervisorCV;
+    std::vector<bool> live;                    // which workers have a thread running as them, along with
+    size_t numLive;                            // everything else here, guarded by sleepMtx
+    size_t numStarting;                        // threads spawned that haven't yet allocated their worker
+    size_t peakThreads;
+    uint64_t threadsSpawned;
+    uint64_t threadsRetired;
 
+    std::mutex waitMtx;
+    std::condition_variable waitCV;
 
+    template <typename F>
+    void scheduleBatch(size_t begin, size_t end, const F &fn, TaskGroup *group);
+    entry *makeEntry(Task &&thunk, TaskGroup *group);
+    void enqueue(entry *first, entry *last, size_t count, TaskGroup *group, TaskPriority priority);
+    void inject(entry *first, entry *last, size_t count, TaskPriority priority);
+    entry *takeInjected();
+    entry *nextInjected();
+    void wait(TaskGroup &group);
+    bool onWorkerThread() const;
+    bool runPendingThunk();
+
+    ThreadPool(const std::vector<WorkerPlacement> &placements, const ElasticPolicy &policy);
+    bool isElastic() const { return policy.minThreads < policy.maxThreads; }
+    void spawn(size_t workerID);
+    void run(size_t workerID);
+    entry *findEntry(size_t workerID);
+    void execute(worker &w, entry *e);
+    bool sleep(size_t workerID);
+    void supervise();
+    bool starved(clock::time_point now);
+    void wakeOne();
+    void wakeAll();
+    void finish(entry *e);
 
 /**
  * ThreadPools are the type of thing that shouldn't be cloneable, since it's
@@ -93,6 +474,89 @@ private:
     ThreadPool(const ThreadPool &original) = delete;
 
     ThreadPool &operator=(const ThreadPool &rhs) = delete;
+
+    friend class TaskGroup;
+    friend class FutureStateBase;
 };
 
+/**
+ * Class: TaskGroup
+ * ----------------
+ * A set of thunks scheduled on a ThreadPool that can be waited for on their own,
+ * without waiting for anything else the pool has been asked to do.  Waiting from
+ * within one of the pool's thunks doesn't tie up the worker running it: the worker
+ * runs other thunks (typically those of the group itself) until the group is done.
+ */
+class TaskGroup {
+public:
+    TaskGroup(ThreadPool &pool) : pool(pool), outstanding(0) {}
+
+/**
+ * Schedules the provided thunk on the group's pool as part of the group.
+ */
+    template <typename F>
+    void schedule(F &&thunk) {
+        ThreadPool::entry *e = pool.makeEntry(Task(std::forward<F>(thunk)), this);
+        pool.enqueue(e, e, 1, this, kNormalPriority);
+    }
+
+/**
+ * Schedules fn(i) for every i in [begin, end) as part of the group, just
+ * as ThreadPool::scheduleBatch does.
+ */
+    template <typename F>
+    void scheduleBatch(size_t begin, size_t end, const F &fn) { pool.scheduleBatch(begin, end, fn, this); }
+
+/**
+ * Blocks and waits until every thunk scheduled through the group
+ * has been executed in full.
+ */
+    void wait() { pool.wait(*this); }
+
+/**
+ * Waits for the group's thunks, since they may well refer to the group.
+ */
+    ~TaskGroup() { wait(); }
+
+private:
+    ThreadPool &pool;
+    std::atomic<size_t> outstanding; // thunks scheduled through the group but not yet finished
+    std::mutex m;
+    std::condition_variable done;
+
+    TaskGroup(const TaskGroup &original) = delete;
+    TaskGroup &operator=(const TaskGroup &rhs) = delete;
+
+    friend class ThreadPool;
+};
+
+template <typename F>
+void ThreadPool::scheduleBatch(size_t begin, size_t end, const F &fn, TaskGroup *group) {
+    if (begin >= end) return;
+    entry *first = NULL, *last = NULL;
+    for (size_t i = begin; i < end; i++) {
+        entry *e = makeEntry(Task([fn, i] { fn(i); }), group);
+        if (last != NULL) last->next = e;
+        else first = e;
+        last = e;
+    }
+    enqueue(first, last, end - begin, group, kNormalPriority);
+}
+
+template <typename F>
+void ThreadPool::parallelFor(size_t begin, size_t end, const F &fn, size_t grainSize) {
+    if (begin >= end) return;
+    if (grainSize == 0) grainSize = std::max<size_t>((end - begin) / (4 * workers.size()), 1);
+    size_t numChunks = (end - begin + grainSize - 1) / grainSize;
+    TaskGroup group(*this);
+    group.scheduleBatch(0, numChunks, [&fn, begin, end, grainSize](size_t chunk) {
+        size_t chunkBegin = begin + chunk * grainSize;
+        size_t chunkEnd = std::min(chunkBegin + grainSize, end);
+        for (size_t i = chunkBegin; i < chunkEnd; i++) fn(i);
+    });
+    group.wait();
+}
+
+#include "future.h"
+
 #endif
@@ -0,0 +1,196 @@
+/**
+ * File: tpbench.cc
+ * ----------------
+ * Measures how many tasks per second the ThreadPool can get through
+ * under a handful of workloads:
+ *
+ *   empty:   thunks that do nothing, all scheduled from the main thread,
+ *            so the cost of scheduling and dispatch is all that's measured
+ *   tiny:    thunks that each do about a microsecond of arithmetic
+ *   large:   empty thunks with 256 bytes of captures, too many to be
+ *            stored within a Task
+ *   batch:   the empty workload, scheduled with a single call to scheduleBatch
+ *   sleepy:  the tptest workload (every third thunk sleeps 0, 1, or 2ms)
+ *   fan-out: thunks that schedule more thunks, as a recursive divide-and-conquer
+ *            algorithm would, until the requested number have run
+ *
+ * Along with the throughput, the average number of calls to operator new per
+ * task is reported.  Tasks themselves shouldn't allocate once the pool's freelists
+ * are warm, so what's left is mostly the price of having more tasks outstanding at
+ * once than ever before.
+ * After the last workload, the pool's metrics (per-worker counters and
+ * latency histograms covering all the workloads) are printed.
+ *
+ * Usage: ./tpbench [<num-threads>] [<num-tasks>]
+ */
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include "thread-pool.h"
+#include "thread-utils.h"
+using namespace std;
+
+static const size_t kDefaultNumThreads = 12;
+static const size_t kDefaultNumTasks = 200000;
+static const size_t kNumSleepyTasks = 1200;
+static const size_t kFanOut = 4;
+
+static atomic<size_t> completed;
+static atomic<size_t> sink;
+static atomic<size_t> numAllocations;
+
+/**
+ * Replaces the global operator new (and so operator delete with it)
+ * to count how often anything is allocated.
+ */
+void *operator new(size_t size) {
+  numAllocations++;
+  void *allocated = malloc(size == 0 ? 1 : size);
+  if (allocated == NULL) throw bad_alloc();
+  return allocated;
+}
+
+void operator delete(void *allocated) noexcept {
+  free(allocated);
+}
+
+void operator delete(void *allocated, size_t) noexcept {
+  free(allocated);
+}
+
+/**
+ * Function: awaitCompletion
+ * -------------------------
+ * Waits on the pool, and then (in case wait returns as soon as the queue
+ * drains, rather than once every thunk has finished) until the expected
+ * number of thunks have checked in.
+ */
+static void awaitCompletion(ThreadPool& pool, size_t expected) {
+  pool.wait();
+  while (completed.load() < expected) this_thread::yield();
+}
+
+static void emptyWorkload(ThreadPool& pool, size_t numTasks) {
+  for (size_t i = 0; i < numTasks; i++) {
+    pool.schedule([] { completed++; });
+  }
+  awaitCompletion(pool, numTasks);
+}
+
+static void tinyWorkload(ThreadPool& pool, size_t numTasks) {
+  for (size_t i = 0; i < numTasks; i++) {
+    pool.schedule([i] {
+      size_t x = i;
+      for (size_t j = 0; j < 200; j++) x = x * 2862933555777941757ULL + 3037000493ULL;
+      sink += x;
+      completed++;
+    });
+  }
+  awaitCompletion(pool, numTasks);
+}
+
+static void batchWorkload(ThreadPool& pool, size_t numTasks) {
+  pool.scheduleBatch(0, numTasks, [](size_t) { completed++; });
+  awaitCompletion(pool, numTasks);
+}
+
+static void largeWorkload(ThreadPool& pool, size_t numTasks) {
+  array<size_t, 32> payload;
+  payload.fill(1);
+  for (size_t i = 0; i < numTasks; i++) {
+    pool.schedule([payload] {
+      sink += payload[0];
+      completed++;
+    });
+  }
+  awaitCompletion(pool, numTasks);
+}
+
+static void sleepyWorkload(ThreadPool& pool, size_t numTasks) {
+  for (size_t id = 0; id < numTasks; id++) {
+    pool.schedule([id] {
+      sleep_for(id % 3);
+      completed++;
+    });
+  }
+  awaitCompletion(pool, numTasks);
+}
+
+/**
+ * Function: fanOut
+ * ----------------
+ * Runs one thunk's worth of the fan-out workload: it counts itself, and
+ * then schedules up to kFanOut children, so long as fewer than numTasks
+ * thunks have been scheduled overall.
+ */
+static atomic<size_t> scheduled;
+static void fanOut(ThreadPool& pool, size_t numTasks) {
+  completed++;
+  for (size_t i = 0; i < kFanOut; i++) {
+    if (scheduled++ >= numTasks) {
+      scheduled--;
+      return;
+    }
+    pool.schedule([&pool, numTasks] { fanOut(pool, numTasks); });
+  }
+}
+
+static void fanOutWorkload(ThreadPool& pool, size_t numTasks) {
+  scheduled = 1;
+  pool.schedule([&pool, numTasks] { fanOut(pool, numTasks); });
+  while (completed.load() < numTasks) this_thread::yield();
+  pool.wait();
+}
+
+struct workload {
+  string name;
+  function<void(ThreadPool&, size_t)> run;
+  size_t numTasks;
+};
+
+int main(int argc, char *argv[]) {
+  if (argc > 3) {
+    cerr << "Usage: " << argv[0] << " [<num-threads>] [<num-tasks>]" << endl;
+    return 1;
+  }
+  size_t numThreads = argc > 1 ? strtoul(argv[1], NULL, 10) : kDefaultNumThreads;
+  size_t numTasks = argc > 2 ? strtoul(argv[2], NULL, 10) : kDefaultNumTasks;
+  if (numThreads == 0 || numTasks == 0) {
+    cerr << "The number of threads and the number of tasks must both be positive." << endl;
+    return 1;
+  }
+
+  workload workloads[] = {
+    {"empty", emptyWorkload, numTasks},
+    {"tiny", tinyWorkload, numTasks},
+    {"large", largeWorkload, numTasks},
+    {"batch", batchWorkload, numTasks},
+    {"sleepy", sleepyWorkload, kNumSleepyTasks},
+    {"fan-out", fanOutWorkload, numTasks},
+  };
+
+  ThreadPool pool(numThreads);
+  cout << "threads: " << numThreads << endl;
+  for (const workload& w: workloads) {
+    completed = 0;
+    size_t allocationsBefore = numAllocations;
+    auto start = chrono::steady_clock::now();
+    w.run(pool, w.numTasks);
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    double allocationsPerTask = double(numAllocations - allocationsBefore) / w.numTasks;
+    cout << setw(8) << w.name << ": " << setw(8) << w.numTasks << " tasks in "
+         << fixed << setprecision(3) << elapsed.count() << "s, "
+         << setprecision(0) << setw(10) << w.numTasks / elapsed.count() << " tasks/sec, "
+         << setprecision(3) << allocationsPerTask << " allocations/task" << endl;
+  }
+  cout << endl << pool.stats();
+  return 0;
+}
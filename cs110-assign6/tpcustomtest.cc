@@ -10,6 +10,11 @@
 #include <map>
 #include <string>
 #include <functional>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <vector>
 #include <cstring>
 
 #include <sys/types.h> // used to count the number of threads
@@ -59,6 +64,131 @@ static void reuseThreadPoolTest() {
   pool.wait();
 }
 
+static void moveOnlyThunksTest() {
+  ThreadPool pool(4);
+  for (size_t i = 0; i < 8; i++) {
+    unique_ptr<size_t> id(new size_t(i));
+    pool.schedule([id = move(id)] {
+      cout << oslock << "Thunk " << *id << " owns its id." << endl << osunlock;
+    });
+  }
+  pool.wait();
+}
+
+static void taskGroupsTest() {
+  ThreadPool pool(4);
+  TaskGroup slow(pool), fast(pool);
+  auto start = chrono::steady_clock::now();
+  slow.scheduleBatch(0, 2, [](size_t id) { sleep_for(1000); });
+  fast.scheduleBatch(0, 8, [](size_t id) {
+    cout << oslock << "Fast thunk " << id << " is done." << endl << osunlock;
+  });
+  fast.wait();
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  cout << (elapsed.count() < 1 ? "The fast group finished first." :
+           "The fast group waited for the slow one!") << endl;
+  slow.wait();
+}
+
+static void parallelForTest() {
+  ThreadPool pool(4);
+  atomic<size_t> sum(0);
+  pool.parallelFor(0, 1000, [&pool, &sum](size_t i) {
+    pool.parallelFor(0, 1000, [&sum, i](size_t j) { sum += i * j; }, 100);
+  });
+  size_t expected = (999 * 1000 / 2) * size_t(999 * 1000 / 2);
+  cout << "Nested parallelFor sum: " << sum << " (expected " << expected << ")." << endl;
+}
+
+static void futuresTest() {
+  ThreadPool pool(4);
+  vector<Future<size_t>> lengths;
+  for (size_t i = 0; i < 8; i++) {
+    lengths.push_back(pool.submit([i] { return string(i, '*'); })
+                          .then([](const string& stars) { return stars.size(); }));
+  }
+  Future<size_t> total = whenAll(lengths).then([](const vector<size_t>& lengths) {
+    size_t total = 0;
+    for (size_t length: lengths) total += length;
+    return total;
+  });
+  cout << "Total length: " << total.get() << " (expected 28)." << endl;
+
+  Future<int> failed = pool.submit([]() -> int { throw runtime_error("thunk failed"); })
+                           .then([](int value) { return value + 1; });
+  try {
+    failed.get();
+    cout << "The exception was lost!" << endl;
+  } catch (const runtime_error& e) {
+    cout << "Caught \"" << e.what() << "\" from a continuation." << endl;
+  }
+}
+
+static void topologyTest() {
+  ThreadPool pool(4, kPinnedToCPU);
+  pool.parallelFor(0, 64, [](size_t i) { sleep_for(1); });
+  cout << pool.topology();
+}
+
+static void statsTest() {
+  ThreadPool pool(4);
+  for (size_t i = 0; i < 16; i++) {
+    pool.schedule([&pool] {
+      pool.schedule([] { sleep_for(10); });
+      sleep_for(10);
+    });
+  }
+  pool.wait();
+  ThreadPoolStats stats = pool.stats();
+  cout << stats;
+  cout << (stats.tasksRun() == 32 && stats.runTime.total() == 32 ? "All 32 thunks were counted." :
+           "Some thunks were missed!") << endl;
+}
+
+static void elasticTest() {
+  ThreadPool pool(ElasticPolicy{1, 8, chrono::milliseconds(5), chrono::milliseconds(50)});
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (size_t i = 0; i < 8; i++) pool.schedule([] { sleep_for(200); }); // stands in for blocking I/O
+  pool.wait();
+  double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  ThreadPoolStats busy = pool.stats();
+  sleep_for(300);
+  ThreadPoolStats idle = pool.stats();
+  cout << busy << idle;
+  cout << "Grew to " << busy.peakThreads << " threads, and ran 8 blocked thunks in " << (elapsed < 1000 ? "under" : "over")
+       << " a second." << endl;
+  cout << (idle.numThreads == 1 ? "Shrank back to a single thread." : "Failed to shrink back to a single thread!") << endl;
+}
+
+static void prioritiesTest() {
+  ThreadPool pool(1);
+  string order;
+  pool.schedule([] { sleep_for(100); }); // ties up the only worker while the lanes fill up
+  sleep_for(10);
+  pool.setPriorityWeights(8, 4, 1);      // starts the lanes' turns afresh, since the thunk above took one
+  const TaskPriority priorities[] = {kLowPriority, kNormalPriority, kHighPriority};
+  for (size_t i = 0; i < 8; i++) {
+    for (TaskPriority priority: priorities) {
+      pool.schedule([&order, priority] { order += "HNL"[priority]; }, ScheduleOptions{priority});
+    }
+  }
+  chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::milliseconds(10);
+  pool.schedule([&order] { order += 'x'; }, ScheduleOptions{kHighPriority, deadline, kDropWhenLate});
+  pool.schedule([&order] { order += 'd'; }, ScheduleOptions{kHighPriority, deadline, kDemoteWhenLate});
+  Future<int> late = pool.submit([] { return 1; }, ScheduleOptions{kNormalPriority, deadline, kDropWhenLate});
+  pool.wait();
+  cout << "Ran in the order " << order << " (H, N, L for high, normal, low priority, d for demoted)." << endl;
+  cout << (order == "HHHHHHHHNNNNLNNNNLLLLLLLd" ? "Lanes took turns by weight, and late thunks were handled." :
+           "Lanes didn't take turns as they should have!") << endl;
+  try {
+    late.get();
+    cout << "A late submission ran anyway!" << endl;
+  } catch (const DeadlineMissedException& e) {
+    cout << "A late submission threw: " << e.what() << endl;
+  }
+  cout << pool.stats();
+}
+
 struct testEntry {
   string flag;
   function<void(void)> testfn;
@@ -70,6 +200,14 @@ static void buildMap(map<string, function<void(void)>>& testFunctionMap) {
     {"--single-thread-single-wait", singleThreadSingleWaitTest},
     {"--no-threads-double-wait", noThreadsDoubleWaitTest},
     {"--reuse-thread-pool", reuseThreadPoolTest},
+    {"--move-only-thunks", moveOnlyThunksTest},
+    {"--task-groups", taskGroupsTest},
+    {"--parallel-for", parallelForTest},
+    {"--futures", futuresTest},
+    {"--topology", topologyTest},
+    {"--stats", statsTest},
+    {"--elastic", elasticTest},
+    {"--priorities", prioritiesTest},
   };
 
   for (const testEntry& entry: entries) {
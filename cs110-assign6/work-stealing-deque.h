@@ -0,0 +1,140 @@
+/**
+ * File: work-stealing-deque.h
+ * ---------------------------
+ * Defines the WorkStealingDeque class template, the lock-free deque of
+ * Chase and Lev ("Dynamic Circular Work-Stealing Deque", SPAA 2005), with
+ * the memory orderings given by Lê, Pop, Cohen, and Zappa Nardelli ("Correct
+ * and Efficient Work-Stealing for Weak Memory Models", PPoPP 2013).
+ *
+ * Exactly one thread (the deque's owner) may push and pop, both at the
+ * bottom of the deque, while any number of other threads may steal from
+ * the top.  The owner's operations never contend with one another, and only
+ * contend with a thief when the deque is down to its last element.  The deque
+ * stores pointers, and grows (but never shrinks) as needed.
+ */
+
+#ifndef _work_stealing_deque_
+#define _work_stealing_deque_
+
+#include <atomic>   // for atomic, atomic_thread_fence
+#include <cstddef>  // for size_t
+#include <cstdint>  // for int64_t
+#include <memory>   // for unique_ptr
+#include <vector>   // for vector
+
+template <typename T>
+class WorkStealingDeque {
+public:
+
+/**
+ * Constructs an empty deque with room for the specified number of
+ * elements (rounded up to a power of two) before it needs to grow.
+ */
+    WorkStealingDeque(size_t capacity = kDefaultCapacity) : top(0), bottom(0) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        buffers.emplace_back(new buffer(size));
+        current.store(buffers.back().get(), std::memory_order_relaxed);
+    }
+
+/**
+ * Pushes the supplied element onto the bottom of the deque.  May only be
+ * called by the owner.
+ */
+    void push(T *element) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        buffer *buf = current.load(std::memory_order_relaxed);
+        if (b - t > (int64_t) buf->mask) buf = grow(buf, t, b);
+        buf->put(b, element);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+/**
+ * Pops the element most recently pushed onto the bottom of the deque, or
+ * returns NULL if the deque is empty.  May only be called by the owner.
+ */
+    T *pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        buffer *buf = current.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) { // already empty
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return NULL;
+        }
+        T *element = buf->get(b);
+        if (t == b) { // the last element, which a thief may be racing us for
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                element = NULL;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return element;
+    }
+
+/**
+ * Steals the element at the top of the deque (the one that's been there
+ * the longest), or returns NULL if the deque is empty or if another thread
+ * won the race for that element.  May be called by any thread.
+ */
+    T *steal() {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) return NULL;
+        buffer *buf = current.load(std::memory_order_acquire);
+        T *element = buf->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return NULL;
+        return element;
+    }
+
+/**
+ * Returns the number of elements in the deque, which may be stale by
+ * the time it's returned unless called by the owner while nothing's
+ * being stolen.
+ */
+    size_t size() const {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+    static const size_t kDefaultCapacity = 256;
+
+private:
+    struct buffer {
+        size_t mask;
+        std::unique_ptr<std::atomic<T *>[]> slots;
+
+        buffer(size_t capacity) : mask(capacity - 1), slots(new std::atomic<T *>[capacity]) {}
+        T *get(int64_t i) const { return slots[i & mask].load(std::memory_order_relaxed); }
+        void put(int64_t i, T *element) { slots[i & mask].store(element, std::memory_order_relaxed); }
+    };
+
+    std::atomic<int64_t> top;
+    std::atomic<int64_t> bottom;
+    std::atomic<buffer *> current;
+
+/**
+ * Every buffer the deque has ever used.  A thief may still be reading from
+ * a buffer after the owner has moved on to a bigger one, so old buffers are
+ * only freed along with the deque itself.
+ */
+    std::vector<std::unique_ptr<buffer>> buffers;
+
+    buffer *grow(buffer *old, int64_t t, int64_t b) {
+        buffers.emplace_back(new buffer(2 * (old->mask + 1)));
+        buffer *buf = buffers.back().get();
+        for (int64_t i = t; i < b; i++) buf->put(i, old->get(i));
+        current.store(buf, std::memory_order_release);
+        return buf;
+    }
+
+    WorkStealingDeque(const WorkStealingDeque &original) = delete;
+    WorkStealingDeque &operator=(const WorkStealingDeque &rhs) = delete;
+};
+
+#endif
@@ -0,0 +1,416 @@
+/**
+ * File: future.h
+ * --------------
+ * Defines the Future class template, which is returned by ThreadPool::submit
+ * and stands for the value the submitted function will eventually return (or the
+ * exception it will eventually throw).  Futures are cheap to copy, and all copies
+ * share the same result, much like std::shared_future.
+ *
+ * Rather than blocking a thread until a result is ready, a continuation can be
+ * attached with then(), and will be scheduled on the pool once the result is
+ * ready, and whenAll combines many futures into one.  A pipeline of stages can
+ * be expressed as a chain of continuations without any pool thread ever sitting
+ * in a blocking call, waiting for an earlier stage.
+ */
+
+#ifndef _future_
+#define _future_
+
+#include <atomic>              // for atomic
+#include <condition_variable>  // for condition_variable
+#include <exception>           // for exception_ptr, current_exception, make_exception_ptr, rethrow_exception
+#include <memory>              // for shared_ptr, make_shared
+#include <mutex>               // for mutex, lock_guard, unique_lock
+#include <new>                 // for placement new
+#include <thread>              // for this_thread::yield
+#include <type_traits>         // for decay, result_of
+#include <utility>             // for forward, move
+#include <vector>              // for vector
+
+#include "task.h"
+#include "thread-pool.h"
+
+/**
+ * Class: FutureStateBase
+ * ----------------------
+ * Everything shared by all copies of a Future apart from the value itself: whether
+ * the result is ready, the exception in place of a value (if any), and the continuations
+ * to be scheduled once it's ready.  The result is always stored before complete is called,
+ * and only read once done is seen to be true, so it needs no lock of its own.
+ */
+class FutureStateBase {
+ public:
+  FutureStateBase(ThreadPool *pool) : pool(pool), done(false) {}
+
+  bool isDone() const { return done.load(); }
+  bool failed() const { return error != nullptr; }
+  std::exception_ptr getError() const { return error; }
+  void fail(std::exception_ptr e) { error = e; }
+
+/**
+ * Blocks until the result is ready.  One of the pool's own workers runs other
+ * thunks in the meantime instead, since the result may well depend on them.
+ */
+  void wait() {
+    if (pool != NULL && pool->onWorkerThread()) {
+      while (!done.load()) {
+        if (!pool->runPendingThunk()) std::this_thread::yield();
+      }
+      return;
+    }
+    std::unique_lock<std::mutex> ul(m);
+    cv.wait(ul, [this] { return done.load(); });
+  }
+
+/**
+ * Marks the result as ready, wakes any waiting threads, and schedules every
+ * continuation attached so far.
+ */
+  void complete() {
+    std::vector<Task> ready;
+    {
+      std::lock_guard<std::mutex> lg(m);
+      done = true;
+      ready.swap(continuations);
+      cv.notify_all();
+    }
+    for (Task& continuation: ready) launch(std::move(continuation));
+  }
+
+/**
+ * Schedules the supplied continuation once the result is ready,
+ * which may be right away.
+ */
+  void addContinuation(Task&& continuation) {
+    {
+      std::lock_guard<std::mutex> lg(m);
+      if (!done.load()) {
+        continuations.push_back(std::move(continuation));
+        return;
+      }
+    }
+    launch(std::move(continuation));
+  }
+
+  ThreadPool *getPool() const { return pool; }
+
+ private:
+  ThreadPool *pool;          // NULL only for the result of whenAll on no futures at all
+  std::mutex m;
+  std::condition_variable cv;
+  std::atomic<bool> done;
+  std::exception_ptr error;
+  std::vector<Task> continuations;
+
+/**
+ * Schedules a continuation on the pool, or, if there's no pool,
+ * runs it right away on the calling thread.
+ */
+  void launch(Task&& continuation) {
+    if (pool != NULL) pool->schedule(std::move(continuation));
+    else continuation();
+  }
+
+  FutureStateBase(const FutureStateBase& original) = delete;
+  FutureStateBase& operator=(const FutureStateBase& rhs) = delete;
+};
+
+template <typename T>
+class FutureState : public FutureStateBase {
+ public:
+  FutureState(ThreadPool *pool) : FutureStateBase(pool), hasValue(false) {}
+  ~FutureState() { if (hasValue) reinterpret_cast<T *>(storage)->~T(); }
+
+  template <typename U>
+  void emplace(U&& value) {
+    new (storage) T(std::forward<U>(value));
+    hasValue = true;
+  }
+
+  const T& value() const { return *reinterpret_cast<const T *>(storage); }
+
+ private:
+  alignas(T) unsigned char storage[sizeof(T)];
+  bool hasValue;
+};
+
+template <>
+class FutureState<void> : public FutureStateBase {
+ public:
+  FutureState(ThreadPool *pool) : FutureStateBase(pool) {}
+};
+
+/**
+ * Type: futureRunner
+ * ------------------
+ * Calls a function with the supplied arguments, stores whatever it returns
+ * (or throws) in a FutureState, and then completes that state.
+ */
+template <typename R>
+struct futureRunner {
+  template <typename F, typename... Args>
+  static void run(FutureState<R>& state, F& f, Args&&... args) {
+    try {
+      state.emplace(f(std::forward<Args>(args)...));
+    } catch (...) {
+      state.fail(std::current_exception());
+    }
+    state.complete();
+  }
+};
+
+template <>
+struct futureRunner<void> {
+  template <typename F, typename... Args>
+  static void run(FutureState<void>& state, F& f, Args&&... args) {
+    try {
+      f(std::forward<Args>(args)...);
+    } catch (...) {
+      state.fail(std::current_exception());
+    }
+    state.complete();
+  }
+};
+
+/**
+ * Calls a continuation with the value of the future it's attached to
+ * (or with nothing at all, if that's a Future<void>).
+ */
+template <typename R, typename F, typename T>
+void runContinuation(FutureState<R>& result, F& f, const FutureState<T>& antecedent) {
+  futureRunner<R>::run(result, f, antecedent.value());
+}
+
+template <typename R, typename F>
+void runContinuation(FutureState<R>& result, F& f, const FutureState<void>& antecedent) {
+  futureRunner<R>::run(result, f);
+}
+
+template <typename T, typename F>
+struct continuationResult {
+  typedef typename std::result_of<F&(const T&)>::type type;
+};
+
+template <typename F>
+struct continuationResult<void, F> {
+  typedef typename std::result_of<F&()>::type type;
+};
+
+/**
+ * Type: submission
+ * ----------------
+ * The thunk ThreadPool::submit schedules, which runs the submitted function and
+ * stores its result, or, if the pool drops it (see Task::cancel), stores a
+ * DeadlineMissedException instead.
+ */
+template <typename R, typename F>
+struct submission {
+  std::shared_ptr<FutureState<R>> result;
+  F f;
+  void operator()() { futureRunner<R>::run(*result, f); }
+  void cancel() {
+    result->fail(std::make_exception_ptr(DeadlineMissedException()));
+    result->complete();
+  }
+};
+
+template <typename T, typename R, typename F>
+struct continuation {
+  std::shared_ptr<FutureState<T>> antecedent;
+  std::shared_ptr<FutureState<R>> result;
+  F f;
+
+  void operator()() {
+    if (antecedent->failed()) {
+      result->fail(antecedent->getError());
+      result->complete();
+    } else {
+      runContinuation(*result, f, *antecedent);
+    }
+  }
+};
+
+template <typename T>
+struct getResult {
+  typedef const T& type;
+};
+
+template <>
+struct getResult<void> {
+  typedef void type;
+};
+
+template <typename T>
+class Future;
+
+template <typename T>
+struct whenAllState;
+
+template <typename T>
+Future<typename whenAllState<T>::result> whenAll(const std::vector<Future<T>>& futures);
+
+template <typename T>
+class Future {
+ public:
+
+/**
+ * Constructs a Future with no result to wait for, which is only good for
+ * assigning a real one to later.
+ */
+  Future() {}
+
+/**
+ * Returns true if and only if the Future stands for a result (that is, it
+ * came from ThreadPool::submit, then, or whenAll).
+ */
+  bool valid() const { return state != nullptr; }
+
+/**
+ * Returns true if and only if the result is ready, so that get won't block.
+ */
+  bool ready() const { return state->isDone(); }
+
+/**
+ * Blocks until the result is ready.
+ */
+  void wait() const { state->wait(); }
+
+/**
+ * Blocks until the result is ready, and then returns the value (or
+ * rethrows the exception) the function it stands for produced.
+ */
+  typename getResult<T>::type get() const {
+    state->wait();
+    if (state->failed()) std::rethrow_exception(state->getError());
+    return value(*state);
+  }
+
+/**
+ * Schedules f to be called (with this Future's value, unless it's a Future<void>) on
+ * the pool once this Future's result is ready, and returns a Future for what f returns.
+ * If this Future's function threw an exception, f isn't called at all, and the returned
+ * Future throws that same exception.
+ */
+  template <typename F>
+  Future<typename continuationResult<T, typename std::decay<F>::type>::type> then(F&& f) const {
+    typedef typename std::decay<F>::type function;
+    typedef typename continuationResult<T, function>::type R;
+    std::shared_ptr<FutureState<R>> result = std::make_shared<FutureState<R>>(state->getPool());
+    state->addContinuation(continuation<T, R, function>{state, result, std::forward<F>(f)});
+    return Future<R>(result);
+  }
+
+ private:
+  std::shared_ptr<FutureState<T>> state;
+
+  explicit Future(const std::shared_ptr<FutureState<T>>& state) : state(state) {}
+
+  template <typename U>
+  static const U& value(const FutureState<U>& state) { return state.value(); }
+  static void value(const FutureState<void>& state) {}
+
+  template <typename U>
+  friend class Future;
+  friend class ThreadPool;
+  friend struct whenAllState<T>;
+  template <typename U>
+  friend Future<typename whenAllState<U>::result> whenAll(const std::vector<Future<U>>& futures);
+};
+
+/**
+ * Type: whenAllState
+ * ------------------
+ * Shared by the continuations whenAll attaches to each of its futures: each counts
+ * down remaining, and the last to do so gathers up the results, which are either all
+ * of the values, in order, or else the exception thrown by the first future that threw one.
+ */
+template <typename T>
+struct whenAllState {
+  typedef std::vector<T> result;
+
+  std::vector<Future<T>> futures;
+  std::atomic<size_t> remaining;
+  std::shared_ptr<FutureState<result>> all;
+
+  void finish() {
+    for (const Future<T>& future: futures) {
+      if (future.state->failed()) {
+        all->fail(future.state->getError());
+        all->complete();
+        return;
+      }
+    }
+    std::vector<T> values;
+    values.reserve(futures.size());
+    for (const Future<T>& future: futures) values.push_back(future.state->value());
+    futures.clear();
+    all->emplace(std::move(values));
+    all->complete();
+  }
+};
+
+template <>
+struct whenAllState<void> {
+  typedef void result;
+
+  std::vector<Future<void>> futures;
+  std::atomic<size_t> remaining;
+  std::shared_ptr<FutureState<result>> all;
+
+  void finish() {
+    for (const Future<void>& future: futures) {
+      if (future.state->failed()) {
+        all->fail(future.state->getError());
+        break;
+      }
+    }
+    futures.clear();
+    all->complete();
+  }
+};
+
+template <typename T>
+struct whenAllCountdown {
+  std::shared_ptr<whenAllState<T>> state;
+  void operator()() { if (--state->remaining == 0) state->finish(); }
+};
+
+/**
+ * Function: whenAll
+ * -----------------
+ * Returns a Future for the values of all of the supplied futures, in order (or,
+ * for Future<void>s, a Future<void> that's ready once they all are).  If any of
+ * them throws, the returned Future throws the exception the first of those threw.
+ * Nothing blocks while waiting for them: each has a continuation attached that
+ * counts it off, and the last of those continuations assembles the result.
+ */
+template <typename T>
+Future<typename whenAllState<T>::result> whenAll(const std::vector<Future<T>>& futures) {
+  typedef typename whenAllState<T>::result R;
+  ThreadPool *pool = futures.empty() ? NULL : futures[0].state->getPool();
+  std::shared_ptr<whenAllState<T>> state = std::make_shared<whenAllState<T>>();
+  state->futures = futures;
+  state->remaining = futures.size() + 1; // one extra, so nothing finishes until every continuation's attached
+  state->all = std::make_shared<FutureState<R>>(pool);
+  for (const Future<T>& future: futures) future.state->addContinuation(whenAllCountdown<T>{state});
+  whenAllCountdown<T>{state}();
+  return Future<R>(state->all);
+}
+
+template <typename F>
+Future<typename std::result_of<typename std::decay<F>::type&()>::type> ThreadPool::submit(F&& f) {
+  return submit(std::forward<F>(f), ScheduleOptions{kNormalPriority, std::chrono::steady_clock::time_point(),
+                                                    kDropWhenLate});
+}
+
+template <typename F>
+Future<typename std::result_of<typename std::decay<F>::type&()>::type> ThreadPool::submit(F&& f,
+                                                                           const ScheduleOptions& options) {
+  typedef typename std::decay<F>::type function;
+  typedef typename std::result_of<function&()>::type R;
+  std::shared_ptr<FutureState<R>> result = std::make_shared<FutureState<R>>(this);
+  schedule(submission<R, function>{result, std::forward<F>(f)}, options);
+  return Future<R>(result);
+}
+
+#endif
@@ -0,0 +1,124 @@
+/**
+ * File: task.cc
+ * -------------
+ * Presents the implementation of the block freelists behind Task::allocate
+ * and Task::release.
+ */
+
+#include "task.h"
+#include <mutex>
+#include <vector>
+using namespace std;
+
+static const size_t kMinBlockSize = 16;
+static const size_t kNumSizeClasses = 9;      // 16, 32, ..., 4096 bytes
+static const size_t kMaxFreeBlocks = 256;     // per size class, before a thread passes a batch on
+static const size_t kBatchSize = 64;          // the number of blocks passed on at once
+
+/**
+ * A free block is threaded onto its freelist through its own first word.
+ */
+struct freeBlock {
+  freeBlock *next;
+};
+
+struct freeList {
+  freeBlock *head = NULL;
+  size_t length = 0;
+};
+
+/**
+ * Batches of blocks released by one thread and waiting to be
+ * allocated by another, one vector of batches per size class.
+ */
+struct sharedFreeLists {
+  mutex m;
+  vector<freeList> batches[kNumSizeClasses];
+
+  ~sharedFreeLists() {
+    for (vector<freeList>& sizeClass: batches) {
+      for (freeList& batch: sizeClass) {
+        while (batch.head != NULL) {
+          freeBlock *block = batch.head;
+          batch.head = block->next;
+          ::operator delete(block);
+        }
+      }
+    }
+  }
+};
+
+static sharedFreeLists shared;
+
+/**
+ * Each thread's own freelists, which it hands over to the shared lists
+ * when it exits, so that no block is ever stranded.
+ */
+struct localFreeLists {
+  freeList lists[kNumSizeClasses];
+
+  ~localFreeLists() {
+    lock_guard<mutex> lg(shared.m);
+    for (size_t i = 0; i < kNumSizeClasses; i++) {
+      if (lists[i].head != NULL) shared.batches[i].push_back(lists[i]);
+    }
+  }
+};
+
+static thread_local localFreeLists local;
+
+/**
+ * Function: sizeClassOf
+ * ---------------------
+ * Returns the index of the smallest size class that fits blocks of the specified
+ * size, or kNumSizeClasses if they're too big to be kept on a freelist.
+ */
+static size_t sizeClassOf(size_t size) {
+  size_t sizeClass = 0;
+  while (sizeClass < kNumSizeClasses && (kMinBlockSize << sizeClass) < size) sizeClass++;
+  return sizeClass;
+}
+
+void *Task::allocate(size_t size) {
+  size_t sizeClass = sizeClassOf(size);
+  if (sizeClass == kNumSizeClasses) return ::operator new(size);
+  freeList& list = local.lists[sizeClass];
+  if (list.head == NULL) {
+    lock_guard<mutex> lg(shared.m);
+    vector<freeList>& batches = shared.batches[sizeClass];
+    if (!batches.empty()) {
+      list = batches.back();
+      batches.pop_back();
+    }
+  }
+  if (list.head == NULL) return ::operator new(kMinBlockSize << sizeClass);
+  freeBlock *block = list.head;
+  list.head = block->next;
+  list.length--;
+  return block;
+}
+
+void Task::release(void *block, size_t size) {
+  size_t sizeClass = sizeClassOf(size);
+  if (sizeClass == kNumSizeClasses) {
+    ::operator delete(block);
+    return;
+  }
+  freeList& list = local.lists[sizeClass];
+  freeBlock *freed = static_cast<freeBlock *>(block);
+  freed->next = list.head;
+  list.head = freed;
+  list.length++;
+  if (list.length <= kMaxFreeBlocks) return;
+
+  freeList batch;
+  batch.head = list.head;
+  freeBlock *last = list.head;
+  for (size_t i = 1; i < kBatchSize; i++) last = last->next;
+  list.head = last->next;
+  list.length -= kBatchSize;
+  last->next = NULL;
+  batch.length = kBatchSize;
+  lock_guard<mutex> lg(shared.m);
+  shared.batches[sizeClass].push_back(batch);
+}
@@ -2,90 +2,488 @@
  * File: thread-pool.cc
  * --------------------
  * Presents the implementation of the ThreadPool class.
- * Copied my own solution from assignment 6.
+ * Started as my own solution from assignment 6, but without the dispatcher
+ * thread: the workers take thunks straight off the queue themselves.
  */
 
 #include "thread-pool.h"
 #include <algorithm>
+#include <condition_variable>
+#include <iomanip>
+#include <map>
 #include <mutex>
-
+#include <new>
+#include <thread>
+#include <vector>
+#include <sched.h>       // for sched_getcpu
+#include <sys/syscall.h> // for SYS_gettid
+#include <unistd.h>      // for syscall
 using namespace std;
 
-void ThreadPool::dispatcher() {
+/**
+ * Class: ThreadPoolImpl
+ * ---------------------
+ * Everything the ThreadPool keeps from its clients.  Scheduled thunks wait in
+ * FIFO lanes of entries, which are allocated with Task::allocate and linked
+ * through their own next fields, so queueing a thunk allocates nothing.
+ *
+ * There's a slot for every placement, but only the first minThreads slots have
+ * threads to begin with.  An elastic pool's supervisor thread fills the others as
+ * needed, and threads that go idle for long enough retire, emptying their slots.
+ */
+class ThreadPoolImpl {
+ public:
+  ThreadPoolImpl(const vector<WorkerPlacement>& placements, const ElasticPolicy& policy);
+  ~ThreadPoolImpl();
+  void schedule(Task&& thunk, const ScheduleOptions& options);
+  void setPriorityWeights(const size_t weights[]);
+  void wait();
+  bool onWorkerThread() const;
+  bool runPendingThunk();
+  ThreadPoolTopology topology();
+  ThreadPoolStats stats();
+
+ private:
+  typedef chrono::steady_clock clock;
+
+  struct entry {
+    Task thunk;
+    clock::time_point scheduled;
+    clock::time_point deadline; // or clock::time_point() if there isn't one
+    LatePolicy whenLate;
+    entry *next;
+  };
+
+  struct lane {
+    entry *head;   // oldest first
+    entry *tail;
+    size_t weight; // how many entries it hands out per turn
+    size_t credit; // how many more it may hand out this turn
+  };
+
+  mutex m;
+  condition_variable thunkAvailable;
+  condition_variable allDone;
+  condition_variable allStarted;
+  condition_variable supervisorCV;
+  lane lanes[kNumPriorities];
+  size_t numQueued;   // in all of the lanes together
+  size_t outstanding; // scheduled but not yet finished
+  bool exit;
+  vector<thread> workers;             // the latest thread to run in each slot, if any
+  thread supervisor;                  // only started if the pool is elastic
+  ElasticPolicy policy;
+  CPUTopology machine;
+  vector<WorkerPlacement> placements; // the tid and lastCPU fields are guarded by m
+  vector<bool> live;                  // which slots have a thread running in them, guarded by m
+  size_t numStarting;                 // threads spawned that haven't yet pinned themselves
+  ThreadPoolStats counts;
+
+  bool isElastic() const { return policy.minThreads < policy.maxThreads; }
+  void spawn(size_t workerID);
+  void worker(size_t workerID);
+  void supervise();
+  void append(entry *e, TaskPriority priority);
+  entry *next();
+  entry *take(entry*& dropped);
+  void drop(entry *dropped);
+  void run(entry *e);
+};
+
+static const size_t kDefaultWeights[kNumPriorities] = {8, 4, 1};
+
+/**
+ * Every worker thread notes the pool it belongs to, so that a worker waiting
+ * on a Future can run other thunks instead of blocking.
+ */
+static thread_local ThreadPoolImpl *currentPool = NULL;
+
+ThreadPoolImpl::ThreadPoolImpl(const vector<WorkerPlacement>& placements, const ElasticPolicy& policy) :
+  numQueued(0), outstanding(0), exit(false), workers(placements.size()), policy(policy),
+  placements(placements), live(placements.size(), false) {
+  for (size_t priority = 0; priority < kNumPriorities; priority++) {
+    lanes[priority] = lane{NULL, NULL, kDefaultWeights[priority], kDefaultWeights[priority]};
+  }
+  this->policy.maxThreads = placements.size();
+  this->policy.minThreads = min(policy.minThreads, placements.size());
+  numStarting = this->policy.minThreads;
+  counts = ThreadPoolStats{numStarting, numStarting, numStarting, 0, 0, 0};
+  fill(live.begin(), live.begin() + numStarting, true);
+  for (size_t workerID = 0; workerID < this->policy.minThreads; workerID++) spawn(workerID);
+  unique_lock<mutex> ul(m);
+  allStarted.wait(ul, [this] { return numStarting == 0; });
+  if (isElastic()) supervisor = thread([this] { supervise(); });
+}
+
+/**
+ * Method: spawn
+ * -------------
+ * Starts a thread in the specified slot, which the caller must already have
+ * marked as live.  The slot's previous thread (if any) has retired, so it's
+ * joined first.
+ */
+void ThreadPoolImpl::spawn(size_t workerID) {
+  if (workers[workerID].joinable()) workers[workerID].join();
+  workers[workerID] = thread([this, workerID] { worker(workerID); });
+}
+
+void ThreadPoolImpl::schedule(Task&& thunk, const ScheduleOptions& options) {
+  entry *e = new (Task::allocate(sizeof(entry))) entry{move(thunk), clock::now(), options.deadline,
+                                                       options.whenLate, NULL};
+  lock_guard<mutex> lg(m);
+  append(e, options.priority);
+  outstanding++;
+  thunkAvailable.notify_one();
+}
+
+void ThreadPoolImpl::setPriorityWeights(const size_t weights[]) {
+  lock_guard<mutex> lg(m);
+  for (size_t priority = 0; priority < kNumPriorities; priority++) {
+    lanes[priority].weight = lanes[priority].credit = max<size_t>(weights[priority], 1);
+  }
+}
+
+/**
+ * Method: append
+ * --------------
+ * Appends the supplied entry to the back of the specified lane.
+ * The caller must hold m.
+ */
+void ThreadPoolImpl::append(entry *e, TaskPriority priority) {
+  lane& l = lanes[priority];
+  if (l.tail != NULL) l.tail->next = e;
+  else l.head = e;
+  l.tail = e;
+  numQueued++;
+}
+
+/**
+ * Method: next
+ * ------------
+ * Removes and returns the entry at the front of the lane whose turn it is, or
+ * NULL if every lane is empty.  Each lane's turn lasts until it has handed out
+ * as many entries as its weight (or has none left to hand out), and once every
+ * lane with entries left has had its turn, they all start afresh.  The caller
+ * must hold m.
+ */
+ThreadPoolImpl::entry *ThreadPoolImpl::next() {
+  for (size_t round = 0; round < 2; round++) {
+    for (lane& l: lanes) {
+      if (l.head == NULL || l.credit == 0) continue;
+      l.credit--;
+      entry *e = l.head;
+      l.head = e->next;
+      if (l.head == NULL) l.tail = NULL;
+      e->next = NULL;
+      numQueued--;
+      return e;
+    }
+    for (lane& l: lanes) l.credit = l.weight;
+  }
+  return NULL;
+}
+
+/**
+ * Method: take
+ * ------------
+ * Removes and returns the next entry whose deadline (if any) hasn't passed, or
+ * returns NULL if there's no such entry.  Entries whose deadlines have passed
+ * along the way are demoted to the back of the low-priority lane (without their
+ * deadlines, so that it only happens once), or else added to the supplied list of
+ * dropped entries, which the caller must pass to drop once it has released m.
+ */
+ThreadPoolImpl::entry *ThreadPoolImpl::take(entry*& dropped) {
+  entry *e;
+  clock::time_point now;
+  while ((e = next()) != NULL && e->deadline != clock::time_point()) {
+    if (now == clock::time_point()) now = clock::now();
+    if (e->deadline >= now) break;
+    if (e->whenLate == kDemoteWhenLate) {
+      e->deadline = clock::time_point();
+      append(e, kLowPriority);
+      counts.tasksDemoted++;
+    } else {
+      e->next = dropped;
+      dropped = e;
+      counts.tasksDropped++;
+    }
+  }
+  return e;
+}
+
+/**
+ * Method: drop
+ * ------------
+ * Cancels the thunks in the supplied list of entries (see Task::cancel), which
+ * may well schedule others, so m mustn't be held, and counts them as finished.
+ */
+void ThreadPoolImpl::drop(entry *dropped) {
+  while (dropped != NULL) {
+    entry *next = dropped->next;
+    dropped->thunk.cancel();
+    dropped->~entry();
+    Task::release(dropped, sizeof(entry));
+    lock_guard<mutex> lg(m);
+    if (--outstanding == 0) allDone.notify_all();
+    dropped = next;
+  }
+}
+
+/**
+ * Method: worker
+ * --------------
+ * The body of each thread, which first pins itself as its slot's placement
+ * dictates (noting if it couldn't), and then runs thunks until the pool
+ * is destroyed, or, in an elastic pool, until it has waited idleTimeout for
+ * something to do while the pool has more than minThreads threads.  The
+ * constructor waits until its threads have pinned themselves.  Each time a
+ * thread wakes, it notes which CPU it's on.
+ */
+void ThreadPoolImpl::worker(size_t workerID) {
+  currentPool = this;
+  unique_lock<mutex> ul(m);
+  WorkerPlacement& placement = placements[workerID];
+  if (!placement.cpus.empty() && !pinThread(placement.cpus)) {
+    placement.cpus.clear();
+    placement.node = -1;
+  }
+  placement.tid = syscall(SYS_gettid);
+  placement.lastCPU = sched_getcpu();
+  if (--numStarting == 0) allStarted.notify_all();
+  ul.unlock();
+  auto ready = [this] { return numQueued > 0 || exit; };
   while (true) {
-    lock_guard<mutex> lgThunkQueue(mThunkQueue);
-    cvThunkQueue.wait(mThunkQueue, [this]{
-      return !thunkQueue.empty() || exit;
-    });
-    if (exit) return;
-    mThunkQueue.unlock();
-    lock_guard<mutex> lgWorkerStatus(mWorkerStatus);
-    cvWorkerStatus.wait(mWorkerStatus, [this]{
-      return find(wBusy.begin(), wBusy.end(), false) != wBusy.end();
-    });
-    for (size_t workerID = 0; workerID < wBusy.size(); workerID++) {
-      if (!wBusy[workerID]) {
-        wBusy[workerID] = true;
-        mWorkerStatus.unlock();
-        cvWorkerStatus.notify_all();
-        mThunkQueue.lock();
-        wThunks[workerID] = thunkQueue.front();
-        thunkQueue.pop();
-        mThunkQueue.unlock();
-        cvThunkQueue.notify_all();
-        sWorkers[workerID].signal();
-        break;
+    ul.lock();
+    if (!isElastic()) {
+      thunkAvailable.wait(ul, ready);
+    } else {
+      while (!thunkAvailable.wait_for(ul, policy.idleTimeout, ready)) {
+        if (counts.numThreads == policy.minThreads) continue;
+        live[workerID] = false;
+        counts.numThreads--;
+        counts.threadsRetired++;
+        return;
       }
     }
+    placements[workerID].lastCPU = sched_getcpu();
+    if (numQueued == 0) return;
+    entry *dropped = NULL;
+    entry *e = take(dropped);
+    ul.unlock();
+    drop(dropped);
+    if (e != NULL) run(e);
   }
 }
 
-void ThreadPool::worker(size_t workerID) {
-  while (true) {
-    sWorkers[workerID].wait();
-    if (exit) return;
-    wThunks[workerID]();
-    lock_guard<mutex> lgWorkerStatus(mWorkerStatus);
-    wBusy[workerID] = false;
-    mWorkerStatus.unlock();
-    cvWorkerStatus.notify_all();
+/**
+ * Method: supervise
+ * -----------------
+ * The body of an elastic pool's supervisor thread, which checks, twice every
+ * maxQueueAge, whether the thunk at the front of any lane has waited for that
+ * long, and if so, starts a thread in the lowest-numbered empty slot.  Any idle
+ * thread would have taken the thunk right away, so that only happens when all
+ * of them are busy (or there are none).  Only one thread is added at a time,
+ * so that a brief stall doesn't flood the machine with them.
+ */
+void ThreadPoolImpl::supervise() {
+  chrono::milliseconds interval = max(policy.maxQueueAge / 2, chrono::milliseconds(1));
+  unique_lock<mutex> ul(m);
+  while (!supervisorCV.wait_for(ul, interval, [this] { return exit; })) {
+    if (counts.numThreads == policy.maxThreads) continue;
+    bool starved = false;
+    for (const lane& l: lanes) {
+      if (l.head != NULL && clock::now() - l.head->scheduled >= policy.maxQueueAge) starved = true;
+    }
+    if (!starved) continue;
+    size_t workerID = find(live.begin(), live.end(), false) - live.begin();
+    live[workerID] = true;
+    numStarting++;
+    counts.numThreads++;
+    counts.threadsSpawned++;
+    counts.peakThreads = max(counts.peakThreads, counts.numThreads);
+    ul.unlock();
+    spawn(workerID);
+    ul.lock();
   }
 }
 
-ThreadPool::ThreadPool(size_t numThreads) : wts(numThreads), exit(false),
-  wBusy(numThreads, false), wThunks(numThreads), sWorkers(numThreads) {
-  dt = thread([this]() { dispatcher(); });
+/**
+ * Only the slots with a thread running in them right now are included.
+ */
+ThreadPoolTopology ThreadPoolImpl::topology() {
+  lock_guard<mutex> lg(m);
+  ThreadPoolTopology topology = {machine, vector<WorkerPlacement>()};
+  for (size_t workerID = 0; workerID < placements.size(); workerID++) {
+    if (live[workerID]) topology.workers.push_back(placements[workerID]);
+  }
+  return topology;
+}
+
+ThreadPoolStats ThreadPoolImpl::stats() {
+  lock_guard<mutex> lg(m);
+  return counts;
+}
+
+/**
+ * Method: run
+ * -----------
+ * Runs the thunk in the supplied entry (which must already have been taken
+ * off the queue), frees the entry, and counts the thunk as finished.
+ */
+void ThreadPoolImpl::run(entry *e) {
+  e->thunk();
+  e->~entry();
+  Task::release(e, sizeof(entry));
+  lock_guard<mutex> lg(m);
+  if (--outstanding == 0) allDone.notify_all();
+}
+
+bool ThreadPoolImpl::onWorkerThread() const {
+  return currentPool == this;
+}
+
+bool ThreadPoolImpl::runPendingThunk() {
+  unique_lock<mutex> ul(m);
+  entry *dropped = NULL;
+  entry *e = take(dropped);
+  ul.unlock();
+  drop(dropped);
+  if (e == NULL) return dropped != NULL;
+  run(e);
+  return true;
+}
+
+void ThreadPoolImpl::wait() {
+  unique_lock<mutex> ul(m);
+  allDone.wait(ul, [this] { return outstanding == 0; });
+}
+
+ThreadPoolImpl::~ThreadPoolImpl() {
+  wait();
+  {
+    lock_guard<mutex> lg(m);
+    exit = true;
+  }
+  thunkAvailable.notify_all();
+  supervisorCV.notify_all();
+  if (supervisor.joinable()) supervisor.join();
+  for (thread& t: workers) {
+    if (t.joinable()) t.join();
+  }
+}
+
+/**
+ * Function: spreadOrder
+ * ---------------------
+ * Returns the CPUs of the specified node in the order threads should be dealt
+ * out to them: the first CPU of every core, then the second (hyperthread) of
+ * every core, and so on, so that threads only share cores once they must.
+ */
+static vector<int> spreadOrder(const CPUTopology& machine, int node) {
+  map<pair<int, int>, vector<int>> cores;
+  for (const CPUInfo& cpu: machine.getCPUs()) {
+    if (cpu.node == node) cores[make_pair(cpu.package, cpu.core)].push_back(cpu.id);
+  }
+  vector<int> order;
+  for (size_t sibling = 0; order.size() < machine.getCPUsOnNode(node).size(); sibling++) {
+    for (const auto& core: cores) {
+      if (sibling < core.second.size()) order.push_back(core.second[sibling]);
+    }
+  }
+  return order;
+}
+
+static vector<WorkerPlacement> placementsFor(size_t numThreads, ThreadPoolAffinity affinity) {
+  vector<WorkerPlacement> placements(numThreads, WorkerPlacement{vector<int>(), -1, 0, -1});
+  CPUTopology machine;
+  vector<int> nodes = machine.getNodes();
+  if (affinity == kUnpinned || nodes.empty()) return placements;
+  vector<vector<int>> orders;
+  for (int node: nodes) orders.push_back(spreadOrder(machine, node));
   for (size_t workerID = 0; workerID < numThreads; workerID++) {
-    wts[workerID] = thread([this](size_t workerID) {
-      worker(workerID);
-    }, workerID);
+    size_t n = workerID % nodes.size();
+    placements[workerID].node = nodes[n];
+    if (affinity == kPinnedToNode) {
+      placements[workerID].cpus = orders[n];
+    } else {
+      placements[workerID].cpus.push_back(orders[n][(workerID / nodes.size()) % orders[n].size()]);
+    }
+  }
+  return placements;
+}
+
+static vector<WorkerPlacement> placementsOn(const vector<int>& cpus) {
+  CPUTopology machine;
+  vector<WorkerPlacement> placements;
+  for (int cpu: cpus) placements.push_back(WorkerPlacement{vector<int>(1, cpu), machine.getNodeOf(cpu), 0, -1});
+  return placements;
+}
+
+ThreadPool::ThreadPool(size_t numThreads, ThreadPoolAffinity affinity) :
+  impl(new ThreadPoolImpl(placementsFor(numThreads, affinity), ElasticPolicy{numThreads, numThreads})) {}
+
+ThreadPool::ThreadPool(const vector<int>& cpus) :
+  impl(new ThreadPoolImpl(placementsOn(cpus), ElasticPolicy{cpus.size(), cpus.size()})) {}
+
+ThreadPool::ThreadPool(const ElasticPolicy& policy, ThreadPoolAffinity affinity) :
+  impl(new ThreadPoolImpl(placementsFor(max(max<size_t>(policy.minThreads, 1), policy.maxThreads), affinity),
+                          policy)) {}
+
+ThreadPoolTopology ThreadPool::topology() const {
+  return impl->topology();
+}
+
+ThreadPoolStats ThreadPool::stats() const {
+  return impl->stats();
+}
+
+ostream& operator<<(ostream& os, const ThreadPoolStats& stats) {
+  return os << "threads: " << stats.numThreads << " now, " << stats.peakThreads << " at peak, "
+            << stats.threadsSpawned << " spawned, " << stats.threadsRetired << " retired" << endl
+            << "late thunks: " << stats.tasksDropped << " dropped, " << stats.tasksDemoted << " demoted" << endl;
+}
+
+ostream& operator<<(ostream& os, const ThreadPoolTopology& topology) {
+  os << topology.machine;
+  os << setw(6) << "thread" << setw(9) << "tid" << setw(6) << "node" << setw(10) << "last cpu" << "  cpus" << endl;
+  for (size_t i = 0; i < topology.workers.size(); i++) {
+    const WorkerPlacement& w = topology.workers[i];
+    os << setw(6) << i << setw(9) << w.tid << setw(6);
+    if (w.node == -1) os << "any";
+    else os << w.node;
+    os << setw(10) << w.lastCPU << "  ";
+    if (w.cpus.empty()) os << "any";
+    for (size_t j = 0; j < w.cpus.size(); j++) os << (j == 0 ? "" : ",") << w.cpus[j];
+    os << endl;
   }
+  return os;
 }
 
-void ThreadPool::schedule(const function<void(void)>& thunk) {
-  lock_guard<mutex> lgThunkQueue(mThunkQueue);
-  thunkQueue.push(thunk);
-  mThunkQueue.unlock();
-  cvThunkQueue.notify_all();
+void ThreadPool::schedule(Task&& thunk) {
+  impl->schedule(move(thunk), ScheduleOptions{kNormalPriority, chrono::steady_clock::time_point(), kDropWhenLate});
+}
+
+void ThreadPool::schedule(Task&& thunk, const ScheduleOptions& options) {
+  impl->schedule(move(thunk), options);
+}
+
+void ThreadPool::setPriorityWeights(size_t high, size_t normal, size_t low) {
+  size_t weights[kNumPriorities] = {high, normal, low};
+  impl->setPriorityWeights(weights);
 }
 
 void ThreadPool::wait() {
-  lock_guard<mutex> lgThunkQueue(mThunkQueue);
-  cvThunkQueue.wait(mThunkQueue, [this]{ return thunkQueue.empty(); });
-  mThunkQueue.unlock();
-  lock_guard<mutex> lgWorkerStatus(mWorkerStatus);
-  cvWorkerStatus.wait(mWorkerStatus, [this]{
-    return find(wBusy.begin(), wBusy.end(), true) == wBusy.end();
-  });
-  mWorkerStatus.unlock();
+  impl->wait();
+}
+
+bool ThreadPool::onWorkerThread() const {
+  return impl->onWorkerThread();
+}
+
+bool ThreadPool::runPendingThunk() {
+  return impl->runPendingThunk();
 }
 
 ThreadPool::~ThreadPool() {
-  wait();
-  exit = true;
-  cvThunkQueue.notify_all();
-  cvWorkerStatus.notify_all();
-  for (semaphore& s : sWorkers) s.signal();
-  dt.join();
-  for (thread& t : wts) t.join();
+  delete impl;
 }
@@ -5,22 +5,200 @@
  * of thunks (which are zero-argument functions that don't return a value)
  * and schedules them in a FIFO manner to be executed by a constant number
  * of child threads that exist solely to invoke previously scheduled thunks.
+ *
+ * The queue is really three FIFO lanes, one per TaskPriority, which take
+ * turns in proportion to their weights, so that cheap, latency-sensitive
+ * work (cache hits, say) needn't wait behind a burst of slow downloads.  A
+ * thunk can also be given a deadline by which it should have started, after
+ * which it's dropped or demoted instead.
+ *
+ * The threads can be pinned to CPUs or to NUMA nodes, and the pool can report
+ * where they've been placed, so that the number of threads can be matched to
+ * the hardware.
+ *
+ * A pool can also be elastic, in which case it keeps between a minimum and a
+ * maximum number of threads, adding threads while thunks are left waiting (because
+ * those it has are all blocked on slow origin servers, say), and retiring those
+ * that have had nothing to do for a while (see ElasticPolicy).
  */
 
 #ifndef _thread_pool__
 #define _thread_pool__
 
+#include <chrono>
 #include <cstdlib>
-#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+#include "cpu-topology.h"
+#include "task.h"
+
+/**
+ * Type: ThreadPoolAffinity
+ * ------------------------
+ * How a ThreadPool places its threads: not at all, each on a single CPU,
+ * or each on all of the CPUs of a single NUMA node.  Pinned threads are
+ * dealt out across the nodes in turn, and across each node's CPUs in turn
+ * (one per core before any core gets a second), so that a pool smaller
+ * than the machine is spread evenly across it.
+ */
+enum ThreadPoolAffinity {
+  kUnpinned, kPinnedToCPU, kPinnedToNode
+};
+
+/**
+ * Type: WorkerPlacement
+ * ---------------------
+ * Where one of a ThreadPool's threads may run (cpus is empty for an unpinned thread,
+ * and node is -1 for one not confined to a single node), along with its kernel thread
+ * id (as shown by top -H, say) and the CPU it was last seen running on.
+ */
+struct WorkerPlacement {
+  std::vector<int> cpus;
+  int node;
+  pid_t tid;
+  int lastCPU;
+};
+
+/**
+ * Type: ThreadPoolTopology
+ * ------------------------
+ * The machine's CPUs, as the pool sees them, and where each of the pool's
+ * threads has been placed among them, as returned by ThreadPool::topology.
+ */
+struct ThreadPoolTopology {
+  CPUTopology machine;
+  std::vector<WorkerPlacement> workers;
+};
+
+/**
+ * Prints the machine's nodes and CPUs, followed by each thread's placement.
+ */
+std::ostream& operator<<(std::ostream& os, const ThreadPoolTopology& topology);
+
+/**
+ * Type: ElasticPolicy
+ * -------------------
+ * The bounds within which an elastic ThreadPool sizes itself.  It starts with
+ * minThreads threads, and adds another (up to maxThreads in all) whenever the
+ * thunk at the front of any lane has waited for longer than maxQueueAge, which
+ * only happens when every thread is busy.  A thread that has had nothing to do
+ * for idleTimeout retires, unless that would leave fewer than minThreads.
+ */
+struct ElasticPolicy {
+  size_t minThreads;
+  size_t maxThreads;
+  std::chrono::milliseconds maxQueueAge;
+  std::chrono::milliseconds idleTimeout;
+};
+
+/**
+ * Type: ThreadPoolStats
+ * ---------------------
+ * How many threads a ThreadPool has now, the most it has ever had at once,
+ * how many it has ever started (the first ones included), and how many of
+ * those have since retired, along with how many thunks were dropped or demoted
+ * because their deadlines passed, as returned by ThreadPool::stats.
+ */
+struct ThreadPoolStats {
+  size_t numThreads;
+  size_t peakThreads;
+  size_t threadsSpawned;
+  size_t threadsRetired;
+  size_t tasksDropped;
+  size_t tasksDemoted;
+};
+
+/**
+ * Prints the thread counts on one line and the late thunk counts on another.
+ */
+std::ostream& operator<<(std::ostream& os, const ThreadPoolStats& stats);
+
+/**
+ * Type: TaskPriority
+ * ------------------
+ * The lane a thunk waits in.  While thunks are waiting in more than one lane,
+ * the lanes take turns handing them out, each handing out as many per turn
+ * as its weight (see ThreadPool::setPriorityWeights), so that high-priority
+ * thunks jump ahead of the rest without starving them.
+ */
+enum TaskPriority {
+  kHighPriority, kNormalPriority, kLowPriority
+};
+
+static const size_t kNumPriorities = kLowPriority + 1;
+
+/**
+ * Type: LatePolicy
+ * ----------------
+ * What becomes of a thunk whose deadline passes before a thread gets to it:
+ * it's either dropped without being run (see Task::cancel), or demoted to the
+ * back of the low-priority lane, from which it will eventually be run regardless.
+ */
+enum LatePolicy {
+  kDropWhenLate, kDemoteWhenLate
+};
+
+/**
+ * Type: ScheduleOptions
+ * ---------------------
+ * How to queue a thunk: in which lane, and, optionally, with a deadline by which
+ * it should have started, along with what to do if it hasn't.  A default-constructed
+ * deadline means there isn't one, so ScheduleOptions{kHighPriority} sets only the lane.
+ */
+struct ScheduleOptions {
+  TaskPriority priority;
+  std::chrono::steady_clock::time_point deadline;
+  LatePolicy whenLate;
+};
+
+/**
+ * Class: DeadlineMissedException
+ * ------------------------------
+ * Thrown by the Future for a submitted function that was dropped
+ * because its deadline passed before it could start.
+ */
+class DeadlineMissedException: public std::runtime_error {
+ public:
+  DeadlineMissedException() : std::runtime_error("deadline passed before the task could start") {}
+};
+
+template <typename T>
+class Future;
 
 class ThreadPool {
  public:
 
 /**
  * Constructs a ThreadPool configured to spawn up to the specified
- * number of threads.
+ * number of threads, placed as the supplied affinity dictates.
+ */
+  ThreadPool(size_t numThreads, ThreadPoolAffinity affinity = kUnpinned);
+
+/**
+ * Constructs a ThreadPool with one thread pinned to each of the
+ * supplied CPUs (which may be listed more than once).
+ */
+  ThreadPool(const std::vector<int>& cpus);
+
+/**
+ * Constructs an elastic ThreadPool, which keeps as many threads as the supplied
+ * policy dictates, each placed as the supplied affinity dictates (with the first
+ * maxThreads placements dealt out as though that many threads were wanted).
+ */
+  ThreadPool(const ElasticPolicy& policy, ThreadPoolAffinity affinity = kUnpinned);
+
+/**
+ * Returns the machine's topology and each thread's place in it.
  */
-  ThreadPool(size_t numThreads);
+  ThreadPoolTopology topology() const;
+
+/**
+ * Returns how many threads the pool has, and has had.
+ */
+  ThreadPoolStats stats() const;
 
 /**
  * Destroys the ThreadPool class
@@ -31,9 +209,44 @@ class ThreadPool {
  * Schedules the provided thunk (which is something that can
  * be invoked as a zero-argument function without a return value)
  * to be executed by one of the ThreadPool's threads as soon as
- * all previously scheduled thunks have been handled.
+ * all previously scheduled thunks have been handled.  The thunk is
+ * moved (if it's an rvalue) or copied into a Task just once, so it
+ * needn't be copyable, and normally nothing is allocated (see task.h).
+ */
+  template <typename F>
+  void schedule(F&& thunk) { schedule(Task(std::forward<F>(thunk))); }
+
+  void schedule(Task&& thunk);
+
+/**
+ * Schedules the provided thunk as above, but queued as the supplied options
+ * dictate.  Deadlines are checked as thunks are taken off the queue, so a
+ * thunk that has already started always runs to completion.
+ */
+  template <typename F>
+  void schedule(F&& thunk, const ScheduleOptions& options) { schedule(Task(std::forward<F>(thunk)), options); }
+
+  void schedule(Task&& thunk, const ScheduleOptions& options);
+
+/**
+ * Schedules the provided function (which takes no arguments, but may
+ * return a value) just as schedule would, and returns a Future for its
+ * result, which continuations can be attached to (see future.h).  If the
+ * function is dropped because its deadline passed, the Future throws a
+ * DeadlineMissedException.
  */
-  void schedule(const std::function<void(void)>& thunk);
+  template <typename F>
+  Future<typename std::result_of<typename std::decay<F>::type&()>::type> submit(F&& f);
+
+  template <typename F>
+  Future<typename std::result_of<typename std::decay<F>::type&()>::type> submit(F&& f, const ScheduleOptions& options);
+
+/**
+ * Sets how many thunks each lane hands out per turn while other lanes have
+ * thunks waiting too (see TaskPriority).  The weights start out as 8, 4,
+ * and 1, and any weight of 0 is treated as 1, so that no lane starves.
+ */
+  void setPriorityWeights(size_t high, size_t normal, size_t low);
 
 /**
  * Blocks and waits until all previously scheduled thunks
@@ -44,8 +257,15 @@ class ThreadPool {
  private:
   class ThreadPoolImpl *impl;
 
+  bool onWorkerThread() const;
+  bool runPendingThunk();
+
   ThreadPool(const ThreadPool& original) = delete;
   ThreadPool& operator=(const ThreadPool& rhs) = delete;
+
+  friend class FutureStateBase;
 };
 
+#include "future.h"
+
 #endif
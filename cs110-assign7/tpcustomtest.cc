@@ -0,0 +1,163 @@
+/**
+ * File: tpcustomtest.cc
+ * ---------------------
+ * Unit tests that exercise the proxy's ThreadPool, particularly where it
+ * differs from assign6's: a single queue shared by every thread, which
+ * a thread waiting on a Future drains itself, whose priority lanes take
+ * turns in strict order, and an elastic pool that can shrink to no threads
+ * at all.
+ */
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <functional>
+#include <chrono>
+#include <future>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "thread-pool.h"
+using namespace std;
+
+static void nestedFuturesTest() {
+  ThreadPool pool(1);
+  // The only thread waits on futures whose thunks are queued behind it, so this
+  // finishes only if the waiting thread runs them itself.
+  Future<size_t> outer = pool.submit([&pool]() -> size_t {
+    vector<Future<size_t>> lengths;
+    for (size_t i = 0; i < 8; i++) {
+      lengths.push_back(pool.submit([i] { return string(i, '*'); })
+                            .then([](const string& stars) { return stars.size(); }));
+    }
+    Future<vector<size_t>> all = whenAll(lengths);
+    size_t total = 0;
+    for (size_t length: all.get()) total += length;
+    return total + pool.submit([] { return size_t(0); }).get();
+  });
+  cout << "Total length: " << outer.get() << " (expected 28), all on a single thread." << endl;
+}
+
+static void elasticFromZeroTest() {
+  ThreadPool pool(ElasticPolicy{0, 4, chrono::milliseconds(5), chrono::milliseconds(50)});
+  cout << (pool.stats().numThreads == 0 && pool.topology().workers.empty() ? "Started out with no threads." :
+           "Started out with threads it didn't need!") << endl;
+
+  promise<void> release;
+  shared_future<void> gate = release.get_future().share();
+  vector<promise<void>> started(4);
+  for (promise<void>& p: started) {
+    promise<void> *arrived = &p;
+    pool.schedule([arrived, gate] { arrived->set_value(); gate.wait(); }); // stands in for a slow origin fetch
+  }
+  for (promise<void>& p: started) p.get_future().wait();
+  ThreadPoolStats busy = pool.stats();
+  set<pid_t> tids;
+  for (const WorkerPlacement& worker: pool.topology().workers) tids.insert(worker.tid);
+  cout << "Grew to " << busy.numThreads << " threads, and the topology lists " << tids.size()
+       << " distinct ones (expected 4 and 4)." << endl;
+  release.set_value();
+  pool.wait();
+
+  this_thread::sleep_for(chrono::milliseconds(300));
+  ThreadPoolStats idle = pool.stats();
+  cout << (idle.numThreads == 0 && idle.threadsRetired == 4 && pool.topology().workers.empty() ?
+           "Retired every thread once idle, and the topology lists none." : "Failed to shrink back to no threads!") << endl;
+
+  pool.schedule([] {});
+  pool.wait();
+  cout << (pool.stats().threadsSpawned == 5 ? "Spawned a fifth thread for a thunk scheduled after that." :
+           "Didn't start a thread for a thunk scheduled after that!") << endl;
+}
+
+static void laneOrderTest() {
+  ThreadPool pool(1);
+  promise<void> started, release;
+  shared_future<void> gate = release.get_future().share();
+  pool.schedule([&started, gate] { started.set_value(); gate.wait(); }); // ties up the only thread
+  started.get_future().wait();
+  pool.setPriorityWeights(2, 1, 1); // starts the lanes' turns afresh, since the thunk above took one
+
+  string order;
+  const TaskPriority priorities[] = {kLowPriority, kNormalPriority, kHighPriority};
+  for (size_t i = 0; i < 4; i++) {
+    for (TaskPriority priority: priorities) {
+      pool.schedule([&order, priority, i] { order += "HNL"[priority]; order += char('0' + i); },
+                    ScheduleOptions{priority});
+    }
+  }
+  release.set_value();
+  pool.wait();
+  cout << "Ran in the order " << order << " (expected H0H1N0L0H2H3N1L1N2L2N3L3)." << endl;
+}
+
+static void lateWhileWaitingTest() {
+  ThreadPool pool(1);
+  // The only thread waits on late submissions itself, so it's runPendingThunk, not
+  // a worker, that finds them late and drops or demotes them.
+  Future<string> outcome = pool.submit([&pool]() -> string {
+    chrono::steady_clock::time_point passed = chrono::steady_clock::now() - chrono::milliseconds(1);
+    Future<int> demoted = pool.submit([] { return 1; }, ScheduleOptions{kHighPriority, passed, kDemoteWhenLate});
+    Future<int> dropped = pool.submit([] { return 2; }, ScheduleOptions{kHighPriority, passed, kDropWhenLate});
+    string outcome = "demoted one returned " + to_string(demoted.get()) + ", and the dropped one ";
+    try {
+      outcome += "returned " + to_string(dropped.get());
+    } catch (const DeadlineMissedException& e) {
+      outcome += "threw \"" + string(e.what()) + "\"";
+    }
+    return outcome;
+  });
+  cout << "The " << outcome.get() << "." << endl;
+  ThreadPoolStats stats = pool.stats();
+  cout << (stats.tasksDropped == 1 && stats.tasksDemoted == 1 ? "Counted 1 dropped thunk and 1 demoted one." :
+           "Miscounted the late thunks!") << endl;
+}
+
+struct testEntry {
+  string flag;
+  function<void(void)> testfn;
+};
+
+static void buildMap(map<string, function<void(void)>>& testFunctionMap) {
+  testEntry entries[] = {
+    {"--nested-futures", nestedFuturesTest},
+    {"--elastic-from-zero", elasticFromZeroTest},
+    {"--lane-order", laneOrderTest},
+    {"--late-while-waiting", lateWhileWaitingTest},
+  };
+
+  for (const testEntry& entry: entries) {
+    testFunctionMap[entry.flag] = entry.testfn;
+  }
+}
+
+static void executeAll(const map<string, function<void(void)>>& testFunctionMap) {
+  for (const auto& entry: testFunctionMap) {
+    cout << entry.first << ":" << endl;
+    entry.second();
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    cout << "Ouch! I need exactly two arguments." << endl;
+    return 0;
+  }
+
+  map<string, function<void(void)>> testFunctionMap;
+  buildMap(testFunctionMap);
+  string flag = argv[1];
+  if (flag == "--all") {
+    executeAll(testFunctionMap);
+    return 0;
+  }
+  auto found = testFunctionMap.find(argv[1]);
+  if (found == testFunctionMap.end()) {
+    cout << "Oops... we don't recognize the flag \"" << argv[1] << "\"." << endl;
+    return 0;
+  }
+
+  found->second();
+  return 0;
+}
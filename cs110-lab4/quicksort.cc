@@ -4,6 +4,15 @@
  * Provides a working sequential version of quicksort, leaving
  * you with the task of implementing two different multithreaded
  * versions as descrived in the lab4 handout.
+ *
+ * The aggressive and conservative versions spawn a thread per partition,
+ * which is why they're limited to small inputs.  The parallel version
+ * instead hands partitions to a fixed pool of workers, each of which keeps
+ * its own deque of unsorted ranges and steals from the others once its own
+ * deque runs dry, so it can sort hundreds of millions of numbers.  The radix
+ * and sample versions aren't comparison-based quicksorts at all, but they're
+ * benchmarked alongside the others, since small key ranges like the one
+ * populateSequence draws from play to their strengths.
  */
 
 #include "random-generator.h"  // for RandomGenerator
@@ -13,6 +22,14 @@
 #include <iomanip>             // for setw, setfill
 #include <cassert>             // for assert macro
 #include <thread>              // for thread
+#include <mutex>               // for mutex, lock_guard, unique_lock
+#include <condition_variable>  // for condition_variable
+#include <atomic>              // for atomic
+#include <deque>               // for deque
+#include <memory>              // for unique_ptr
+#include <chrono>              // for steady_clock
+#include <cstdlib>             // for strtoull, exit
+#include <functional>          // for function
 
 using namespace std;
 
@@ -102,6 +119,617 @@ static void quicksort(vector<int> &numbers, ssize_t start, ssize_t finish) {
     quicksort(numbers, mid + 1, finish);
 }
 
+/**
+ * Function: insertionSort
+ * -----------------------
+ * Sorts the (small) range of integers from start through finish
+ * via insertion sort, which beats partitioning on ranges this small.
+ */
+static void insertionSort(vector<int> &numbers, ssize_t start, ssize_t finish) {
+    for (ssize_t i = start + 1; i <= finish; i++) {
+        int value = numbers[i];
+        ssize_t j = i - 1;
+        while (j >= start && numbers[j] > value) {
+            numbers[j + 1] = numbers[j];
+            j--;
+        }
+        numbers[j + 1] = value;
+    }
+}
+
+/**
+ * Function: heapsort
+ * ------------------
+ * Sorts the range of integers from start through finish via heapsort,
+ * whose running time is O(n log n) no matter how the numbers are arranged.
+ */
+static void heapsort(vector<int> &numbers, ssize_t start, ssize_t finish) {
+    make_heap(numbers.begin() + start, numbers.begin() + finish + 1);
+    sort_heap(numbers.begin() + start, numbers.begin() + finish + 1);
+}
+
+/**
+ * Function: depthLimitFor
+ * -----------------------
+ * Returns the number of levels of partitioning introsort allows for a range
+ * of the supplied length before it gives up on quicksort, which is twice the
+ * depth a run of perfectly balanced partitions would reach.
+ */
+static size_t depthLimitFor(size_t length) {
+    size_t depth = 0;
+    while (length > 1) {
+        length >>= 1;
+        depth++;
+    }
+    return 2 * depth;
+}
+
+/**
+ * Function: sort3
+ * ---------------
+ * Rearranges the three integers at the supplied positions so that
+ * numbers[a] <= numbers[b] <= numbers[c].
+ */
+static void sort3(vector<int> &numbers, ssize_t a, ssize_t b, ssize_t c) {
+    if (numbers[b] < numbers[a]) swap(numbers[a], numbers[b]);
+    if (numbers[c] < numbers[b]) swap(numbers[b], numbers[c]);
+    if (numbers[b] < numbers[a]) swap(numbers[a], numbers[b]);
+}
+
+/**
+ * Function: selectPivot
+ * ---------------------
+ * Moves a good pivot to numbers[start]: the median of the first, middle,
+ * and last numbers for small ranges, and Tukey's ninther (the median of three
+ * such medians) for larger ones.  Either way, sorted and reversed input are split
+ * down the middle rather than one element at a time.
+ */
+static const ssize_t kNintherThreshold = 128;
+static void selectPivot(vector<int> &numbers, ssize_t start, ssize_t finish) {
+    ssize_t mid = start + (finish - start + 1) / 2;
+    if (finish - start + 1 <= kNintherThreshold) {
+        sort3(numbers, mid, start, finish);
+        return;
+    }
+    sort3(numbers, start, mid, finish);
+    sort3(numbers, start + 1, mid - 1, finish - 1);
+    sort3(numbers, start + 2, mid + 1, finish - 2);
+    sort3(numbers, mid - 1, mid, mid + 1);
+    swap(numbers[start], numbers[mid]);
+}
+
+/**
+ * Function: goesLeft
+ * ------------------
+ * Returns true if and only if value belongs to the left of the pivot.  Ordinarily
+ * that's every number less than the pivot, but when equalsGoLeft is true, numbers
+ * equal to the pivot go left as well.
+ */
+template <bool equalsGoLeft>
+static inline bool goesLeft(int value, int pivot) {
+    return equalsGoLeft ? value <= pivot : value < pivot;
+}
+
+/**
+ * Function: finishPartition
+ * -------------------------
+ * Partitions the integers from lo up to (but not including) hi with a scalar
+ * Hoare-style loop, given that everything from numbers[start + 1] up to lo already
+ * belongs left and everything from hi on already belongs right, and then swaps the pivot
+ * (numbers[start]) into place between the two sides and returns its final position.
+ */
+template <bool equalsGoLeft>
+static ssize_t finishPartition(vector<int> &numbers, ssize_t start, ssize_t lo, ssize_t hi) {
+    int pivot = numbers[start];
+    hi--;
+    while (true) {
+        while (lo <= hi && goesLeft<equalsGoLeft>(numbers[lo], pivot)) lo++;
+        while (lo <= hi && !goesLeft<equalsGoLeft>(numbers[hi], pivot)) hi--;
+        if (lo >= hi) break;
+        swap(numbers[lo], numbers[hi]);
+        lo++;
+        hi--;
+    }
+    ssize_t mid = lo - 1;
+    swap(numbers[start], numbers[mid]);
+    return mid;
+}
+
+/**
+ * Function: scalarPartition
+ * -------------------------
+ * Partitions the range from start through finish around numbers[start]
+ * one element at a time, branching on every comparison.
+ */
+template <bool equalsGoLeft>
+static ssize_t scalarPartition(vector<int> &numbers, ssize_t start, ssize_t finish) {
+    return finishPartition<equalsGoLeft>(numbers, start, start + 1, finish + 1);
+}
+
+/**
+ * Function: blockPartition
+ * ------------------------
+ * Partitions the range from start through finish around numbers[start] without
+ * branching on comparisons, as in BlockQuicksort (Edelkamp and Weiss).  A block of
+ * kBlockSize numbers from the left end is scanned, and the offset of every number
+ * that belongs right is recorded; another block from the right end is scanned for
+ * numbers that belong left.  Each comparison merely decides whether the offset
+ * counter advances, so the scans compile to straight-line code whose cost doesn't
+ * depend on how predictable the data is.  The recorded numbers are then swapped
+ * pairwise, and whichever block has been exhausted is replaced by the next one in.
+ * Whatever's left once fewer than two blocks remain is finished off by finishPartition.
+ */
+static const ssize_t kBlockSize = 64;
+template <bool equalsGoLeft>
+static ssize_t blockPartition(vector<int> &numbers, ssize_t start, ssize_t finish) {
+    int pivot = numbers[start];
+    int *data = numbers.data();
+    ssize_t lo = start + 1;
+    ssize_t hi = finish + 1; // one past the last number not known to belong right
+    unsigned char leftOffsets[kBlockSize], rightOffsets[kBlockSize];
+    size_t numLeft = 0, numRight = 0, firstLeft = 0, firstRight = 0;
+    while (hi - lo > 2 * kBlockSize) {
+        if (numLeft == 0) {
+            firstLeft = 0;
+            for (ssize_t i = 0; i < kBlockSize; i++) {
+                leftOffsets[numLeft] = i;
+                numLeft += !goesLeft<equalsGoLeft>(data[lo + i], pivot);
+            }
+        }
+        if (numRight == 0) {
+            firstRight = 0;
+            for (ssize_t i = 0; i < kBlockSize; i++) {
+                rightOffsets[numRight] = i;
+                numRight += goesLeft<equalsGoLeft>(data[hi - 1 - i], pivot);
+            }
+        }
+        size_t numSwaps = min(numLeft, numRight);
+        for (size_t i = 0; i < numSwaps; i++) {
+            swap(data[lo + leftOffsets[firstLeft + i]], data[hi - 1 - rightOffsets[firstRight + i]]);
+        }
+        numLeft -= numSwaps;
+        numRight -= numSwaps;
+        firstLeft += numSwaps;
+        firstRight += numSwaps;
+        if (numLeft == 0) lo += kBlockSize;
+        if (numRight == 0) hi -= kBlockSize;
+    }
+    // a block that's only partly been swapped is simply scanned again
+    return finishPartition<equalsGoLeft>(numbers, start, lo, hi);
+}
+
+/**
+ * Function: partitionStep
+ * -----------------------
+ * Selects a pivot for the range from start through finish, partitions the range
+ * around it (with the block kernel if branchless is true, and the scalar one otherwise),
+ * and sets lowerFinish and upperStart so that [start, lowerFinish] and [upperStart, finish]
+ * are all that's left to be sorted.
+ *
+ * Unless leftmost is true, numbers[start - 1] must be no larger than anything in
+ * the range (and mustn't be changing under us).  If that predecessor is equal to the
+ * pivot, the numbers equal to the pivot are sent left, where they're then known to be
+ * in place, so the left side needn't be sorted at all.  That makes quick work of inputs
+ * with few distinct values, which otherwise degrade quicksort because every number
+ * equal to the pivot lands on the same side.
+ */
+template <bool branchless>
+static void partitionStep(vector<int> &numbers, ssize_t start, ssize_t finish, bool leftmost,
+                          ssize_t &lowerFinish, ssize_t &upperStart) {
+    selectPivot(numbers, start, finish);
+    ssize_t mid;
+    if (!leftmost && numbers[start - 1] == numbers[start]) {
+        mid = branchless ? blockPartition<true>(numbers, start, finish) : scalarPartition<true>(numbers, start, finish);
+        lowerFinish = start - 1;
+    } else {
+        mid = branchless ? blockPartition<false>(numbers, start, finish) : scalarPartition<false>(numbers, start, finish);
+        lowerFinish = mid - 1;
+    }
+    upperStart = mid + 1;
+}
+
+/**
+ * Function: introsort
+ * -------------------
+ * Sorts the range of integers from start through finish via quicksort,
+ * except that small ranges are insertion sorted and that the range is heapsorted
+ * instead once depthLimit levels of partitioning haven't finished the job (as they
+ * won't if the pivots keep being poor).  The smaller side of each partition is sorted
+ * recursively and the larger one iteratively, so the recursion is never more than
+ * O(log n) deep.  The template parameter selects the partition kernel, and leftmost
+ * is as for partitionStep.
+ */
+static const ssize_t kInsertionSortCutoff = 16;
+template <bool branchless>
+static void introsort(vector<int> &numbers, ssize_t start, ssize_t finish, size_t depthLimit, bool leftmost) {
+    while (finish - start + 1 > kInsertionSortCutoff) {
+        if (depthLimit == 0) {
+            heapsort(numbers, start, finish);
+            return;
+        }
+        depthLimit--;
+        ssize_t lowerFinish, upperStart;
+        partitionStep<branchless>(numbers, start, finish, leftmost, lowerFinish, upperStart);
+        if (lowerFinish - start < finish - upperStart) {
+            introsort<branchless>(numbers, start, lowerFinish, depthLimit, leftmost);
+            start = upperStart;
+            leftmost = false;
+        } else {
+            introsort<branchless>(numbers, upperStart, finish, depthLimit, false);
+            finish = lowerFinish;
+        }
+    }
+    insertionSort(numbers, start, finish);
+}
+
+/**
+ * Functions: introsort, scalarIntrosort
+ * -------------------------------------
+ * Sort the supplied numbers via introsort, with the branchless block
+ * partition kernel and the scalar one, respectively.
+ */
+static void introsort(vector<int> &numbers) {
+    introsort<true>(numbers, 0, numbers.size() - 1, depthLimitFor(numbers.size()), true);
+}
+
+static void scalarIntrosort(vector<int> &numbers) {
+    introsort<false>(numbers, 0, numbers.size() - 1, depthLimitFor(numbers.size()), true);
+}
+
+/**
+ * Class: ParallelSorter
+ * ---------------------
+ * Sorts with a fixed pool of workers: the thread calling sort, and
+ * one fewer helper threads than there are cores, all launched once and
+ * reused by every call to sort.  Each worker owns a deque of ranges still
+ * to be sorted.  A worker partitions its range, pushes the larger side onto
+ * the back of its own deque, and carries on with the smaller side, until its
+ * range is small enough (kSequentialCutoff) to introsort on its own.  It then
+ * takes the most recently pushed range from the back of its own deque, or, if
+ * that's empty, steals the oldest (and so typically largest) range from the
+ * front of some other worker's deque.  Since the ranges are disjoint, none of
+ * this requires any locking of the numbers themselves.  (The number just before
+ * a range, which partitionStep consults, is always a pivot that's already been
+ * put in its final place, so it's never being moved by another worker.)
+ */
+static const ssize_t kSequentialCutoff = 1 << 14;
+class ParallelSorter {
+public:
+    ParallelSorter(size_t numWorkers);
+    ~ParallelSorter();
+    void sort(vector<int> &numbers);
+
+private:
+    struct range {
+        ssize_t start;
+        ssize_t finish;
+        size_t depthLimit;
+        bool leftmost;
+    };
+
+    struct workerQueue {
+        mutex lock;
+        std::deque<range> ranges;
+    };
+
+    vector<unique_ptr<workerQueue>> queues; // one per worker, where the caller of sort is worker 0
+    vector<thread> helpers;
+    vector<int> *numbers;
+    atomic<size_t> outstanding; // the number of ranges pushed (or being sorted) but not yet sorted
+
+    mutex generationLock;
+    condition_variable generationChanged;
+    size_t generation; // the number of calls to sort so far, used to wake the helpers
+    bool shuttingDown;
+
+    void help(size_t id);
+    void work(size_t id);
+    bool take(size_t id, range &r);
+    void push(size_t id, const range &r);
+    void sortRange(size_t id, range r);
+};
+
+ParallelSorter::ParallelSorter(size_t numWorkers) : numbers(NULL), outstanding(0), generation(0), shuttingDown(false) {
+    if (numWorkers == 0) numWorkers = 1;
+    for (size_t id = 0; id < numWorkers; id++) queues.emplace_back(new workerQueue);
+    for (size_t id = 1; id < numWorkers; id++) helpers.push_back(thread([this, id] { help(id); }));
+}
+
+ParallelSorter::~ParallelSorter() {
+    {
+        lock_guard<mutex> lg(generationLock);
+        shuttingDown = true;
+    }
+    generationChanged.notify_all();
+    for (thread &t: helpers) t.join();
+}
+
+void ParallelSorter::sort(vector<int> &numbers) {
+    if (numbers.size() < 2) return;
+    this->numbers = &numbers;
+    outstanding = 1;
+    push(0, {0, (ssize_t) numbers.size() - 1, depthLimitFor(numbers.size()), true});
+    {
+        lock_guard<mutex> lg(generationLock);
+        generation++;
+    }
+    generationChanged.notify_all();
+    work(0);
+}
+
+/**
+ * Method: help
+ * ------------
+ * The body of each helper thread, which sleeps until the next call to sort
+ * and then works alongside the caller until every range has been sorted.
+ */
+void ParallelSorter::help(size_t id) {
+    size_t seen = 0;
+    while (true) {
+        {
+            unique_lock<mutex> ul(generationLock);
+            generationChanged.wait(ul, [this, seen] { return shuttingDown || generation != seen; });
+            if (shuttingDown) return;
+            seen = generation;
+        }
+        work(id);
+    }
+}
+
+/**
+ * Method: work
+ * ------------
+ * Sorts whatever ranges can be found until there are none left to sort.
+ */
+void ParallelSorter::work(size_t id) {
+    while (outstanding.load() > 0) {
+        range r;
+        if (take(id, r)) sortRange(id, r);
+        else this_thread::yield();
+    }
+}
+
+void ParallelSorter::push(size_t id, const range &r) {
+    lock_guard<mutex> lg(queues[id]->lock);
+    queues[id]->ranges.push_back(r);
+}
+
+/**
+ * Method: take
+ * ------------
+ * Pops the range most recently pushed by the supplied worker, or failing that,
+ * steals the oldest range of the first other worker that has one.  Returns false
+ * if every deque is empty.
+ */
+bool ParallelSorter::take(size_t id, range &r) {
+    for (size_t i = 0; i < queues.size(); i++) {
+        size_t victim = (id + i) % queues.size();
+        lock_guard<mutex> lg(queues[victim]->lock);
+        std::deque<range> &ranges = queues[victim]->ranges;
+        if (ranges.empty()) continue;
+        if (victim == id) {
+            r = ranges.back();
+            ranges.pop_back();
+        } else {
+            r = ranges.front();
+            ranges.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void ParallelSorter::sortRange(size_t id, range r) {
+    while (r.finish - r.start + 1 > kSequentialCutoff && r.depthLimit > 0) {
+        r.depthLimit--;
+        ssize_t lowerFinish, upperStart;
+        partitionStep<true>(*numbers, r.start, r.finish, r.leftmost, lowerFinish, upperStart);
+        range lower = {r.start, lowerFinish, r.depthLimit, r.leftmost};
+        range upper = {upperStart, r.finish, r.depthLimit, false};
+        bool lowerIsSmaller = lowerFinish - r.start < r.finish - upperStart;
+        outstanding++;
+        push(id, lowerIsSmaller ? upper : lower);
+        r = lowerIsSmaller ? lower : upper;
+    }
+    introsort<true>(*numbers, r.start, r.finish, r.depthLimit, r.leftmost);
+    outstanding--;
+}
+
+/**
+ * Function: numCores
+ * ------------------
+ * Returns the number of cores available, or 1 if that can't be determined.
+ */
+static size_t numCores() {
+    return max<size_t>(1, thread::hardware_concurrency());
+}
+
+/**
+ * Function: parallelQuicksort
+ * ---------------------------
+ * Sorts the supplied numbers with a ParallelSorter that has one worker
+ * per core.  The sorter (and its threads) are created the first time
+ * through and reused from then on.
+ */
+static void parallelQuicksort(vector<int> &numbers) {
+    static ParallelSorter sorter(numCores());
+    sorter.sort(numbers);
+}
+
+/**
+ * Function: workersFor
+ * --------------------
+ * Returns the number of workers the radix and sample sorts split the supplied
+ * number of elements across: one per core, unless that would leave any of them
+ * with fewer than kMinElementsPerWorker elements.
+ */
+static const size_t kMinElementsPerWorker = 1 << 16;
+static size_t workersFor(size_t numElements) {
+    return max<size_t>(1, min(numCores(), numElements / kMinElementsPerWorker));
+}
+
+/**
+ * Function: runOnWorkers
+ * ----------------------
+ * Runs the supplied function once per worker, passing each its id (from 0
+ * up to numWorkers - 1), and returns once they've all finished.  The calling
+ * thread serves as worker 0, so a single worker costs no threads at all.
+ */
+static void runOnWorkers(size_t numWorkers, const function<void(size_t)> &fn) {
+    vector<thread> workers;
+    for (size_t id = 1; id < numWorkers; id++) workers.push_back(thread(fn, id));
+    fn(0);
+    for (thread &t: workers) t.join();
+}
+
+/**
+ * Function: radixSort
+ * -------------------
+ * Sorts the supplied numbers via an LSD radix sort, one byte per pass.  The
+ * numbers are split into one contiguous chunk per worker.  Every pass, each worker
+ * builds a histogram of its own chunk's digits, those histograms are combined into
+ * the position at which each worker writes its first number with each digit (worker
+ * by worker within each digit, which keeps the sort stable), and each worker then
+ * scatters its own chunk into a second buffer.  A histogram of every digit is built
+ * up front, so that any pass whose digit is the same for every number (the top two
+ * bytes, for numbers drawn from [kMinValue, kMaxValue]) is skipped altogether.
+ */
+static const size_t kRadixBits = 8;
+static const size_t kNumDigitValues = 1 << kRadixBits;
+static const size_t kNumRadixPasses = 32 / kRadixBits;
+static inline size_t digitOf(int value, size_t pass) {
+    unsigned int key = (unsigned int) value ^ 0x80000000u; // flipping the sign bit orders negative numbers first
+    return (key >> (pass * kRadixBits)) & (kNumDigitValues - 1);
+}
+
+static void radixSort(vector<int> &numbers) {
+    size_t n = numbers.size();
+    size_t numWorkers = workersFor(n);
+    auto chunkStart = [n, numWorkers](size_t id) { return n * id / numWorkers; };
+    // counts[id][pass * kNumDigitValues + digit] counts the numbers in worker id's chunk with that digit
+    vector<vector<size_t>> counts(numWorkers, vector<size_t>(kNumRadixPasses * kNumDigitValues));
+    runOnWorkers(numWorkers, [&](size_t id) {
+        vector<size_t> &count = counts[id];
+        for (size_t i = chunkStart(id); i < chunkStart(id + 1); i++) {
+            for (size_t pass = 0; pass < kNumRadixPasses; pass++)
+                count[pass * kNumDigitValues + digitOf(numbers[i], pass)]++;
+        }
+    });
+
+    vector<int> buffer(n);
+    vector<int> *from = &numbers, *to = &buffer;
+    bool scattered = false; // once anything's moved, the up-front per-chunk counts are stale
+    vector<vector<size_t>> offsets(numWorkers, vector<size_t>(kNumDigitValues));
+    for (size_t pass = 0; pass < kNumRadixPasses; pass++) {
+        bool skip = false;
+        for (size_t digit = 0; digit < kNumDigitValues && !skip; digit++) {
+            size_t total = 0;
+            for (size_t id = 0; id < numWorkers; id++) total += counts[id][pass * kNumDigitValues + digit];
+            skip = total == n;
+        }
+        if (skip) continue;
+
+        if (scattered) {
+            runOnWorkers(numWorkers, [&](size_t id) {
+                size_t *count = &counts[id][pass * kNumDigitValues];
+                fill(count, count + kNumDigitValues, 0);
+                for (size_t i = chunkStart(id); i < chunkStart(id + 1); i++) count[digitOf((*from)[i], pass)]++;
+            });
+        }
+        size_t position = 0;
+        for (size_t digit = 0; digit < kNumDigitValues; digit++) {
+            for (size_t id = 0; id < numWorkers; id++) {
+                offsets[id][digit] = position;
+                position += counts[id][pass * kNumDigitValues + digit];
+            }
+        }
+        runOnWorkers(numWorkers, [&](size_t id) {
+            vector<size_t> &offset = offsets[id];
+            for (size_t i = chunkStart(id); i < chunkStart(id + 1); i++) {
+                int value = (*from)[i];
+                (*to)[offset[digitOf(value, pass)]++] = value;
+            }
+        });
+        swap(from, to);
+        scattered = true;
+    }
+    if (from != &numbers) numbers.swap(buffer);
+}
+
+/**
+ * Function: sampleSort
+ * --------------------
+ * Sorts the supplied numbers via a parallel sample sort.  A random sample of
+ * kOversampling numbers per worker is sorted, and evenly spaced members of it are
+ * chosen as splitters, which carve the range of values into one bucket per worker.
+ * Each worker then counts how many numbers in its own chunk land in each bucket, the
+ * counts are combined into where each worker writes into each bucket, every worker
+ * scatters its chunk into a second buffer, and finally the buckets, which are now
+ * in order relative to one another, are each introsorted in place by whichever worker
+ * gets to them first.
+ */
+static const size_t kOversampling = 64;
+static void sampleSort(vector<int> &numbers) {
+    size_t n = numbers.size();
+    size_t numWorkers = workersFor(n);
+    if (numWorkers == 1) {
+        introsort(numbers);
+        return;
+    }
+    auto chunkStart = [n, numWorkers](size_t id) { return n * id / numWorkers; };
+
+    // draw one sample from each of kOversampling * numWorkers evenly sized strides
+    RandomGenerator rgen;
+    size_t numSamples = kOversampling * numWorkers;
+    vector<int> samples(numSamples);
+    for (size_t i = 0; i < numSamples; i++) {
+        size_t strideStart = n * i / numSamples;
+        size_t strideLength = n * (i + 1) / numSamples - strideStart;
+        samples[i] = numbers[strideStart + rgen.getNextInt(0, strideLength - 1)];
+    }
+    sort(samples.begin(), samples.end());
+    vector<int> splitters(numWorkers - 1);
+    for (size_t b = 0; b + 1 < numWorkers; b++) splitters[b] = samples[(b + 1) * kOversampling];
+    auto bucketOf = [&splitters](int value) {
+        return upper_bound(splitters.begin(), splitters.end(), value) - splitters.begin();
+    };
+
+    vector<vector<size_t>> counts(numWorkers, vector<size_t>(numWorkers));
+    runOnWorkers(numWorkers, [&](size_t id) {
+        for (size_t i = chunkStart(id); i < chunkStart(id + 1); i++) counts[id][bucketOf(numbers[i])]++;
+    });
+    vector<vector<size_t>> offsets(numWorkers, vector<size_t>(numWorkers));
+    vector<size_t> bucketStarts(numWorkers + 1);
+    size_t position = 0;
+    for (size_t b = 0; b < numWorkers; b++) {
+        bucketStarts[b] = position;
+        for (size_t id = 0; id < numWorkers; id++) {
+            offsets[id][b] = position;
+            position += counts[id][b];
+        }
+    }
+    bucketStarts[numWorkers] = n;
+
+    vector<int> buffer(n);
+    runOnWorkers(numWorkers, [&](size_t id) {
+        vector<size_t> &offset = offsets[id];
+        for (size_t i = chunkStart(id); i < chunkStart(id + 1); i++) {
+            int value = numbers[i];
+            buffer[offset[bucketOf(value)]++] = value;
+        }
+    });
+    numbers.swap(buffer);
+
+    atomic<size_t> nextBucket(0);
+    runOnWorkers(numWorkers, [&](size_t id) {
+        for (size_t b = nextBucket++; b < numWorkers; b = nextBucket++) {
+            ssize_t start = bucketStarts[b], finish = bucketStarts[b + 1] - 1;
+            // leftmost, since the bucket before this one may be being sorted at the same time
+            introsort<true>(numbers, start, finish, depthLimitFor(finish - start + 1), true);
+        }
+    });
+}
+
 /**
  * Function: quicksort
  * -------------------
@@ -113,6 +741,89 @@ static void quicksort(vector<int> &numbers) {
     quicksort(numbers, 0, numbers.size() - 1);
 }
 
+/**
+ * Function: stdSort
+ * -----------------
+ * Sorts the supplied numbers with std::sort, as a baseline.
+ */
+static void stdSort(vector<int> &numbers) {
+    sort(numbers.begin(), numbers.end());
+}
+
+/**
+ * Functions: populateRandom, populateSorted, populateReversed, populateDuplicates
+ * -------------------------------------------------------------------------------
+ * Populate the supplied vector with numbers drawn from a wide range, with numbers
+ * already in sorted order, with numbers in reverse order, and with numbers drawn from
+ * just a handful of values, respectively.  populateSequence's numbers (drawn from
+ * [kMinValue, kMaxValue]) round out the distributions the benchmark can sort.
+ */
+static const int kRandomBound = 1 << 30;
+static const int kNumDuplicateValues = 16;
+static void populateRandom(vector<int> &numbers) {
+    RandomGenerator rgen;
+    for (int &n: numbers)
+        n = rgen.getNextInt(-kRandomBound, kRandomBound);
+}
+
+static void populateSorted(vector<int> &numbers) {
+    for (size_t i = 0; i < numbers.size(); i++)
+        numbers[i] = i;
+}
+
+static void populateReversed(vector<int> &numbers) {
+    for (size_t i = 0; i < numbers.size(); i++)
+        numbers[i] = numbers.size() - i;
+}
+
+static void populateDuplicates(vector<int> &numbers) {
+    RandomGenerator rgen;
+    for (int &n: numbers)
+        n = rgen.getNextInt(0, kNumDuplicateValues - 1);
+}
+
+/**
+ * Types: variant, distribution
+ * ----------------------------
+ * A variant pairs the name of a sorting function with the function itself
+ * and the most numbers it can sensibly sort (0 meaning there's no limit).  The
+ * thread-per-partition versions are capped because they create so many threads, and
+ * the sequential version because sorted input drives its recursion n levels deep.
+ * A distribution pairs a name with the function generating numbers of that shape.
+ */
+struct variant {
+    const char *name;
+    void (*sort)(vector<int> &);
+    size_t maxElements;
+};
+
+struct distribution {
+    const char *name;
+    void (*populate)(vector<int> &);
+};
+
+static const size_t kNumElements = 128; // don't make the number bigger than this for aggressive and conservative
+static const size_t kMaxSequentialElements = 1 << 16;
+static const variant kVariants[] = {
+    {"sequential", quicksort, kMaxSequentialElements},
+    {"aggressive", aggressiveQuicksort, kNumElements},
+    {"conservative", conservativeQuicksort, kNumElements},
+    {"scalar-introsort", scalarIntrosort, 0},
+    {"introsort", introsort, 0},
+    {"parallel", parallelQuicksort, 0},
+    {"radix", radixSort, 0},
+    {"sample", sampleSort, 0},
+    {"std-sort", stdSort, 0}
+};
+
+static const distribution kDistributions[] = {
+    {"range", populateSequence},
+    {"random", populateRandom},
+    {"sorted", populateSorted},
+    {"reversed", populateReversed},
+    {"duplicates", populateDuplicates}
+};
+
 /**
  * Function: usage
  * ---------------
@@ -121,45 +832,156 @@ static void quicksort(vector<int> &numbers) {
  */
 static void usage(const string &message) {
     cerr << "Error: " << message << endl;
-    cerr << "Usage: ./quicksort [--aggressive | --conservative | --sequential]" << endl;
+    cerr << "Usage: ./quicksort [--<variant> ... | --all] [--sizes <n>,...] [--distributions <name>,... | all]" << endl;
+    cerr << "Variants:";
+    for (const variant &v: kVariants) cerr << " " << v.name;
+    cerr << endl << "Distributions:";
+    for (const distribution &d: kDistributions) cerr << " " << d.name;
+    cerr << endl << "Sizes may carry a K, M, or G suffix (e.g. 1K, 10M, 1G)." << endl;
     exit(EXIT_FAILURE);
 }
 
+/**
+ * Function: split
+ * ---------------
+ * Splits the supplied comma-separated list into its items.
+ */
+static vector<string> split(const string &list) {
+    vector<string> items;
+    size_t start = 0;
+    while (true) {
+        size_t comma = list.find(',', start);
+        items.push_back(list.substr(start, comma - start));
+        if (comma == string::npos) return items;
+        start = comma + 1;
+    }
+}
+
+/**
+ * Function: parseSize
+ * -------------------
+ * Parses a number of elements, which may carry a K, M, or G suffix
+ * (for a thousand, a million, or a billion).
+ */
+static size_t parseSize(const string &size) {
+    char *end;
+    size_t n = strtoull(size.c_str(), &end, 10);
+    string suffix = end;
+    if (suffix == "K") n *= 1000;
+    else if (suffix == "M") n *= 1000 * 1000;
+    else if (suffix == "G") n *= 1000 * 1000 * 1000;
+    else if (!suffix.empty()) n = 0;
+    if (end == size.c_str() || n == 0) usage("\"" + size + "\" isn't a valid number of elements.");
+    return n;
+}
+
+/**
+ * Type: configuration
+ * -------------------
+ * Bundles everything the command line can specify: the variants to
+ * run, the sizes to run them on, and the distributions to draw from.
+ */
+struct configuration {
+    vector<const variant *> variants;
+    vector<size_t> sizes;
+    vector<const distribution *> distributions;
+};
+
 /**
  * Function: validateArgumentVector
  * --------------------------------
- * Validates the argument vector passed to main, and provided
- * everything looks correct, returns one of three strings to 
- * be clear which version of quicksort should be executed.
+ * Validates the argument vector passed to main, and provided everything
+ * looks correct, returns the configuration it describes.  Without any
+ * arguments, the sequential version sorts kNumElements numbers drawn
+ * by populateSequence, just as the lab has always done.
  */
-static string validateArgumentVector(char *argv[], int argc) {
-    if (argc == 1) return "sequential";
-    if (argc > 2) usage("Invoked with too many arguments.");
-    string flag = argv[1];
-    if (flag == "--aggressive" || flag == "--conservative" || flag == "--sequential")
-        return flag.substr(2);
-    usage("Second argument must be one of three different flags.");
-    assert(false); // can't get here, but g++ can't tell that
+static configuration validateArgumentVector(char *argv[], int argc) {
+    configuration config;
+    for (int i = 1; i < argc; i++) {
+        string flag = argv[i];
+        if (flag == "--all") {
+            for (const variant &v: kVariants) config.variants.push_back(&v);
+        } else if (flag == "--sizes" || flag == "--distributions") {
+            if (i + 1 == argc) usage(flag + " must be followed by a list.");
+            for (const string &item: split(argv[++i])) {
+                if (flag == "--sizes") {
+                    config.sizes.push_back(parseSize(item));
+                    continue;
+                }
+                bool found = false;
+                for (const distribution &d: kDistributions) {
+                    if (item == d.name || item == "all") {
+                        config.distributions.push_back(&d);
+                        found = true;
+                    }
+                }
+                if (!found) usage("\"" + item + "\" isn't a distribution.");
+            }
+        } else {
+            bool found = false;
+            for (const variant &v: kVariants) {
+                if (flag == string("--") + v.name) {
+                    config.variants.push_back(&v);
+                    found = true;
+                }
+            }
+            if (!found) usage("\"" + flag + "\" isn't a recognized flag.");
+        }
+    }
+    if (config.variants.empty()) config.variants.push_back(&kVariants[0]);
+    if (config.sizes.empty()) config.sizes.push_back(kNumElements);
+    if (config.distributions.empty()) config.distributions.push_back(&kDistributions[0]);
+    return config;
+}
+
+/**
+ * Function: benchmark
+ * -------------------
+ * Times the supplied variant on copies of the supplied input until either kMaxTrials
+ * trials or kMinSeconds of sorting have gone by, making sure every trial leaves the
+ * numbers sorted, and prints the number of elements sorted per second.  Returns
+ * false (having said so) if any trial doesn't leave the numbers sorted.
+ */
+static const size_t kMaxTrials = 1000;
+static const double kMinSeconds = 0.5;
+static bool benchmark(const variant &v, const distribution &d, const vector<int> &input) {
+    cout << left << setw(18) << v.name << setw(12) << d.name << right << setw(12) << input.size() << flush;
+    if (v.maxElements != 0 && input.size() > v.maxElements) {
+        cout << "  skipped (limited to " << v.maxElements << " elements)" << endl;
+        return true;
+    }
+    vector<int> numbers;
+    size_t trials = 0;
+    chrono::duration<double> elapsed(0);
+    while (trials < kMaxTrials && elapsed.count() < kMinSeconds) {
+        numbers = input;
+        auto start = chrono::steady_clock::now();
+        v.sort(numbers);
+        elapsed += chrono::steady_clock::now() - start;
+        trials++;
+        if (!is_sorted(numbers.cbegin(), numbers.cend())) {
+            cout << "  \033[1;31mFAILED!\033[0m on trial #" << trials << endl;
+            cout << v.name << " is \033[1;31mBROKEN.... please fix!\033[0m" << endl;
+            return false;
+        }
+    }
+    cout << setw(8) << trials << fixed << setprecision(0) << setw(16)
+         << trials * input.size() / elapsed.count() << " elements/sec" << endl;
+    return true;
 }
 
-static const size_t kNumElements = 128; // don't make the number bigger than this
 int main(int argc, char *argv[]) {
-    string version = validateArgumentVector(argv, argc);
-    void (*qsfn)(vector<int> &) = quicksort;
-    if (version == "aggressive") qsfn = aggressiveQuicksort;
-    else if (version == "conservative") qsfn = conservativeQuicksort;
-    for (size_t trial = 1; trial <= 1000; trial++) {
-        vector<int> numbers(kNumElements);
-        populateSequence(numbers);
-        qsfn(numbers);
-        bool sorted = is_sorted(numbers.cbegin(), numbers.cend());
-        cout << "\rTrial #" << setw(4) << setfill('0') << trial << ": "
-             << (sorted ? "\033[1;34mSUCCEEDED!\033[0m" : "\033[1;31mFAILED!   \033[0m") << flush;
-        if (!sorted) {
-            cout << endl << "quicksort is \033[1;31mBROKEN.... please fix!\033[0m" << flush;
-            break;
-        }
-    }
-    cout << endl;
+    configuration config = validateArgumentVector(argv, argc);
+    cout << left << setw(18) << "variant" << setw(12) << "numbers" << right << setw(12) << "size"
+         << setw(8) << "trials" << setw(16) << "throughput" << endl;
+    for (size_t size: config.sizes) {
+        for (const distribution *d: config.distributions) {
+            vector<int> input(size);
+            d->populate(input);
+            for (const variant *v: config.variants) {
+                if (!benchmark(*v, *d, input)) return 1;
+            }
+        }
+    }
     return 0;
 }